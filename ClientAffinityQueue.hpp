@@ -0,0 +1,683 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <stop_token>
+
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/deque.hpp>
+
+#include "Platform.hpp"
+#include "WaitStrategy.hpp"
+#include "RingBuffer.hpp"
+#include "QueueClosed.hpp"
+
+namespace threadsafe_containers
+{
+
+/// \brief Threadsafe queue that routes elements of a client to one consumer.
+///        There is a shard per consumer, a consumer thread is bound to a shard on it's first pop
+///        and takes elements only from it. A client is assigned to the shard of the hash of it's id.
+///        If that consumer saturated (it's shard is full or it serves MAX_CLIENTS clients already),
+///        the client is assigned to the least loaded consumer which may take one more client.
+///        A client keeps it's consumer while it has elements in queue or the consumer handles
+///        it's last element, i.e. until the consumer comes for the next element.
+///        So elements of a client are handled one by one in FIFO order and each consumer
+///        serves MAX_CLIENTS clients at most. Has the same public API as Queue.
+/// \tparam SIZE Default capacity of a shard.
+/// \tparam MAX_CLIENTS Default number of clients a consumer may serve at a time.
+/// \tparam ClientOf Returns client id of an element, used by push operations without client id.
+/// \note  A shard has it's own lock, assignments of clients are split into as many directories
+///        by client id, each with it's own lock. So producers of different clients and consumers
+///        of different shards don't contend.
+/// \note  If the shard of a client is full, the client is moved with it's elements to the least
+///        loaded consumer which may take it, unless it's consumer handles an element of it now.
+///        Elements keep their order, so it doesn't break per-client order.
+///        There is no work stealing: it would break per-client order and the cap of clients.
+/// \note  Waits on a closed queue don't block (see close).
+template<typename T, std::size_t SIZE = 2, std::size_t MAX_CLIENTS = 4,
+         typename ClientOf = std::hash<T>> class ClientAffinityQueue
+{
+    static_assert(SIZE > 0, "Shard must have at least one slot");
+    static_assert(MAX_CLIENTS > 0, "Consumer must serve at least one client");
+
+public:
+    using value_type = T;
+    using pointer_type = std::unique_ptr<T>;
+    using client_id_t = std::size_t;
+
+    /// \brief Lets producer_consumer::Framework create a shard per consumer.
+    static constexpr bool is_sharded {true};
+
+    /// \brief A shard per hardware thread.
+    ClientAffinityQueue():
+        ClientAffinityQueue{std::max<std::size_t>(std::thread::hardware_concurrency(), 1)}
+    {}
+
+    /// \throws std::invalid_argument
+    explicit ClientAffinityQueue(std::size_t num_of_shards, std::size_t shard_capacity = SIZE,
+                                 std::size_t max_clients = MAX_CLIENTS):
+        m_max_clients{max_clients}
+    {
+        if(num_of_shards == 0)
+            throw std::invalid_argument{"Number of shards must be positive"};
+        if(shard_capacity == 0)
+            throw std::invalid_argument{"Capacity must be positive"};
+        if(max_clients == 0)
+            throw std::invalid_argument{"Consumer must serve at least one client"};
+        m_shards.reserve(num_of_shards);
+        m_directories.reserve(num_of_shards);
+        for(std::size_t cntr {0}; cntr < num_of_shards; ++cntr)
+        {
+            m_shards.emplace_back(std::make_unique<Shard>(cntr, shard_capacity));
+            m_directories.emplace_back(std::make_unique<Directory>());
+        }
+    }
+
+    ClientAffinityQueue(const ClientAffinityQueue&) = delete;
+    ClientAffinityQueue(ClientAffinityQueue&&) = delete;
+    ClientAffinityQueue& operator=(const ClientAffinityQueue&) = delete;
+    ClientAffinityQueue& operator=(ClientAffinityQueue&&) = delete;
+
+    ~ClientAffinityQueue() = default;
+
+    /// \brief  Push value of client ClientOf{}(v) into queue.
+    /// \return False if there is no space for \b v, true otherwise.
+    [[nodiscard]] bool push(T v)
+    {
+        const auto client {ClientOf{}(v)};
+        return push(client, std::move(v));
+    }
+
+    /// \brief  Push value of \b client into queue.
+    /// \return False if the shard of \b client is full and it may not be moved,
+    ///         or no consumer may take one more client, true otherwise.
+    [[nodiscard]] bool push(client_id_t client, T v)
+    {
+        return enqueue(client, v);
+    }
+
+    /// \brief  Dequeue element of the calling consumer and place it's value into \b v.
+    /// \return False if the shard of consumer is empty, \b v keeps it's value.
+    ///         True otherwise, \b v contains dequeued value.
+    [[nodiscard]] bool pop(T& v)
+    {
+        return dequeue(v);
+    }
+
+    /// \brief  Dequeue element of the calling consumer and return it's value.
+    /// \return nullptr if the shard of consumer is empty, dequeued value otherwise.
+    [[nodiscard]] pointer_type pop()
+    {
+        pointer_type p;
+        (void)dequeue(p);
+        return p;
+    }
+
+    /// \brief  Dequeue element without allocation.
+    /// \return std::nullopt if the shard of consumer is empty, dequeued value otherwise.
+    [[nodiscard]] std::optional<T> try_pop()
+    {
+        std::optional<T> v;
+        (void)dequeue(v);
+        return v;
+    }
+
+    /// \brief Wait until queue is empty.
+    /// \throws QueueClosed If queue is closed while it's empty.
+    void wait_until_empty()
+    {
+        m_pushed.wait_until([this]{ return !empty() || closed(); });
+        if(empty())
+            throw QueueClosed{};
+    }
+
+    /// \brief Wait until queue is full.
+    /// \throws QueueClosed If queue is closed while it's full.
+    void wait_until_full()
+    {
+        m_space_available.wait_until([this]{ return !full() || closed(); });
+        if(full())
+            throw QueueClosed{};
+    }
+
+    /// \return True if queue is empty, false otherwise.
+    [[nodiscard]] bool empty() const
+    {
+        return size() == 0;
+    }
+
+    /// \return True if queue is false, false otherwise.
+    [[nodiscard]] bool full() const
+    {
+        return !(size() < max_size());
+    }
+
+    /// \brief Wait if there is no space for \b v, push it into queue.
+    void wait_and_push(T v)
+    {
+        const auto client {ClientOf{}(v)};
+        wait_and_push(client, std::move(v));
+    }
+
+    /// \brief  Wait if there is no space for \b v of \b client, push it into queue.
+    /// \throws QueueClosed If queue is closed while there is no space.
+    void wait_and_push(client_id_t client, T v)
+    {
+        bool pushed {false};
+        m_space_available.wait_until([this, client, &v, &pushed]{ return (pushed = enqueue(client, v)) || closed(); });
+        if(!pushed)
+            throw QueueClosed{};
+    }
+
+    /// \brief  Wait if there is no space for \b v, push it into queue.
+    ///         The wait is cancelled when stop is requested on \b stop_token.
+    /// \return False if stop is requested or queue is closed while there is no space, true otherwise.
+    [[nodiscard]] bool wait_and_push(T v, std::stop_token stop_token)
+    {
+        const std::stop_callback on_stop {stop_token, [this]{ wake_all(); }};
+        const auto client {ClientOf{}(v)};
+        bool pushed {false};
+        m_space_available.wait_until([this, client, &v, &pushed, &stop_token]
+                                     { return (pushed = enqueue(client, v)) || stop_token.stop_requested() || closed(); });
+        return pushed;
+    }
+
+    /// \brief  Wait until the shard of consumer is not empty, dequeue element and place it's value into \b v.
+    /// \throws QueueClosed If queue is closed while the shard is empty.
+    void wait_and_pop(T& v)
+    {
+        bool popped {false};
+        own_shard().m_not_empty.wait_until([this, &v, &popped]{ return (popped = dequeue(v)) || closed(); });
+        if(!popped)
+            throw QueueClosed{};
+    }
+
+    /// \brief  Wait until the shard of consumer is not empty, dequeue element and return it's value.
+    /// \throws QueueClosed If queue is closed while the shard is empty.
+    [[nodiscard]] pointer_type wait_and_pop()
+    {
+        pointer_type p;
+        own_shard().m_not_empty.wait_until([this, &p]{ return dequeue(p) || closed(); });
+        if(!p)
+            throw QueueClosed{};
+        return p;
+    }
+
+    /// \brief  Wait until the shard of consumer is not empty or \b exit_condition is true,
+    ///         dequeue element and place it's value into \b v.
+    /// \return False if exit condition is met or queue is closed on empty shard, \b v keeps it's value.
+    template<typename P>
+    [[nodiscard]] bool wait_and_pop(T& v, P exit_condition)
+    {
+        bool popped {false};
+        own_shard().m_not_empty.wait_until([this, &v, &popped, &exit_condition]
+                                           { return (popped = dequeue(v)) || exit_condition() || closed(); });
+        return popped;
+    }
+
+    /// \brief  Wait until the shard of consumer is not empty, dequeue element and place it's value into \b v.
+    ///         The wait is cancelled when stop is requested on \b stop_token,
+    ///         so elements left in the shard are still dequeued after that.
+    /// \return False if stop is requested on empty shard, \b v keeps it's value.
+    [[nodiscard]] bool wait_and_pop(T& v, std::stop_token stop_token)
+    {
+        const std::stop_callback on_stop {stop_token, [this]{ wake_all(); }};
+        return wait_and_pop(v, [&stop_token]{ return stop_token.stop_requested(); });
+    }
+
+    template<typename P>
+    [[nodiscard]] pointer_type wait_and_pop(P exit_condition)
+    {
+        pointer_type p;
+        own_shard().m_not_empty.wait_until([this, &p, &exit_condition]{ return dequeue(p) || exit_condition() || closed(); });
+        return p;
+    }
+
+    /// \brief Drop all elements and assignments of clients.
+    void clear()
+    {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        locks.reserve(m_directories.size() + m_shards.size());
+        for(auto& directory:m_directories)
+            locks.emplace_back(directory->m_mutex);
+        for(auto& shard:m_shards)
+            locks.emplace_back(shard->m_mutex);
+        for(auto& directory:m_directories)
+            directory->m_clients.clear();
+        for(auto& shard:m_shards)
+        {
+            shard->m_buffer.clear();
+            shard->m_size.store(0, std::memory_order_relaxed);
+            shard->m_clients.store(0, std::memory_order_relaxed);
+            shard->m_last_client.reset();
+        }
+        m_size.store(0, std::memory_order_relaxed);
+        locks.clear();
+        m_space_available.notify_all();
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return m_size.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::size_t max_size() const noexcept
+    {
+        return m_shards.size() * m_shards.front()->m_buffer.capacity();
+    }
+
+    [[nodiscard]] std::size_t num_of_shards() const noexcept
+    {
+        return m_shards.size();
+    }
+
+    [[nodiscard]] std::size_t max_clients() const noexcept
+    {
+        return m_max_clients;
+    }
+
+    /// \return Size of shard \b index.
+    [[nodiscard]] std::size_t shard_size(std::size_t index) const noexcept
+    {
+        return m_shards[index]->m_size.load(std::memory_order_relaxed);
+    }
+
+    /// \return Number of clients assigned to the consumer of shard \b index.
+    [[nodiscard]] std::size_t num_of_clients(std::size_t index) const noexcept
+    {
+        return m_shards[index]->m_clients.load(std::memory_order_relaxed);
+    }
+
+    /// \return Shard \b client is assigned to, std::nullopt if it isn't assigned.
+    [[nodiscard]] std::optional<std::size_t> shard_of(client_id_t client) const
+    {
+        const auto& directory {directory_of(client)};
+        std::scoped_lock lk {directory.m_mutex};
+        const auto it {directory.m_clients.find(client)};
+        if(it == directory.m_clients.end())
+            return std::nullopt;
+        return it->second.m_shard;
+    }
+
+    /// \brief Close queue for waiting: threads blocked on it are woken and waits don't block
+    ///        any more (see Queue::close). Elements left in queue are still dequeued.
+    void close()
+    {
+        m_closed.store(true, std::memory_order_relaxed);
+        wake_all();
+    }
+
+    /// \brief Let waits block again.
+    void open() noexcept
+    {
+        m_closed.store(false, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool closed() const noexcept
+    {
+        return m_closed.load(std::memory_order_relaxed);
+    }
+
+    /// \note Must not be called concurrently with operations which modify queue.
+    [[nodiscard]] friend bool operator==(const ClientAffinityQueue& l, const ClientAffinityQueue& r)
+    {
+        return l.contents() == r.contents();
+    }
+
+private:
+    using element_t = std::pair<client_id_t, T>;
+
+    struct Client
+    {
+        std::size_t m_shard {0};
+        std::size_t m_pending {0}; ///< elements in queue
+    };
+
+    /// \brief Assignments of clients, whose ids fall into it. Locked before shards.
+    struct alignas(cache_line_size) Directory
+    {
+        std::unordered_map<client_id_t, Client> m_clients;
+        mutable std::mutex m_mutex;
+    };
+
+    /// \note Counters are written under the lock of the shard and read without it
+    ///       to pick a shard for a client.
+    struct alignas(cache_line_size) Shard
+    {
+        Shard(std::size_t index, std::size_t capacity):
+            m_index{index},
+            m_buffer{capacity}
+        {}
+
+        [[nodiscard]] bool full() const noexcept
+        {
+            return !(m_buffer.size() < m_buffer.capacity());
+        }
+
+        [[nodiscard]] std::size_t space() const noexcept
+        {
+            return m_buffer.capacity() - m_size.load(std::memory_order_relaxed);
+        }
+
+        const std::size_t m_index;
+        RingBuffer<element_t> m_buffer;
+        std::atomic<std::size_t> m_size {0};
+        std::atomic<std::size_t> m_clients {0};
+        /// \brief Client of the element the consumer handles now.
+        std::optional<client_id_t> m_last_client;
+        mutable std::mutex m_mutex;
+        EventCount m_not_empty;
+    };
+
+    /// \brief Must be called under the lock of \b shard, so size of queue never drops below zero.
+    void push(Shard& shard, client_id_t client, T& v)
+    {
+        shard.m_buffer.emplace_back(client, std::move(v));
+        shard.m_size.store(shard.m_buffer.size(), std::memory_order_relaxed);
+        m_size.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] Directory& directory_of(client_id_t client) const noexcept
+    {
+        return *m_directories[std::hash<client_id_t>{}(client) % m_directories.size()];
+    }
+
+    [[nodiscard]] bool has_room_for_client(const Shard& shard, std::size_t num_of_elements) const noexcept
+    {
+        return shard.m_clients.load(std::memory_order_relaxed) < m_max_clients && shard.space() >= num_of_elements;
+    }
+
+    /// \brief  Least loaded shard other than \b except, which may take one more client with
+    ///         \b num_of_elements elements. Read without locks, so it's a guess to be checked.
+    [[nodiscard]] std::optional<std::size_t> least_loaded(std::size_t num_of_elements,
+                                                          std::optional<std::size_t> except = std::nullopt) const noexcept
+    {
+        std::optional<std::size_t> best;
+        for(std::size_t cntr {0}; cntr < m_shards.size(); ++cntr)
+        {
+            const auto& shard {*m_shards[cntr]};
+            if(cntr == except || !has_room_for_client(shard, num_of_elements))
+                continue;
+            const auto& other {*m_shards[best.value_or(cntr)]};
+            if(!best || shard.m_size < other.m_size || (shard.m_size == other.m_size && shard.m_clients < other.m_clients))
+                best = cntr;
+        }
+        return best;
+    }
+
+    /// \brief  Must be called under the lock of the directory of \b client, which isn't assigned.
+    ///         Assign \b client to the shard of it's hash, or the least loaded one if that
+    ///         consumer saturated, and push \b v there.
+    /// \return Shard of \b client, std::nullopt if no consumer may take it.
+    [[nodiscard]] std::optional<std::size_t> assign(client_id_t client, T& v)
+    {
+        std::optional<std::size_t> index {std::hash<client_id_t>{}(client) % m_shards.size()};
+        // counters may change before the shard is locked, so a few shards are tried
+        for(std::size_t attempt {0}; index && attempt < m_shards.size(); ++attempt)
+        {
+            auto& shard {*m_shards[*index]};
+            std::scoped_lock lk {shard.m_mutex};
+            if(shard.m_clients.load(std::memory_order_relaxed) < m_max_clients && !shard.full())
+            {
+                push(shard, client, v);
+                shard.m_clients.store(shard.m_clients.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return index;
+            }
+            index = least_loaded(1);
+        }
+        return std::nullopt;
+    }
+
+    /// \brief  Must be called under the lock of the directory of \b client.
+    ///         Push \b v into the shard of \b client. If it's full, move \b client with it's
+    ///         elements to the least loaded shard, which may take it, and push \b v there.
+    /// \return False if the shard is full and it's consumer handles an element of \b client
+    ///         or no consumer may take it.
+    [[nodiscard]] bool push_or_migrate(client_id_t client, Client& assignment, T& v)
+    {
+        auto& from {*m_shards[assignment.m_shard]};
+        {
+            std::scoped_lock lk {from.m_mutex};
+            if(!from.full())
+            {
+                push(from, client, v);
+                return true;
+            }
+            if(from.m_last_client == client)
+                return false;
+        }
+        const auto index {least_loaded(assignment.m_pending + 1, assignment.m_shard)};
+        if(!index)
+            return false;
+        auto& to {*m_shards[*index]};
+        {
+            std::scoped_lock lk {from.m_mutex, to.m_mutex};
+            if(!from.full())
+            {
+                push(from, client, v);
+                return true;
+            }
+            if(from.m_last_client == client || to.m_clients.load(std::memory_order_relaxed) >= m_max_clients ||
+               to.m_buffer.capacity() - to.m_buffer.size() < assignment.m_pending + 1)
+                return false;
+            // elements of other clients keep their places, elements of the client keep their order
+            for(auto left {from.m_buffer.size()}; left; --left)
+            {
+                auto element {std::move(from.m_buffer.front())};
+                from.m_buffer.pop_front();
+                (element.first == client ? to.m_buffer : from.m_buffer).emplace_back(std::move(element));
+            }
+            push(to, client, v);
+            from.m_size.store(from.m_buffer.size(), std::memory_order_relaxed);
+            from.m_clients.store(from.m_clients.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+            to.m_clients.store(to.m_clients.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        assignment.m_shard = *index;
+        // space is freed in the shard the client is moved from
+        m_space_available.notify_all();
+        return true;
+    }
+
+    /// \brief \b v is left untouched if there is no space for it.
+    [[nodiscard]] bool enqueue(client_id_t client, T& v)
+    {
+        std::size_t index {0};
+        {
+            auto& directory {directory_of(client)};
+            std::scoped_lock lk {directory.m_mutex};
+            auto it {directory.m_clients.find(client)};
+            if(it == directory.m_clients.end())
+            {
+                const auto assigned {assign(client, v)};
+                if(!assigned)
+                    return false;
+                directory.m_clients.emplace(client, Client{*assigned, 1});
+                index = *assigned;
+            }
+            else
+            {
+                auto& assignment {it->second};
+                if(!push_or_migrate(client, assignment, v))
+                    return false;
+                ++assignment.m_pending;
+                index = assignment.m_shard;
+            }
+        }
+        m_shards[index]->m_not_empty.notify_all();
+        m_pushed.notify_all();
+        return true;
+    }
+
+    /// \brief Dequeue element of the calling consumer. Releases the client
+    ///        of the previous element if it has no more elements.
+    template<typename Out> [[nodiscard]] bool dequeue(Out& out)
+    {
+        auto& shard {own_shard()};
+        release_last_client(shard);
+        for(;;)
+        {
+            client_id_t client {0};
+            {
+                std::scoped_lock lk {shard.m_mutex};
+                if(shard.m_buffer.empty())
+                    return false;
+                client = shard.m_buffer.front().first;
+            }
+            // pending elements of a client are counted under the lock of it's directory,
+            // the front element may change before both locks are taken
+            auto& directory {directory_of(client)};
+            std::scoped_lock lk {directory.m_mutex, shard.m_mutex};
+            if(shard.m_buffer.empty() || shard.m_buffer.front().first != client)
+                continue;
+            auto& value {shard.m_buffer.front().second};
+            if constexpr(std::is_same_v<Out, pointer_type>)
+                out = std::make_unique<T>(std::move(value));
+            else
+                out = std::move(value);
+            --directory.m_clients[client].m_pending;
+            shard.m_last_client = client;
+            shard.m_buffer.pop_front();
+            shard.m_size.store(shard.m_buffer.size(), std::memory_order_relaxed);
+            m_size.fetch_sub(1, std::memory_order_relaxed);
+            break;
+        }
+        m_space_available.notify_all();
+        return true;
+    }
+
+    void release_last_client(Shard& shard)
+    {
+        std::optional<client_id_t> client;
+        {
+            std::scoped_lock lk {shard.m_mutex};
+            client = shard.m_last_client;
+        }
+        if(!client)
+            return;
+        bool released {false};
+        {
+            auto& directory {directory_of(*client)};
+            std::scoped_lock lk {directory.m_mutex, shard.m_mutex};
+            if(shard.m_last_client != client)
+                return;
+            shard.m_last_client.reset();
+            const auto it {directory.m_clients.find(*client)};
+            if(it != directory.m_clients.end() && !it->second.m_pending && it->second.m_shard == shard.m_index)
+            {
+                directory.m_clients.erase(it);
+                shard.m_clients.store(shard.m_clients.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+                released = true;
+            }
+        }
+        // a producer may wait for a consumer which may take one more client
+        if(released)
+            m_space_available.notify_all();
+    }
+
+    /// \brief Shard of the calling consumer. A thread is bound to a shard of each queue on it's first pop.
+    /// \note  A thread keeps bindings to the last few queues it used, so a thread, that alternates
+    ///        between queues, keeps it's shard and it's clients in each of them.
+    [[nodiscard]] Shard& own_shard()
+    {
+        struct Binding
+        {
+            std::uint64_t queue_id {0};
+            std::size_t shard {0};
+        };
+        static constexpr std::size_t max_bindings {16};
+        thread_local std::vector<Binding> bindings;
+        const auto it {std::ranges::find(bindings, m_id, &Binding::queue_id)};
+        if(it != bindings.end())
+            return *m_shards[it->shard];
+        // ids of destroyed queues are never reused, so the oldest binding is forgotten
+        if(bindings.size() == max_bindings)
+            bindings.erase(bindings.begin());
+        bindings.push_back({m_id, m_next_consumer.fetch_add(1, std::memory_order_relaxed) % m_shards.size()});
+        return *m_shards[bindings.back().shard];
+    }
+
+    [[nodiscard]] static std::uint64_t make_id() noexcept
+    {
+        static std::atomic<std::uint64_t> last_id {0};
+        return ++last_id;
+    }
+
+    /// \brief Wake all parked threads, e.g. to let them check a stop request.
+    void wake_all()
+    {
+        for(auto& shard:m_shards)
+            shard->m_not_empty.notify_all();
+        m_pushed.notify_all();
+        m_space_available.notify_all();
+    }
+
+    /// \brief Copy of elements of all shards, shard by shard.
+    [[nodiscard]] std::deque<T> contents() const
+    {
+        std::deque<T> q;
+        for(const auto& shard:m_shards)
+        {
+            std::scoped_lock lk {shard->m_mutex};
+            for(std::size_t cntr {0}; cntr < shard->m_buffer.size(); ++cntr)
+                q.push_back(shard->m_buffer[cntr].second);
+        }
+        return q;
+    }
+
+
+    friend class boost::serialization::access;
+    // Elements of all shards are stored as one std::deque<T> under the same name
+    // as in Queue, so archives of both queues are interchangeable.
+    template<class Archive>
+    void save(Archive& ar, [[maybe_unused]] const unsigned int version) const
+    {
+        const auto q {contents()};
+        ar & boost::serialization::make_nvp("m_queue", q);
+    }
+
+    /// \brief Clients of loaded elements are taken with ClientOf and assigned anew.
+    /// \throws std::length_error if loaded elements don't fit into queue
+    template<class Archive>
+    void load(Archive& ar, [[maybe_unused]] const unsigned int version)
+    {
+        std::deque<T> q;
+        ar & boost::serialization::make_nvp("m_queue", q);
+        clear();
+        for(auto& v:q)
+        {
+            if(!enqueue(ClientOf{}(v), v))
+                throw std::length_error{"Archive holds more elements than queue may keep"};
+        }
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+
+    const std::uint64_t m_id {make_id()};
+    const std::size_t m_max_clients {MAX_CLIENTS};
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::vector<std::unique_ptr<Directory>> m_directories;
+    std::atomic<std::size_t> m_next_consumer {0};
+    alignas(cache_line_size) std::atomic<std::size_t> m_size {0};
+    alignas(cache_line_size) EventCount m_pushed;
+    alignas(cache_line_size) EventCount m_space_available;
+    std::atomic_bool m_closed {false};
+};
+
+}
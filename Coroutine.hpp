@@ -0,0 +1,160 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+namespace threadsafe_containers
+{
+
+/// \brief Resumes coroutines suspended on queues (see Queue::async_pop, Queue::async_push).
+///        A coroutine is resumed by the scheduler of the thread that suspended it.
+class Scheduler
+{
+public:
+    virtual ~Scheduler() = default;
+
+    /// \brief Resume \b handle, e.g. by a worker thread. Must not resume it in the calling thread:
+    ///        it's called by a producer or a consumer at the end of a queue operation.
+    ///        The queue lock is released by then, so it may block.
+    virtual void schedule(std::coroutine_handle<> handle) = 0;
+
+    /// \return Scheduler of the calling thread, nullptr if the thread doesn't belong to a scheduler.
+    [[nodiscard]] static Scheduler*& current() noexcept
+    {
+        thread_local Scheduler* scheduler {nullptr};
+        return scheduler;
+    }
+};
+
+/// \brief Coroutine, that is run when it's awaited (co_await task) or when it's started on a scheduler.
+///        A started task is detached: it's frame is destroyed when the coroutine is done.
+class Task
+{
+public:
+    struct promise_type
+    {
+        [[nodiscard]] Task get_return_object() noexcept
+        {
+            return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        [[nodiscard]] std::suspend_always initial_suspend() const noexcept
+        {
+            return {};
+        }
+
+        /// \brief Resume the awaiting coroutine, or destroy the frame of a detached task.
+        struct FinalAwaiter
+        {
+            [[nodiscard]] bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            [[nodiscard]] std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) const noexcept
+            {
+                auto& promise {handle.promise()};
+                if(promise.m_continuation)
+                    return promise.m_continuation;
+                // nobody may rethrow exception of a detached task
+                if(promise.m_exception)
+                    std::terminate();
+                handle.destroy();
+                return std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept
+            {}
+        };
+
+        [[nodiscard]] FinalAwaiter final_suspend() const noexcept
+        {
+            return {};
+        }
+
+        void return_void() const noexcept
+        {}
+
+        void unhandled_exception() noexcept
+        {
+            m_exception = std::current_exception();
+        }
+
+        std::coroutine_handle<> m_continuation;
+        std::exception_ptr m_exception;
+    };
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    Task(Task&& other) noexcept:
+        m_handle{std::exchange(other.m_handle, {})}
+    {}
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if(this != &other)
+        {
+            destroy();
+            m_handle = std::exchange(other.m_handle, {});
+        }
+        return *this;
+    }
+
+    ~Task()
+    {
+        destroy();
+    }
+
+    /// \brief Run the task by \b scheduler and detach it.
+    /// \note  An exception escaping a detached task terminates the program.
+    void start(Scheduler& scheduler) &&
+    {
+        scheduler.schedule(std::exchange(m_handle, {}));
+    }
+
+    /// \brief co_await task runs the task in the awaiting thread and resumes the awaiting coroutine
+    ///        when it's done. Exception of the task is rethrown to the awaiting coroutine.
+    struct Awaiter
+    {
+        [[nodiscard]] bool await_ready() const noexcept
+        {
+            return !m_handle || m_handle.done();
+        }
+
+        [[nodiscard]] std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) const noexcept
+        {
+            m_handle.promise().m_continuation = awaiting;
+            return m_handle;
+        }
+
+        void await_resume() const
+        {
+            if(m_handle && m_handle.promise().m_exception)
+                std::rethrow_exception(m_handle.promise().m_exception);
+        }
+
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+    [[nodiscard]] Awaiter operator co_await() const& noexcept
+    {
+        return Awaiter{m_handle};
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) noexcept:
+        m_handle{handle}
+    {}
+
+    void destroy() noexcept
+    {
+        if(m_handle)
+            m_handle.destroy();
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+}
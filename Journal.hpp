@@ -0,0 +1,462 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <string>
+#include <deque>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+#include <stdexcept>
+#include <exception>
+#include <optional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <type_traits>
+
+#include <functional>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include "JournalHook.hpp"
+
+namespace threadsafe_containers
+{
+
+namespace fs = std::filesystem;
+
+/// \brief Counters of Journal.
+struct JournalStats
+{
+    std::uint64_t records {0};     ///< journaled pushes and pops
+    std::uint64_t commits {0};     ///< fdatasync calls, each one commits a group of records
+    std::uint64_t compactions {0}; ///< snapshots, that replaced the log
+};
+
+/// \brief Write-ahead log of queue operations, see Queue::set_journal.
+///        A push is journaled as a record with the element and a pop as a record with a count,
+///        so the cost of an operation doesn't depend on queue size. Records are appended to
+///        a buffer under the queue lock. A writer thread writes the buffer every commit interval
+///        and commits it with one fdatasync (_commit on Windows, group commit), flush() waits for it.
+///        When the log outgrows both compaction size and the last snapshot, queue elements are
+///        taken as a new snapshot and the log starts anew, so compaction costs O(1) per record.
+/// \note  Directory keeps snapshot.N with the elements at the start of generation N and wal.N
+///        with records after it. A snapshot is renamed into place after it's synced, so a crash
+///        leaves either the old generation or the new one. A torn record at the end of log is ignored.
+///        If the snapshot isn't written, records it supersedes are written to the old log instead.
+/// \note  Elements are written as bytes if T is trivially copyable, with a boost binary archive otherwise.
+template<typename T> class Journal: public JournalHook<T>
+{
+public:
+    static constexpr std::size_t default_compaction_size {64 << 20};
+
+    /// \throws std::filesystem::filesystem_error
+    explicit Journal(fs::path directory, std::chrono::microseconds commit_interval = std::chrono::milliseconds(1),
+                     std::size_t compaction_size = default_compaction_size):
+        m_directory{std::move(directory)},
+        m_commit_interval{commit_interval},
+        m_compaction_size{compaction_size},
+        m_encode{&Journal::encode}
+    {
+        fs::create_directories(m_directory);
+        m_generation = last_generation();
+        m_writer = std::thread{[this]{ commit(); }};
+    }
+
+    Journal(const Journal&) = delete;
+    Journal(Journal&&) = delete;
+    Journal& operator=(const Journal&) = delete;
+    Journal& operator=(Journal&&) = delete;
+
+    /// \brief Commit the records journaled so far.
+    ~Journal() override
+    {
+        {
+            std::scoped_lock lk {m_mutex};
+            m_stopping = true;
+        }
+        m_on_pending.notify_one();
+        m_writer.join();
+        if(m_log >= 0)
+            close(m_log);
+    }
+
+    /// \brief  Push elements of the last generation into \b queue.
+    ///         Must be called before the journal is attached to a queue.
+    /// \return Number of pushed elements.
+    /// \throws std::length_error If queue has no space for them.
+    template<typename Queue>
+    std::size_t replay(Queue& queue) const
+    {
+        std::deque<T> elements;
+        const auto generation {last_generation()};
+        if(generation)
+            read(file("snapshot", generation), elements);
+        read(file("wal", generation), elements);
+        for(auto& v:elements)
+        {
+            if(!queue.push(std::move(v)))
+                throw std::length_error{"Queue has no space for journaled elements"};
+        }
+        return elements.size();
+    }
+
+    /// \brief Wait until the records journaled so far are on disk.
+    /// \throws std::system_error If the writer failed to write them.
+    void flush()
+    {
+        std::unique_lock lk {m_mutex};
+        const auto sequence {m_appended};
+        m_flush = true;
+        m_on_pending.notify_one();
+        m_on_durable.wait(lk, [this, sequence]{ return m_durable >= sequence; });
+        if(m_error)
+            std::rethrow_exception(m_error);
+    }
+
+    [[nodiscard]] JournalStats stats() const
+    {
+        std::scoped_lock lk {m_mutex};
+        return m_stats;
+    }
+
+    /// \brief Journal a push of \b v. Called by queue under it's lock.
+    void on_push(const T& v) override
+    {
+        std::scoped_lock lk {m_mutex};
+        const auto size {m_records.size()};
+        m_encode(m_records, v);
+        m_log_size += m_records.size() - size;
+        ++m_appended;
+        ++m_stats.records;
+    }
+
+    /// \brief Journal \b n pops. Called by queue under it's lock.
+    void on_pop(std::size_t n) override
+    {
+        std::scoped_lock lk {m_mutex};
+        m_records.push_back(pop_record);
+        append(m_records, static_cast<std::uint32_t>(n));
+        m_log_size += record_header_size;
+        ++m_appended;
+        ++m_stats.records;
+    }
+
+    /// \return True if queue should pass it's elements to snapshot(). Called by queue under it's lock.
+    [[nodiscard]] bool needs_compaction() const noexcept override
+    {
+        return m_log_size > std::max(m_compaction_size, m_snapshot_size);
+    }
+
+    /// \brief Start a new generation with \b size elements. Records, that aren't written yet,
+    ///        are superseded by the snapshot: they are dropped once the snapshot is in place.
+    ///        Called by queue under it's lock.
+    void snapshot(std::size_t size, const std::function<const T&(std::size_t)>& element) override
+    {
+        std::string snapshot;
+        for(std::size_t cntr {0}; cntr < size; ++cntr)
+            m_encode(snapshot, element(cntr));
+        std::scoped_lock lk {m_mutex};
+        m_log_size = 0;
+        m_snapshot_size = snapshot.size();
+        m_snapshot = std::move(snapshot);
+        m_superseded = m_records.size();
+        ++m_appended;
+        ++m_stats.compactions;
+    }
+
+private:
+    static constexpr char push_record {'+'};
+    static constexpr char pop_record {'-'};
+    static constexpr std::size_t record_header_size {1 + sizeof(std::uint32_t)};
+
+    static void append(std::string& buffer, std::uint32_t n)
+    {
+        buffer.append(reinterpret_cast<const char*>(&n), sizeof(n));
+    }
+
+    /// \brief Append a push record: kind, size of element and element.
+    static void encode(std::string& buffer, const T& v)
+    {
+        buffer.push_back(push_record);
+        if constexpr(std::is_trivially_copyable_v<T>)
+        {
+            append(buffer, static_cast<std::uint32_t>(sizeof(T)));
+            buffer.append(reinterpret_cast<const char*>(&v), sizeof(T));
+        }
+        else
+        {
+            std::ostringstream stream;
+            {
+                boost::archive::binary_oarchive ar {stream, boost::archive::no_header};
+                ar << v;
+            }
+            const auto bytes {std::move(stream).str()};
+            append(buffer, static_cast<std::uint32_t>(bytes.size()));
+            buffer.append(bytes);
+        }
+    }
+
+    [[nodiscard]] static T decode(const std::string& bytes)
+    {
+        if constexpr(std::is_trivially_copyable_v<T>)
+        {
+            T v;
+            std::memcpy(&v, bytes.data(), sizeof(T));
+            return v;
+        }
+        else
+        {
+            std::istringstream stream {bytes};
+            boost::archive::binary_iarchive ar {stream, boost::archive::no_header};
+            T v;
+            ar >> v;
+            return v;
+        }
+    }
+
+    /// \brief Apply records of \b path to \b elements. Reading stops at a torn record.
+    static void read(const fs::path& path, std::deque<T>& elements)
+    {
+        std::ifstream stream {path, std::ios::binary};
+        char kind;
+        std::uint32_t n;
+        std::string bytes;
+        while(stream.get(kind) && stream.read(reinterpret_cast<char*>(&n), sizeof(n)))
+        {
+            if(kind == pop_record)
+            {
+                elements.erase(elements.begin(), elements.begin() + std::min<std::size_t>(n, elements.size()));
+                continue;
+            }
+            if(kind != push_record || (std::is_trivially_copyable_v<T> && n != sizeof(T)))
+                return;
+            bytes.resize(n);
+            if(!stream.read(bytes.data(), n))
+                return;
+            elements.push_back(decode(bytes));
+        }
+    }
+
+    [[nodiscard]] fs::path file(const char* name, std::uint64_t generation) const
+    {
+        return m_directory / (std::string{name} + '.' + std::to_string(generation));
+    }
+
+    /// \return Generation of the last complete snapshot, 0 if there is none.
+    [[nodiscard]] std::uint64_t last_generation() const
+    {
+        std::uint64_t generation {0};
+        for(const auto& entry:fs::directory_iterator{m_directory})
+        {
+            const auto name {entry.path().filename().string()};
+            if(name.starts_with("snapshot.") && entry.path().extension() != ".tmp")
+                generation = std::max<std::uint64_t>(generation, std::stoull(name.substr(name.find('.') + 1)));
+        }
+        return generation;
+    }
+
+    /// \brief Open \b path for appending, it's created if it doesn't exist.
+    [[nodiscard]] static int open(const fs::path& path, bool truncate)
+    {
+#if defined(_WIN32)
+        const int fd {::_wopen(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY | (truncate ? _O_TRUNC : 0),
+                               _S_IREAD | _S_IWRITE)};
+#else
+        const int fd {::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644)};
+#endif
+        if(fd < 0)
+            throw std::system_error{errno, std::generic_category(), "Can't open " + path.string()};
+        return fd;
+    }
+
+    static void close(int fd) noexcept
+    {
+#if defined(_WIN32)
+        ::_close(fd);
+#else
+        ::close(fd);
+#endif
+    }
+
+    static void write(int fd, const std::string& bytes)
+    {
+        for(std::size_t written {0}; written < bytes.size();)
+        {
+#if defined(_WIN32)
+            const auto n {::_write(fd, bytes.data() + written, static_cast<unsigned>(std::min<std::size_t>(bytes.size() - written, INT_MAX)))};
+#else
+            const auto n {::write(fd, bytes.data() + written, bytes.size() - written)};
+#endif
+            if(n < 0 && errno != EINTR)
+                throw std::system_error{errno, std::generic_category(), "Can't write journal"};
+            if(n > 0)
+                written += static_cast<std::size_t>(n);
+        }
+    }
+
+    static void sync(int fd)
+    {
+#if defined(_WIN32)
+        const int result {::_commit(fd)};
+#elif defined(__APPLE__)
+        const int result {::fsync(fd)};
+#else
+        const int result {::fdatasync(fd)};
+#endif
+        if(result != 0)
+            throw std::system_error{errno, std::generic_category(), "Can't sync journal"};
+    }
+
+    /// \brief Make renames and removals in directory durable.
+    /// \note  Windows has no way to sync a directory, NTFS journals it's metadata itself.
+    void sync_directory() const
+    {
+#if !defined(_WIN32)
+        const int dir {::open(m_directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+        if(dir < 0)
+            throw std::system_error{errno, std::generic_category(), "Can't open " + m_directory.string()};
+        const int result {::fsync(dir)};
+        ::close(dir);
+        if(result != 0)
+            throw std::system_error{errno, std::generic_category(), "Can't sync journal directory"};
+#endif
+    }
+
+    /// \brief Write \b snapshot of the next generation, switch log to it and remove the previous one.
+    ///        Generation is changed only once the snapshot is in place, so if it fails,
+    ///        the log of the current generation is still used.
+    void rotate(const std::string& snapshot)
+    {
+        const auto previous {m_generation};
+        const auto path {file("snapshot", previous + 1)};
+        auto tmp {path};
+        tmp += ".tmp";
+        const int fd {open(tmp, true)};
+        try
+        {
+            write(fd, snapshot);
+            sync(fd);
+        }
+        catch(...)
+        {
+            close(fd);
+            std::error_code ec;
+            fs::remove(tmp, ec);
+            throw;
+        }
+        close(fd);
+        fs::rename(tmp, path);
+        m_generation = previous + 1;
+        if(m_log >= 0)
+            close(m_log);
+        // if the new log can't be opened, it's opened again by the next commit
+        m_log = -1;
+        m_log = open(file("wal", m_generation), true);
+        sync_directory();
+        fs::remove(file("snapshot", previous));
+        fs::remove(file("wal", previous));
+    }
+
+    /// \brief Writer thread: commits records every commit interval or on flush().
+    void commit()
+    {
+        std::string records;
+        std::unique_lock lk {m_mutex};
+        while(true)
+        {
+            m_on_pending.wait_for(lk, m_commit_interval, [this]{ return m_flush || m_stopping; });
+            const auto snapshot {std::exchange(m_snapshot, std::nullopt)};
+            const auto superseded {std::exchange(m_superseded, 0)};
+            records.swap(m_records);
+            const auto sequence {m_appended};
+            const bool stopping {m_stopping};
+            m_flush = false;
+            lk.unlock();
+            std::exception_ptr error;
+            const auto generation {m_generation};
+            if(snapshot)
+            {
+                try
+                {
+                    rotate(*snapshot);
+                }
+                catch(...)
+                {
+                    error = std::current_exception();
+                }
+            }
+            // records before the snapshot are written only if it isn't in place
+            if(m_generation != generation)
+                records.erase(0, superseded);
+            try
+            {
+                if(!records.empty())
+                {
+                    if(m_log < 0)
+                        m_log = open(file("wal", m_generation), false);
+                    write(m_log, records);
+                    sync(m_log);
+                }
+            }
+            catch(...)
+            {
+                error = std::current_exception();
+            }
+            lk.lock();
+            if(!records.empty())
+                ++m_stats.commits;
+            records.clear();
+            if(error)
+                m_error = error;
+            m_durable = sequence;
+            m_on_durable.notify_all();
+            if(stopping)
+                return;
+        }
+    }
+
+    fs::path m_directory;
+    std::chrono::microseconds m_commit_interval;
+    std::size_t m_compaction_size;
+    /// \note Queue calls are compiled for any T, so encode() is instantiated only by a constructed journal.
+    void (*m_encode)(std::string& buffer, const T& v);
+    /// \note Used under the queue lock only.
+    std::size_t m_log_size {0};
+    std::size_t m_snapshot_size {0};
+    /// \note Used by the writer thread only.
+    std::uint64_t m_generation {0};
+    int m_log {-1};
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_on_pending;
+    std::condition_variable m_on_durable;
+    std::string m_records;
+    std::optional<std::string> m_snapshot;
+    /// \brief Size of records, that are superseded by the snapshot.
+    std::size_t m_superseded {0};
+    std::uint64_t m_appended {0};
+    std::uint64_t m_durable {0};
+    bool m_flush {false};
+    bool m_stopping {false};
+    std::exception_ptr m_error;
+    JournalStats m_stats;
+    std::thread m_writer;
+};
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace threadsafe_containers
+{
+
+/// \brief Receives operations of a queue to journal them (see Journal, Queue::set_journal).
+///        Queue calls it under it's lock, so calls are serialized.
+template<typename T> class JournalHook
+{
+public:
+    virtual ~JournalHook() = default;
+
+    /// \brief Journal a push of \b v.
+    virtual void on_push(const T& v) = 0;
+
+    /// \brief Journal \b n pops.
+    virtual void on_pop(std::size_t n) = 0;
+
+    /// \return True if queue should pass it's elements to snapshot().
+    [[nodiscard]] virtual bool needs_compaction() const noexcept = 0;
+
+    /// \brief Start a new generation with \b size queue elements, \b element returns one of them
+    ///        by position counting from front.
+    virtual void snapshot(std::size_t size, const std::function<const T&(std::size_t)>& element) = 0;
+};
+
+}
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <deque>
+#include <atomic>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <stop_token>
+
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/deque.hpp>
+
+#include "Platform.hpp"
+#include "WaitStrategy.hpp"
+#include "QueueClosed.hpp"
+
+namespace threadsafe_containers
+{
+
+/// \brief Lock-free bounded multi-producer multi-consumer queue.
+///        Ring of SIZE slots, each slot carries a sequence number that tells
+///        producers and consumers whether the slot is free or holds a value.
+///        Has the same public API as Queue and may be used instead of it.
+/// \note  Blocking operations park a thread only if the ring is empty (full).
+/// \note  Waits on a closed queue don't block (see close).
+template<typename T, std::size_t SIZE = 2> class LockFreeQueue
+{
+    static_assert(SIZE > 1, "Sequence numbers can't distinguish states of a single slot");
+
+public:
+    using value_type = T;
+    using pointer_type = std::unique_ptr<T>;
+
+    LockFreeQueue()
+    {
+        for(std::size_t cntr {0}; cntr < SIZE; ++cntr)
+            m_slots[cntr].m_sequence.store(cntr, std::memory_order_relaxed);
+    }
+
+    LockFreeQueue(const LockFreeQueue&) = delete;
+    LockFreeQueue(LockFreeQueue&&) = delete;
+    LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+    LockFreeQueue& operator=(LockFreeQueue&&) = delete;
+
+    ~LockFreeQueue()
+    {
+        clear();
+    }
+
+    /// \brief  Push value into queue
+    /// \return False if queue has no space left to push \b v, true otherwise.
+    [[nodiscard]] bool push(T v)
+    {
+        if(!enqueue(v))
+            return false;
+        notify_on_not_empty();
+        return true;
+    }
+
+    /// \brief  Dequeue element and place it's value into \b v.
+    /// \return False if queue is empty, \b v keeps it's value.
+    ///         True otherwise, \b v contains dequeued value.
+    [[nodiscard]] bool pop(T& v)
+    {
+        if(!dequeue(v))
+            return false;
+        notify_on_space_available();
+        return true;
+    }
+
+    /// \brief  Dequeue element and return it's value.
+    /// \return nullptr if queue is empty, dequeued value otherwise.
+    [[nodiscard]] pointer_type pop()
+    {
+        pointer_type p;
+        if(!dequeue(p))
+            return nullptr;
+        notify_on_space_available();
+        return p;
+    }
+
+    /// \brief  Dequeue element without allocation.
+    /// \return std::nullopt if queue is empty, dequeued value otherwise.
+    [[nodiscard]] std::optional<T> try_pop()
+    {
+        std::optional<T> v;
+        if(!dequeue(v))
+            return std::nullopt;
+        notify_on_space_available();
+        return v;
+    }
+
+    /// \brief Wait until queue is empty.
+    /// \throws QueueClosed If queue is closed while it's empty.
+    void wait_until_empty()
+    {
+        m_not_empty.wait_until([this]{ return !empty() || closed(); });
+        if(empty())
+            throw QueueClosed{};
+    }
+
+    /// \brief Wait until queue is full.
+    /// \throws QueueClosed If queue is closed while it's full.
+    void wait_until_full()
+    {
+        m_space_available.wait_until([this]{ return !full() || closed(); });
+        if(full())
+            throw QueueClosed{};
+    }
+
+    /// \return True if queue is empty, false otherwise.
+    [[nodiscard]] bool empty() const
+    {
+        return size() == 0;
+    }
+
+    /// \return True if queue is false, false otherwise.
+    [[nodiscard]] bool full() const
+    {
+        return size() >= SIZE;
+    }
+
+    /// \brief  Wait if queue is full, push \b v into queue.
+    /// \throws QueueClosed If queue is closed while it's full.
+    void wait_and_push(T v)
+    {
+        bool pushed {false};
+        m_space_available.wait_until([this, &v, &pushed]{ return (pushed = enqueue(v)) || closed(); });
+        if(!pushed)
+            throw QueueClosed{};
+        notify_on_not_empty();
+    }
+
+    /// \brief  Wait until queue is empty, dequeue element and place it's value into \b v.
+    /// \throws QueueClosed If queue is closed while it's empty.
+    void wait_and_pop(T& v)
+    {
+        bool popped {false};
+        m_not_empty.wait_until([this, &v, &popped]{ return (popped = dequeue(v)) || closed(); });
+        if(!popped)
+            throw QueueClosed{};
+        notify_on_space_available();
+    }
+
+    /// \brief  Wait until queue is empty, dequeue element and return it's value.
+    /// \throws QueueClosed If queue is closed while it's empty.
+    [[nodiscard]] pointer_type wait_and_pop()
+    {
+        pointer_type p;
+        m_not_empty.wait_until([this, &p]{ return dequeue(p) || closed(); });
+        if(!p)
+            throw QueueClosed{};
+        notify_on_space_available();
+        return p;
+    }
+
+    /// \brief  Wait until queue is not empty or \b exit_condition is true,
+    ///         dequeue element and place it's value into \b v.
+    /// \return False if exit condition is met or queue is closed on empty queue, \b v keeps it's value.
+    template<typename P>
+    [[nodiscard]] bool wait_and_pop(T& v, P exit_condition)
+    {
+        bool popped {false};
+        m_not_empty.wait_until([this, &v, &popped, &exit_condition]{ return (popped = dequeue(v)) || exit_condition() || closed(); });
+        if(!popped)
+            return false;
+        notify_on_space_available();
+        return true;
+    }
+
+    /// \brief  Wait if queue is full, push \b v into queue.
+    ///         The wait is cancelled when stop is requested on \b stop_token.
+    /// \return False if stop is requested or queue is closed while it's full, true otherwise.
+    [[nodiscard]] bool wait_and_push(T v, std::stop_token stop_token)
+    {
+        const std::stop_callback on_stop {stop_token, [this]{ m_space_available.notify_all(); }};
+        bool pushed {false};
+        m_space_available.wait_until([this, &v, &pushed, &stop_token]{ return (pushed = enqueue(v)) || stop_token.stop_requested() || closed(); });
+        if(!pushed)
+            return false;
+        notify_on_not_empty();
+        return true;
+    }
+
+    /// \brief  Wait until queue is not empty, dequeue element and place it's value into \b v.
+    ///         The wait is cancelled when stop is requested on \b stop_token,
+    ///         so elements left in queue are still dequeued after that.
+    /// \return False if stop is requested on empty queue, \b v keeps it's value.
+    [[nodiscard]] bool wait_and_pop(T& v, std::stop_token stop_token)
+    {
+        const std::stop_callback on_stop {stop_token, [this]{ m_not_empty.notify_all(); }};
+        return wait_and_pop(v, [&stop_token]{ return stop_token.stop_requested(); });
+    }
+
+    template<typename P>
+    [[nodiscard]] pointer_type wait_and_pop(P exit_condition)
+    {
+        pointer_type p;
+        m_not_empty.wait_until([this, &p, &exit_condition]{ return dequeue(p) || exit_condition() || closed(); });
+        if(!p)
+            return nullptr;
+        notify_on_space_available();
+        return p;
+    }
+
+    void clear()
+    {
+        std::optional<T> v;
+        while(dequeue(v))
+            notify_on_space_available();
+    }
+
+    /// \note The value is exact only if there are no concurrent operations.
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        const auto head {m_head.load(std::memory_order_acquire)};
+        const auto tail {m_tail.load(std::memory_order_acquire)};
+        return tail > head ? tail - head: 0;
+    }
+
+    [[nodiscard]] constexpr std::size_t max_size() const noexcept
+    {
+        return SIZE;
+    }
+
+    /// \brief Close queue for waiting: threads blocked on it are woken and waits don't block
+    ///        any more (see Queue::close). Elements left in queue are still dequeued.
+    void close()
+    {
+        m_closed.store(true, std::memory_order_relaxed);
+        m_not_empty.notify_all();
+        m_space_available.notify_all();
+    }
+
+    /// \brief Let waits block again.
+    void open() noexcept
+    {
+        m_closed.store(false, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool closed() const noexcept
+    {
+        return m_closed.load(std::memory_order_relaxed);
+    }
+
+    /// \note Must not be called concurrently with operations which modify queue.
+    [[nodiscard]] friend bool operator==(const LockFreeQueue& l, const LockFreeQueue& r)
+    {
+        return l.contents() == r.contents();
+    }
+
+private:
+    using sequence_t = std::size_t;
+
+    struct alignas(cache_line_size) Slot
+    {
+        std::atomic<sequence_t> m_sequence;
+        alignas(T) unsigned char m_storage[sizeof(T)];
+
+        T* value() noexcept
+        {
+            return std::launder(reinterpret_cast<T*>(m_storage));
+        }
+
+        const T* value() const noexcept
+        {
+            return std::launder(reinterpret_cast<const T*>(m_storage));
+        }
+    };
+
+    /// \brief Claim a free slot and move \b v into it.
+    ///        \b v is left untouched if queue is full.
+    [[nodiscard]] bool enqueue(T& v)
+    {
+        auto pos {m_tail.load(std::memory_order_relaxed)};
+        Slot* slot {nullptr};
+        for(;;)
+        {
+            slot = &m_slots[pos % SIZE];
+            const auto seq {slot->m_sequence.load(std::memory_order_acquire)};
+            const auto diff {static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos)};
+            if(diff == 0)
+            {
+                if(m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+                return false;
+            else
+                pos = m_tail.load(std::memory_order_relaxed);
+        }
+        ::new(static_cast<void*>(slot->m_storage)) T(std::move(v));
+        slot->m_sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// \brief Claim an occupied slot and move it's value into \b out.
+    template<typename Out> [[nodiscard]] bool dequeue(Out& out)
+    {
+        auto pos {m_head.load(std::memory_order_relaxed)};
+        Slot* slot {nullptr};
+        for(;;)
+        {
+            slot = &m_slots[pos % SIZE];
+            const auto seq {slot->m_sequence.load(std::memory_order_acquire)};
+            const auto diff {static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1)};
+            if(diff == 0)
+            {
+                if(m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+                return false;
+            else
+                pos = m_head.load(std::memory_order_relaxed);
+        }
+        auto* value {slot->value()};
+        if constexpr(std::is_same_v<Out, pointer_type>)
+            out = std::make_unique<T>(std::move(*value));
+        else
+            out = std::move(*value);
+        value->~T();
+        slot->m_sequence.store(pos + SIZE, std::memory_order_release);
+        return true;
+    }
+
+    void notify_on_not_empty()
+    {
+        m_not_empty.notify_all();
+    }
+
+    void notify_on_space_available()
+    {
+        m_space_available.notify_all();
+    }
+
+    /// \brief Copy of queue elements from head to tail.
+    [[nodiscard]] std::deque<T> contents() const
+    {
+        std::deque<T> q;
+        const auto head {m_head.load(std::memory_order_acquire)};
+        const auto tail {m_tail.load(std::memory_order_acquire)};
+        for(auto pos {head}; pos < tail; ++pos)
+            q.push_back(*m_slots[pos % SIZE].value());
+        return q;
+    }
+
+
+    friend class boost::serialization::access;
+    // Elements are stored as std::deque<T> under the same name as in Queue,
+    // so archives of both queues are interchangeable.
+    /// \note Must not be called concurrently with operations which modify queue.
+    template<class Archive>
+    void save(Archive& ar, [[maybe_unused]] const unsigned int version) const
+    {
+        const auto q {contents()};
+        ar & boost::serialization::make_nvp("m_queue", q);
+    }
+
+    template<class Archive>
+    void load(Archive& ar, [[maybe_unused]] const unsigned int version)
+    {
+        std::deque<T> q;
+        ar & boost::serialization::make_nvp("m_queue", q);
+        if(q.size() > SIZE)
+            throw std::length_error{"Archive holds more elements than queue may keep"};
+        clear();
+        for(auto& v:q)
+        {
+            if(!enqueue(v))
+                throw std::length_error{"Queue is modified while being loaded"};
+            notify_on_not_empty();
+        }
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+
+    alignas(cache_line_size) std::atomic<sequence_t> m_head {0};
+    alignas(cache_line_size) std::atomic<sequence_t> m_tail {0};
+    alignas(cache_line_size) EventCount m_not_empty;
+    alignas(cache_line_size) EventCount m_space_available;
+    std::atomic_bool m_closed {false};
+    Slot m_slots[SIZE];
+};
+
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+#include <stdexcept>
+#include <optional>
+#include <functional>
+#include <atomic>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace threadsafe_containers
+{
+
+namespace fs = std::filesystem;
+
+/// \brief Queue elements in a file, that is memory mapped on load instead of parsed.
+///        Elements are served straight from the mapping, there is no copy at startup.
+///        Supports trivially copyable T and std::string, that is served as std::string_view.
+/// \note  File layout: Header, offset table of count + 1 offsets of elements relative to
+///        the data region (element i is [offset i, offset i + 1)), data region aligned to 8.
+///        The file is written next to \b path, synced and renamed into place, so a crash
+///        leaves either the previous snapshot or the new one.
+/// \note  Byte order and layout of T are those of the machine that saved the file.
+template<typename T> class MappedSnapshot
+{
+    static constexpr bool is_string {std::is_same_v<T, std::string>};
+    static_assert(is_string || std::is_trivially_copyable_v<T>, "Elements must be trivially copyable or strings");
+    static_assert(alignof(T) <= 8 || is_string, "Data region is aligned to 8");
+
+public:
+    /// \brief string_view for strings, reference to element otherwise.
+    using reference = std::conditional_t<is_string, std::string_view, std::reference_wrapper<const T>>;
+
+    /// \brief  Save elements of \b queue. The queue is locked only to copy them (see Queue::snapshot).
+    /// \throws std::system_error
+    template<typename Queue>
+    static void save(const fs::path& path, const Queue& queue)
+    {
+        const auto snapshot {queue.snapshot()};
+        const auto& elements {snapshot.elements()};
+        Header header;
+        header.count = elements.size();
+        header.data_offset = align(sizeof(Header) + (header.count + 1) * sizeof(std::uint64_t));
+
+        std::vector<std::uint64_t> offsets;
+        offsets.reserve(header.count + 1);
+        std::uint64_t offset {0};
+        for(std::size_t cntr {0}; cntr < elements.size(); ++cntr)
+        {
+            offsets.push_back(offset);
+            offset += size_of(elements[cntr]);
+        }
+        offsets.push_back(offset);
+
+        auto tmp {path};
+        tmp += ".tmp";
+        {
+            std::ofstream stream {tmp, std::ios::binary | std::ios::trunc};
+            stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            stream.write(reinterpret_cast<const char*>(offsets.data()),
+                         static_cast<std::streamsize>(offsets.size() * sizeof(std::uint64_t)));
+            const char padding[8] {};
+            stream.write(padding, static_cast<std::streamsize>(header.data_offset - sizeof(header) - offsets.size() * sizeof(std::uint64_t)));
+            for(std::size_t cntr {0}; cntr < elements.size(); ++cntr)
+                stream.write(data_of(elements[cntr]), static_cast<std::streamsize>(size_of(elements[cntr])));
+            if(!stream.flush())
+                throw std::system_error{errno, std::generic_category(), "Can't write " + tmp.string()};
+        }
+        sync(tmp, O_WRONLY);
+        fs::rename(tmp, path);
+        auto dir {path.parent_path()};
+        sync(dir.empty() ? fs::path{"."}: dir, O_RDONLY | O_DIRECTORY);
+    }
+
+    /// \brief  Map \b path. The header and the offset table are checked,
+    ///         elements are read when they are served.
+    /// \throws std::system_error, std::runtime_error If file isn't a snapshot of T.
+    explicit MappedSnapshot(const fs::path& path)
+    {
+        const int fd {::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+        if(fd < 0)
+            throw std::system_error{errno, std::generic_category(), "Can't open " + path.string()};
+        struct stat st {};
+        if(::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header)))
+        {
+            ::close(fd);
+            throw std::runtime_error{"Snapshot is truncated"};
+        }
+        m_size = static_cast<std::size_t>(st.st_size);
+        void* p {::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0)};
+        ::close(fd);
+        if(p == MAP_FAILED)
+            throw std::system_error{errno, std::generic_category(), "Can't map " + path.string()};
+        m_file = static_cast<const char*>(p);
+        // elements are usually served in order
+        ::madvise(p, m_size, MADV_SEQUENTIAL);
+
+        Header header;
+        std::memcpy(&header, m_file, sizeof(header));
+        if(std::memcmp(header.magic, Header{}.magic, sizeof(header.magic)) != 0 || header.version != Header{}.version ||
+           header.element_size != Header{}.element_size || header.count >= m_size / sizeof(std::uint64_t) ||
+           header.data_offset < sizeof(Header) + (header.count + 1) * sizeof(std::uint64_t) || header.data_offset > m_size)
+        {
+            unmap();
+            throw std::runtime_error{"File isn't a snapshot of this type"};
+        }
+        m_count = header.count;
+        m_offsets = reinterpret_cast<const std::uint64_t*>(m_file + sizeof(Header));
+        m_data = m_file + header.data_offset;
+        if(!valid_offsets(m_size - header.data_offset))
+        {
+            unmap();
+            throw std::runtime_error{"Snapshot is truncated"};
+        }
+    }
+
+    MappedSnapshot(const MappedSnapshot&) = delete;
+    MappedSnapshot(MappedSnapshot&&) = delete;
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+    MappedSnapshot& operator=(MappedSnapshot&&) = delete;
+
+    /// \note References to elements are invalid after destruction.
+    ~MappedSnapshot()
+    {
+        unmap();
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return m_count;
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return m_count == 0;
+    }
+
+    [[nodiscard]] reference operator[](std::size_t pos) const noexcept
+    {
+        const char* p {m_data + m_offsets[pos]};
+        if constexpr(is_string)
+            return std::string_view{p, static_cast<std::size_t>(m_offsets[pos + 1] - m_offsets[pos])};
+        else
+            return std::cref(*std::launder(reinterpret_cast<const T*>(p)));
+    }
+
+    /// \brief  Take the next element in FIFO order. Threadsafe, so consumers may serve saved
+    ///         elements from the mapping before they turn to the queue.
+    /// \return std::nullopt if all elements are taken.
+    [[nodiscard]] std::optional<reference> try_pop() noexcept
+    {
+        auto next {m_next.load(std::memory_order_relaxed)};
+        do
+        {
+            if(!(next < m_count))
+                return std::nullopt;
+        }
+        while(!m_next.compare_exchange_weak(next, next + 1, std::memory_order_relaxed));
+        return (*this)[next];
+    }
+
+    /// \return Number of elements, that are not taken by try_pop() yet.
+    [[nodiscard]] std::size_t remaining() const noexcept
+    {
+        return m_count - std::min<std::size_t>(m_next.load(std::memory_order_relaxed), m_count);
+    }
+
+private:
+    struct Header
+    {
+        char magic[8] {'P', 'C', 'Q', 'S', 'N', 'A', 'P', '\0'};
+        std::uint32_t version {1};
+        std::uint32_t element_size {is_string ? 0: static_cast<std::uint32_t>(sizeof(T))};
+        std::uint64_t count {0};
+        std::uint64_t data_offset {0};
+    };
+
+    [[nodiscard]] static constexpr std::uint64_t align(std::uint64_t offset) noexcept
+    {
+        return (offset + 7) & ~std::uint64_t{7};
+    }
+
+    [[nodiscard]] static std::uint64_t size_of(const T& v) noexcept
+    {
+        if constexpr(is_string)
+            return v.size();
+        else
+            return sizeof(T);
+    }
+
+    [[nodiscard]] static const char* data_of(const T& v) noexcept
+    {
+        if constexpr(is_string)
+            return v.data();
+        else
+            return reinterpret_cast<const char*>(&v);
+    }
+
+    /// \brief Wait until file or directory \b path is on disk.
+    static void sync(const fs::path& path, int flags)
+    {
+        const int fd {::open(path.c_str(), flags | O_CLOEXEC)};
+        if(fd < 0)
+            throw std::system_error{errno, std::generic_category(), "Can't open " + path.string()};
+        const int result {::fsync(fd)};
+        const int error {errno};
+        ::close(fd);
+        if(result != 0)
+            throw std::system_error{error, std::generic_category(), "Can't sync " + path.string()};
+    }
+
+    /// \brief  Offsets must not decrease and elements must be within the data region
+    ///         of \b data_size bytes, so operator[] never reads past the mapping.
+    [[nodiscard]] bool valid_offsets(std::size_t data_size) const noexcept
+    {
+        for(std::size_t cntr {0}; cntr <= m_count; ++cntr)
+        {
+            if(m_offsets[cntr] > data_size || (cntr && m_offsets[cntr] < m_offsets[cntr - 1]))
+                return false;
+            if constexpr(!is_string)
+            {
+                if(cntr < m_count && (m_offsets[cntr] % alignof(T) != 0 || data_size - m_offsets[cntr] < sizeof(T)))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    void unmap() noexcept
+    {
+        if(m_file)
+            ::munmap(const_cast<char*>(m_file), m_size);
+        m_file = nullptr;
+    }
+
+    const char* m_file {nullptr};
+    std::size_t m_size {0};
+    std::size_t m_count {0};
+    const std::uint64_t* m_offsets {nullptr};
+    const char* m_data {nullptr};
+    std::atomic<std::size_t> m_next {0};
+};
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <functional>
+
+namespace threadsafe_containers
+{
+
+/// \brief What wait_and_push does when queue is full.
+enum class OverflowPolicy
+{
+    block,         ///< wait for space, no longer than timeout if it's set
+    reject_newest, ///< drop the element being pushed
+    drop_oldest,   ///< drop the front element to make space for the new one
+    sample_drop    ///< drop new elements at random before queue is full, low priority ones more often
+};
+
+/// \brief Overflow policy of a queue.
+/// \note  sample_drop works like random early detection: once queue size reaches
+///        \b sample_threshold, an element of priority p is dropped with probability
+///        fill / (p + 1), where fill grows from 0 at the threshold to 1 at high watermark.
+///        A full queue rejects the newest element.
+template<typename T> struct Overflow
+{
+    OverflowPolicy policy {OverflowPolicy::block};
+    std::chrono::microseconds timeout {0};            ///< block: zero waits until there is space
+    std::size_t sample_threshold {0};                 ///< sample_drop: size where dropping starts
+    std::function<std::size_t(const T&)> priority {}; ///< sample_drop: 0 is the lowest priority
+    /// \brief Called with a dropped element and the policy that dropped it, out of the queue lock,
+    ///        e.g. to reply "server busy" to the client right away.
+    std::function<void(T&& dropped, OverflowPolicy policy)> on_drop {};
+};
+
+/// \brief Elements dropped by overflow policies.
+struct OverflowStats
+{
+    std::uint64_t timed_out {0}; ///< block with timeout
+    std::uint64_t rejected {0};  ///< reject_newest, and sample_drop on full queue
+    std::uint64_t evicted {0};   ///< drop_oldest
+    std::uint64_t sampled {0};   ///< sample_drop before queue is full
+
+    [[nodiscard]] std::uint64_t dropped() const noexcept
+    {
+        return timed_out + rejected + evicted + sampled;
+    }
+};
+
+}
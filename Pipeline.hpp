@@ -0,0 +1,366 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <stop_token>
+#include <type_traits>
+
+#include "Queue.hpp"
+
+namespace producer_consumer
+{
+
+/// \brief Counters of a pipeline stage at some moment.
+struct StageStats
+{
+    std::string name;
+    std::size_t num_of_threads {0};               ///< 0 if the stage is fused into the previous one
+    std::size_t depth {0};                        ///< elements waiting in stage queue
+    std::uint64_t processed {0};
+    double throughput {0};                        ///< processed elements per second since start
+    std::chrono::nanoseconds average_latency {0}; ///< time of the stage function per element
+    std::chrono::nanoseconds max_latency {0};
+};
+
+template<typename In> class Pipeline;
+template<typename In, typename Out> class PipelineBuilder;
+
+namespace pipeline_detail
+{
+
+using clock = std::chrono::steady_clock;
+
+class StageBase
+{
+public:
+    explicit StageBase(std::string name):
+        m_name{std::move(name)}
+    {}
+
+    StageBase(const StageBase&) = delete;
+    StageBase(StageBase&&) = delete;
+    StageBase& operator=(const StageBase&) = delete;
+    StageBase& operator=(StageBase&&) = delete;
+
+    virtual ~StageBase() = default;
+
+    virtual void start()
+    {
+        m_start = clock::now();
+    }
+
+    /// \brief Wait until elements, that are in stage, are passed on, and stop stage threads.
+    virtual void stop()
+    {}
+
+    [[nodiscard]] virtual StageStats stats() const
+    {
+        const auto processed {m_processed.load(std::memory_order_relaxed)};
+        const std::chrono::duration<double> elapsed {clock::now() - m_start};
+        const std::chrono::nanoseconds busy {m_busy.load(std::memory_order_relaxed)};
+        StageStats stats;
+        stats.name = m_name;
+        stats.processed = processed;
+        stats.throughput = elapsed.count() > 0 ? static_cast<double>(processed) / elapsed.count() : 0;
+        stats.average_latency = processed ? busy / static_cast<std::chrono::nanoseconds::rep>(processed) : busy;
+        stats.max_latency = std::chrono::nanoseconds{m_max_latency.load(std::memory_order_relaxed)};
+        return stats;
+    }
+
+protected:
+    /// \brief Count an element, that took the stage function since \b start.
+    void count(clock::time_point start) noexcept
+    {
+        const auto latency {std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count()};
+        m_processed.fetch_add(1, std::memory_order_relaxed);
+        m_busy.fetch_add(latency, std::memory_order_relaxed);
+        for(auto max {m_max_latency.load(std::memory_order_relaxed)};
+            latency > max && !m_max_latency.compare_exchange_weak(max, latency, std::memory_order_relaxed);)
+            ;
+    }
+
+private:
+    std::string m_name;
+    clock::time_point m_start {clock::now()};
+    std::atomic<std::uint64_t> m_processed {0};
+    std::atomic<std::chrono::nanoseconds::rep> m_busy {0};
+    std::atomic<std::chrono::nanoseconds::rep> m_max_latency {0};
+};
+
+/// \brief Stage, that passes elements of type Out on to the next stage.
+template<typename Out> class Emitter
+{
+public:
+    virtual ~Emitter() = default;
+
+    void connect(std::function<void(Out)> emit)
+    {
+        m_emit = std::move(emit);
+    }
+
+protected:
+    std::function<void(Out)> m_emit;
+};
+
+/// \brief The last stage passes nothing on.
+template<> class Emitter<void>
+{
+public:
+    virtual ~Emitter() = default;
+};
+
+/// \brief Stage, that turns In into Out. It's function is run by the thread, that passes In to it.
+template<typename In, typename Out> class Step: public StageBase, public Emitter<Out>
+{
+public:
+    template<typename F>
+    Step(std::string name, F f):
+        StageBase{std::move(name)},
+        m_f{std::move(f)}
+    {}
+
+    void process(In v)
+    {
+        const auto start {clock::now()};
+        if constexpr(std::is_void_v<Out>)
+        {
+            m_f(std::move(v));
+            count(start);
+        }
+        else
+        {
+            auto out {m_f(std::move(v))};
+            count(start);
+            this->m_emit(std::move(out));
+        }
+    }
+
+private:
+    std::function<Out(In)> m_f;
+};
+
+/// \brief Stage with a queue of In and threads, that take elements from it.
+template<typename In, typename Out, typename Queue> class QueuedStep: public Step<In, Out>
+{
+    static_assert(std::is_same_v<typename Queue::value_type, In>, "Stage queue must keep elements of stage input type");
+
+public:
+    template<typename F>
+    QueuedStep(std::string name, F f, std::size_t num_of_threads, std::size_t capacity):
+        Step<In, Out>{std::move(name), std::move(f)},
+        m_queue(make_queue(std::max<std::size_t>(num_of_threads, 1), capacity)),
+        m_num_of_threads{std::max<std::size_t>(num_of_threads, 1)}
+    {}
+
+    ~QueuedStep() override
+    {
+        stop();
+    }
+
+    /// \brief Wait if stage queue is full, so a slow stage holds back the stages before it.
+    void push(In v)
+    {
+        m_queue.wait_and_push(std::move(v));
+    }
+
+    void start() override
+    {
+        Step<In, Out>::start();
+        m_stop_source = std::stop_source{};
+        m_threads.reserve(m_num_of_threads);
+        for(std::size_t cntr {0}; cntr < m_num_of_threads; ++cntr)
+            m_threads.emplace_back([this, stop_token = m_stop_source.get_token()]{ work(stop_token); });
+    }
+
+    /// \brief Stage queue is drained before threads finish.
+    void stop() override
+    {
+        m_stop_source.request_stop();
+        m_threads.clear();
+    }
+
+    [[nodiscard]] StageStats stats() const override
+    {
+        auto stats {Step<In, Out>::stats()};
+        stats.num_of_threads = m_num_of_threads;
+        stats.depth = m_queue.size();
+        return stats;
+    }
+
+private:
+    /// \brief Capacity of a sharded queue is split between shards, a shard per thread.
+    [[nodiscard]] static Queue make_queue(std::size_t num_of_threads, std::size_t capacity)
+    {
+        if constexpr(requires { Queue::is_sharded; })
+            return Queue(num_of_threads, std::max<std::size_t>((capacity + num_of_threads - 1) / num_of_threads, 1));
+        else if constexpr(std::is_constructible_v<Queue, std::size_t>)
+            return Queue(capacity);
+        else
+            return Queue();
+    }
+
+    void work(std::stop_token stop_token)
+    {
+        In v;
+        while(m_queue.wait_and_pop(v, stop_token))
+            this->process(std::move(v));
+    }
+
+    Queue m_queue;
+    std::size_t m_num_of_threads;
+    std::stop_source m_stop_source;
+    std::vector<std::jthread> m_threads;
+};
+
+}
+
+/// \brief Builds a pipeline of stages, that pass elements from one to the next.
+///        A stage is either queued, with it's own queue and threads, or fused into the previous
+///        stage, so it runs inline on the threads of that stage and skips a queue hop.
+///        Cheap adjacent stages are worth fusing. The last stage is a sink, that returns void.
+/// \tparam In Type of pipeline input.
+/// \tparam Out Type of output of the last stage so far.
+///
+/// \code
+/// auto pipeline {PipelineBuilder<std::string>{}
+///     .stage("parse", parse, 2)
+///     .fuse("plan", plan)
+///     .stage<LockFreeQueue<Plan, 256>>("execute", execute, 4)
+///     .stage("respond", respond)
+///     .build()};
+/// pipeline.push(request);
+/// \endcode
+template<typename In, typename Out = In> class PipelineBuilder
+{
+public:
+    static constexpr std::size_t default_capacity {1024};
+
+    PipelineBuilder() requires std::is_same_v<In, Out> = default;
+
+    /// \brief  Append a stage, that runs \b f on \b num_of_threads threads. Stage queue keeps up to
+    ///         \b capacity elements, when it's full the previous stage waits.
+    /// \tparam Queue Stage queue type, a queue of Out, e.g. threadsafe_containers::LockFreeQueue.
+    template<typename Queue = threadsafe_containers::Queue<Out>, typename F>
+    [[nodiscard]] PipelineBuilder<In, std::invoke_result_t<F&, Out>> stage(std::string name, F f, std::size_t num_of_threads = 1,
+                                                                         std::size_t capacity = default_capacity) &&
+    {
+        using Next = std::invoke_result_t<F&, Out>;
+        using stage_t = pipeline_detail::QueuedStep<Out, Next, Queue>;
+        auto stage {std::make_unique<stage_t>(std::move(name), std::move(f), num_of_threads, capacity)};
+        auto* queued {stage.get()};
+        if(m_last)
+            m_last->connect([queued](Out v){ queued->push(std::move(v)); });
+        else if constexpr(std::is_same_v<In, Out>)
+            m_push = [queued](In v){ queued->push(std::move(v)); };
+        return append<Next>(std::move(stage));
+    }
+
+    /// \brief  Append a stage, that runs \b f inline on the threads of the previous stage.
+    /// \throws std::logic_error If it's the first stage: pipeline input is queued.
+    template<typename F>
+    [[nodiscard]] PipelineBuilder<In, std::invoke_result_t<F&, Out>> fuse(std::string name, F f) &&
+    {
+        if(!m_last)
+            throw std::logic_error{"The first stage of pipeline can't be fused"};
+        using Next = std::invoke_result_t<F&, Out>;
+        auto stage {std::make_unique<pipeline_detail::Step<Out, Next>>(std::move(name), std::move(f))};
+        auto* fused {stage.get()};
+        m_last->connect([fused](Out v){ fused->process(std::move(v)); });
+        return append<Next>(std::move(stage));
+    }
+
+    /// \brief Start threads of all stages.
+    [[nodiscard]] Pipeline<In> build() &&
+        requires std::is_void_v<Out>
+    {
+        return Pipeline<In>{std::move(m_stages), std::move(m_push)};
+    }
+
+private:
+    template<typename, typename> friend class PipelineBuilder;
+
+    using stages_t = std::vector<std::unique_ptr<pipeline_detail::StageBase>>;
+
+    PipelineBuilder(stages_t stages, std::function<void(In)> push, pipeline_detail::Emitter<Out>* last):
+        m_stages{std::move(stages)},
+        m_push{std::move(push)},
+        m_last{last}
+    {}
+
+    template<typename Next, typename Stage>
+    [[nodiscard]] PipelineBuilder<In, Next> append(std::unique_ptr<Stage> stage)
+    {
+        pipeline_detail::Emitter<Next>* last {stage.get()};
+        m_stages.push_back(std::move(stage));
+        return {std::move(m_stages), std::move(m_push), last};
+    }
+
+    stages_t m_stages;
+    std::function<void(In)> m_push;
+    pipeline_detail::Emitter<Out>* m_last {nullptr};
+};
+
+/// \brief Running pipeline, see PipelineBuilder.
+/// \note  Bounded stage queues propagate backpressure: a slow stage fills it's queue,
+///        then the stage before it waits, and so on up to push().
+template<typename In> class Pipeline
+{
+public:
+    Pipeline(const Pipeline&) = delete;
+    Pipeline(Pipeline&&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+    Pipeline& operator=(Pipeline&&) = delete;
+
+    ~Pipeline()
+    {
+        stop();
+    }
+
+    /// \brief Pass \b v to the first stage. Waits if it's queue is full.
+    void push(In v)
+    {
+        m_push(std::move(v));
+    }
+
+    /// \brief Stop stages one by one from the first to the last, so elements pushed before
+    ///        pass through the whole pipeline. Must not be called concurrently with push().
+    void stop()
+    {
+        for(auto& stage:m_stages)
+            stage->stop();
+    }
+
+    /// \return Counters of stages in pipeline order.
+    [[nodiscard]] std::vector<StageStats> stats() const
+    {
+        std::vector<StageStats> stats;
+        stats.reserve(m_stages.size());
+        for(const auto& stage:m_stages)
+            stats.push_back(stage->stats());
+        return stats;
+    }
+
+private:
+    template<typename, typename> friend class PipelineBuilder;
+
+    Pipeline(std::vector<std::unique_ptr<pipeline_detail::StageBase>> stages, std::function<void(In)> push):
+        m_stages{std::move(stages)},
+        m_push{std::move(push)}
+    {
+        for(auto& stage:m_stages)
+            stage->start();
+    }
+
+    std::vector<std::unique_ptr<pipeline_detail::StageBase>> m_stages;
+    std::function<void(In)> m_push;
+};
+
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <climits>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace threadsafe_containers
+{
+
+/// \brief Size of a cache line. Used to keep independently modified data on separate lines.
+/// \note  std::hardware_destructive_interference_size is not used because it's value
+///        may differ between compilation units and gcc warns about it in headers.
+constexpr std::size_t cache_line_size {64};
+
+/// \brief Hint to the CPU that the caller is in a spin loop.
+inline void cpu_relax() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    _mm_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+/// \brief  Pin the calling thread to \b cpus.
+/// \return False if affinity isn't supported or none of \b cpus may be used.
+inline bool pin_current_thread(const std::vector<unsigned>& cpus) noexcept
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(auto cpu:cpus)
+    {
+        if(cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    static_cast<void>(cpus);
+    return false;
+#endif
+}
+
+/// \return True if the process may issue heavy_barrier() with the membarrier system call,
+///         so light_barrier() needs no fence. Registers the process on the first call.
+inline bool asymmetric_barriers() noexcept
+{
+#if defined(__linux__) && defined(SYS_membarrier)
+    constexpr int membarrier_cmd_register_private_expedited {1 << 4};
+    static const bool registered {syscall(SYS_membarrier, membarrier_cmd_register_private_expedited, 0, 0) == 0};
+    return registered;
+#else
+    return false;
+#endif
+}
+
+/// \brief Barrier of the frequent side of a store-load handshake (e.g. a notifier, that
+///        publishes an element and checks if the peer is parked). Pairs with heavy_barrier():
+///        either this side sees the store of the other side or the other side sees the store
+///        made before this barrier. It's a compiler barrier if the process has asymmetric_barriers().
+inline void light_barrier() noexcept
+{
+    if(asymmetric_barriers())
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    else
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+/// \brief Barrier of the rare side of a store-load handshake (e.g. a thread, that is about to park),
+///        see light_barrier(). Makes every running thread of the process execute a full fence.
+inline void heavy_barrier() noexcept
+{
+#if defined(__linux__) && defined(SYS_membarrier)
+    constexpr int membarrier_cmd_private_expedited {1 << 3};
+    // doesn't fail once the process is registered
+    if(asymmetric_barriers())
+    {
+        syscall(SYS_membarrier, membarrier_cmd_private_expedited, 0, 0);
+        return;
+    }
+#endif
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+/// \return NUMA node of the CPU the calling thread runs on, 0 if it is unknown.
+inline unsigned current_numa_node() noexcept
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu {0};
+    unsigned node {0};
+    if(syscall(SYS_getcpu, &cpu, &node, nullptr) == 0)
+        return node;
+#endif
+    return 0;
+}
+
+/// \return Size of a memory page.
+inline std::size_t page_size() noexcept
+{
+#if defined(__linux__)
+    static const auto size {static_cast<std::size_t>(sysconf(_SC_PAGESIZE))};
+    return size;
+#else
+    return 4096;
+#endif
+}
+
+/// \brief  Move pages of [data, data + size) to NUMA \b node and allocate them there from now on.
+///         Pages are moved as a whole, so only pages lying wholly in the range are moved,
+///         memory of neighbours sharing a page with the range stays where it is.
+/// \return False if it isn't supported, e.g. the kernel is built without NUMA,
+///         or there is no whole page in the range.
+/// \note   The mbind system call is used directly, so there is no dependency on libnuma.
+inline bool bind_memory_to_node(const void* data, std::size_t size, unsigned node) noexcept
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    constexpr int mpol_bind {2};
+    constexpr unsigned mpol_mf_move {1u << 1};
+    using mask_t = unsigned long;
+    if(!(node < sizeof(mask_t) * CHAR_BIT) || !size)
+        return false;
+    const auto page {static_cast<std::uintptr_t>(page_size())};
+    const auto begin {(reinterpret_cast<std::uintptr_t>(data) + page - 1) & ~(page - 1)};
+    const auto end {(reinterpret_cast<std::uintptr_t>(data) + size) & ~(page - 1)};
+    if(!(begin < end))
+        return false;
+    const mask_t mask {mask_t{1} << node};
+    // the kernel takes the number of bits of mask plus one
+    return syscall(SYS_mbind, begin, end - begin, mpol_bind, &mask, sizeof(mask) * CHAR_BIT + 1, mpol_mf_move) == 0;
+#else
+    static_cast<void>(data);
+    static_cast<void>(size);
+    static_cast<void>(node);
+    return false;
+#endif
+}
+
+}
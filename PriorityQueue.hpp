@@ -0,0 +1,464 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <array>
+#include <mutex>
+#include <condition_variable>
+#include <bit>
+#include <stdexcept>
+#include <type_traits>
+#include <stop_token>
+
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/split_member.hpp>
+
+#include "RingBuffer.hpp"
+#include "QueueClosed.hpp"
+
+namespace threadsafe_containers
+{
+
+/// \brief Threadsafe queue with LEVELS priority levels, each kept in it's own RingBuffer.
+///        Level LEVELS - 1 is the highest, level 0 is the lowest and the default one.
+///        Elements of one level are dequeued in FIFO order, the highest non-empty level
+///        is found in O(1) with a bit mask of non-empty levels.
+///        Has the same public API as Queue, push operations take an optional level.
+/// \tparam SIZE Default capacity of a level.
+/// \note  Aging: if \b aging is not zero, pops, that pass over a waiting lower level, are counted
+///        per level. A level passed over \b aging times is served next (the highest one of such
+///        levels first), so no waiting level is starved, including the middle ones.
+/// \note  Waits on a closed queue don't block (see close).
+template<typename T, std::size_t LEVELS = 2, std::size_t SIZE = 2> class PriorityQueue
+{
+    static_assert(LEVELS > 0 && LEVELS <= 64, "Non-empty levels are kept in a 64 bit mask");
+    static_assert(SIZE > 0, "Level must have at least one slot");
+
+public:
+    using value_type = T;
+    using pointer_type = std::unique_ptr<T>;
+
+    PriorityQueue():
+        PriorityQueue{SIZE}
+    {}
+
+    /// \param aging Number of pops a waiting lower level may be passed over, 0 disables aging.
+    /// \throws std::invalid_argument
+    explicit PriorityQueue(std::size_t level_capacity, std::size_t aging = 0):
+        m_aging{aging}
+    {
+        if(level_capacity == 0)
+            throw std::invalid_argument{"Capacity must be positive"};
+        m_levels.reserve(LEVELS);
+        for(std::size_t cntr {0}; cntr < LEVELS; ++cntr)
+            m_levels.emplace_back(std::make_unique<level_t>(level_capacity));
+    }
+
+    PriorityQueue(const PriorityQueue&) = delete;
+    PriorityQueue(PriorityQueue&&) = delete;
+    PriorityQueue& operator=(const PriorityQueue&) = delete;
+    PriorityQueue& operator=(PriorityQueue&&) = delete;
+
+    ~PriorityQueue() = default;
+
+    /// \brief  Push value into \b level.
+    /// \return False if \b level has no space left to push \b v, true otherwise.
+    /// \throws std::out_of_range if there is no \b level
+    [[nodiscard]] bool push(T v, std::size_t level = 0)
+    {
+        check_level(level);
+        std::scoped_lock lk {m_mutex};
+        if(level_full(level))
+            return false;
+        emplace(std::move(v), level);
+        return true;
+    }
+
+    /// \brief  Dequeue element of the highest non-empty level and place it's value into \b v.
+    /// \return False if queue is empty, \b v keeps it's value.
+    ///         True otherwise, \b v contains dequeued value.
+    [[nodiscard]] bool pop(T& v)
+    {
+        std::scoped_lock lk {m_mutex};
+        if(!m_non_empty)
+            return false;
+        take(v);
+        return true;
+    }
+
+    /// \brief  Dequeue element of the highest non-empty level and return it's value.
+    /// \return nullptr if queue is empty, dequeued value otherwise.
+    [[nodiscard]] pointer_type pop()
+    {
+        std::scoped_lock lk {m_mutex};
+        if(!m_non_empty)
+            return nullptr;
+        pointer_type p;
+        take(p);
+        return p;
+    }
+
+    /// \brief  Dequeue element without allocation.
+    /// \return std::nullopt if queue is empty, dequeued value otherwise.
+    [[nodiscard]] std::optional<T> try_pop()
+    {
+        std::scoped_lock lk {m_mutex};
+        if(!m_non_empty)
+            return std::nullopt;
+        std::optional<T> v;
+        take(v);
+        return v;
+    }
+
+    /// \brief Wait until queue is empty.
+    /// \throws QueueClosed If queue is closed while it's empty.
+    void wait_until_empty()
+    {
+        std::unique_lock lk {m_mutex};
+        wait(lk, m_on_not_empty, m_parked_watchers, [this]{ return m_non_empty || m_closed; });
+        if(!m_non_empty)
+            throw QueueClosed{};
+    }
+
+    /// \brief Wait until queue is full.
+    /// \throws QueueClosed If queue is closed while it's full.
+    void wait_until_full()
+    {
+        std::unique_lock lk {m_mutex};
+        wait(lk, m_on_space_available, m_parked_producers, [this]{ return m_size < max_size() || m_closed; });
+        if(!(m_size < max_size()))
+            throw QueueClosed{};
+    }
+
+    /// \return True if queue is empty, false otherwise.
+    [[nodiscard]] bool empty() const
+    {
+        std::scoped_lock lk {m_mutex};
+        return !m_non_empty;
+    }
+
+    /// \return True if all levels are full, false otherwise.
+    [[nodiscard]] bool full() const
+    {
+        std::scoped_lock lk {m_mutex};
+        return !(m_size < max_size());
+    }
+
+    /// \brief  Wait if \b level is full, push \b v into it.
+    /// \throws std::out_of_range if there is no \b level
+    /// \throws QueueClosed If queue is closed while \b level is full.
+    void wait_and_push(T v, std::size_t level = 0)
+    {
+        check_level(level);
+        std::unique_lock lk {m_mutex};
+        wait(lk, m_on_space_available, m_parked_producers, [this, level]{ return !level_full(level) || m_closed; });
+        if(level_full(level))
+            throw QueueClosed{};
+        emplace(std::move(v), level);
+    }
+
+    /// \brief  Wait if \b level is full, push \b v into it.
+    ///         The wait is cancelled when stop is requested on \b stop_token.
+    /// \return False if stop is requested or queue is closed while \b level is full, true otherwise.
+    /// \throws std::out_of_range if there is no \b level
+    [[nodiscard]] bool wait_and_push(T v, std::size_t level, std::stop_token stop_token)
+    {
+        check_level(level);
+        const std::stop_callback on_stop {stop_token, [this]{ wake_all(); }};
+        std::unique_lock lk {m_mutex};
+        wait(lk, m_on_space_available, m_parked_producers,
+             [this, level, &stop_token]{ return !level_full(level) || stop_token.stop_requested() || m_closed; });
+        if(level_full(level))
+            return false;
+        emplace(std::move(v), level);
+        return true;
+    }
+
+    [[nodiscard]] bool wait_and_push(T v, std::stop_token stop_token)
+    {
+        return wait_and_push(std::move(v), 0, std::move(stop_token));
+    }
+
+    /// \brief  Wait until queue is empty, dequeue element and place it's value into \b v.
+    /// \throws QueueClosed If queue is closed while it's empty.
+    void wait_and_pop(T& v)
+    {
+        std::unique_lock lk {m_mutex};
+        wait(lk, m_on_not_empty, m_parked_consumers, [this]{ return m_non_empty || m_closed; });
+        if(!m_non_empty)
+            throw QueueClosed{};
+        take(v);
+    }
+
+    /// \brief  Wait until queue is empty, dequeue element and return it's value.
+    /// \throws QueueClosed If queue is closed while it's empty.
+    [[nodiscard]] pointer_type wait_and_pop()
+    {
+        std::unique_lock lk {m_mutex};
+        wait(lk, m_on_not_empty, m_parked_consumers, [this]{ return m_non_empty || m_closed; });
+        if(!m_non_empty)
+            throw QueueClosed{};
+        pointer_type p;
+        take(p);
+        return p;
+    }
+
+    /// \brief  Wait until queue is not empty or \b exit_condition is true,
+    ///         dequeue element and place it's value into \b v.
+    /// \return False if exit condition is met or queue is closed on empty queue, \b v keeps it's value.
+    template<typename P>
+    [[nodiscard]] bool wait_and_pop(T& v, P exit_condition)
+    {
+        std::unique_lock lk {m_mutex};
+        wait(lk, m_on_not_empty, m_parked_consumers, [this, &exit_condition]{ return m_non_empty || exit_condition() || m_closed; });
+        if(!m_non_empty)
+            return false;
+        take(v);
+        return true;
+    }
+
+    /// \brief  Wait until queue is not empty, dequeue element and place it's value into \b v.
+    ///         The wait is cancelled when stop is requested on \b stop_token,
+    ///         so elements left in queue are still dequeued after that.
+    /// \return False if stop is requested on empty queue, \b v keeps it's value.
+    [[nodiscard]] bool wait_and_pop(T& v, std::stop_token stop_token)
+    {
+        const std::stop_callback on_stop {stop_token, [this]{ wake_all(); }};
+        return wait_and_pop(v, [&stop_token]{ return stop_token.stop_requested(); });
+    }
+
+    template<typename P>
+    [[nodiscard]] pointer_type wait_and_pop(P exit_condition)
+    {
+        std::unique_lock lk {m_mutex};
+        wait(lk, m_on_not_empty, m_parked_consumers, [this, &exit_condition]{ return m_non_empty || exit_condition() || m_closed; });
+        if(!m_non_empty)
+            return nullptr;
+        pointer_type p;
+        take(p);
+        return p;
+    }
+
+    void clear()
+    {
+        std::scoped_lock lk {m_mutex};
+        for(auto& level:m_levels)
+            level->clear();
+        m_non_empty = 0;
+        m_size = 0;
+        m_passed_over.fill(0);
+        if(m_parked_producers)
+            m_on_space_available.notify_all();
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    /// \return Number of elements of \b level.
+    /// \throws std::out_of_range if there is no \b level
+    [[nodiscard]] std::size_t size(std::size_t level) const
+    {
+        check_level(level);
+        std::scoped_lock lk {m_mutex};
+        return m_levels[level]->size();
+    }
+
+    [[nodiscard]] std::size_t max_size() const noexcept
+    {
+        return LEVELS * m_levels.front()->capacity();
+    }
+
+    [[nodiscard]] static constexpr std::size_t levels() noexcept
+    {
+        return LEVELS;
+    }
+
+    /// \brief Close queue for waiting: threads blocked on it are woken and waits don't block
+    ///        any more (see Queue::close). Elements left in queue are still dequeued.
+    void close()
+    {
+        std::scoped_lock lk {m_mutex};
+        m_closed = true;
+        m_on_not_empty.notify_all();
+        m_on_space_available.notify_all();
+    }
+
+    /// \brief Let waits block again.
+    void open()
+    {
+        std::scoped_lock lk {m_mutex};
+        m_closed = false;
+    }
+
+    [[nodiscard]] bool closed() const
+    {
+        std::scoped_lock lk {m_mutex};
+        return m_closed;
+    }
+
+    [[nodiscard]] friend bool operator==(const PriorityQueue& l, const PriorityQueue& r)
+    {
+        for(std::size_t cntr {0}; cntr < LEVELS; ++cntr)
+        {
+            if(!(*l.m_levels[cntr] == *r.m_levels[cntr]))
+                return false;
+        }
+        return true;
+    }
+
+private:
+    using level_t = RingBuffer<T>;
+    using mask_t = std::uint64_t;
+
+    static void check_level(std::size_t level)
+    {
+        if(!(level < LEVELS))
+            throw std::out_of_range{"There is no such priority level"};
+    }
+
+    [[nodiscard]] bool level_full(std::size_t level) const noexcept
+    {
+        return !(m_levels[level]->size() < m_levels[level]->capacity());
+    }
+
+    /// \brief Must be called under the lock, \b level must have space.
+    void emplace(T&& v, std::size_t level)
+    {
+        m_levels[level]->emplace_back(std::move(v));
+        m_non_empty |= mask_t{1} << level;
+        ++m_size;
+        if(m_parked_watchers)
+            m_on_not_empty.notify_all();
+        else if(m_parked_consumers)
+            m_on_not_empty.notify_one();
+    }
+
+    [[nodiscard]] static std::size_t highest_of(mask_t levels) noexcept
+    {
+        return static_cast<std::size_t>(std::bit_width(levels)) - 1;
+    }
+
+    /// \brief The highest non-empty level, or the highest lower level that was passed over
+    ///        \b aging times. Waiting levels below the served one are passed over once more.
+    [[nodiscard]] std::size_t next_level() noexcept
+    {
+        auto level {highest_of(m_non_empty)};
+        if(!m_aging)
+            return level;
+        for(auto waiting {m_non_empty & ~(mask_t{1} << level)}; waiting;)
+        {
+            const auto lower {highest_of(waiting)};
+            if(!(m_passed_over[lower] < m_aging))
+            {
+                level = lower;
+                break;
+            }
+            waiting &= ~(mask_t{1} << lower);
+        }
+        for(auto waiting {m_non_empty & ((mask_t{1} << level) - 1)}; waiting; waiting &= waiting - 1)
+            ++m_passed_over[static_cast<std::size_t>(std::countr_zero(waiting))];
+        m_passed_over[level] = 0;
+        return level;
+    }
+
+    /// \brief Must be called under the lock on non-empty queue.
+    template<typename Out> void take(Out& out)
+    {
+        const auto level {next_level()};
+        auto& buffer {*m_levels[level]};
+        if constexpr(std::is_same_v<Out, pointer_type>)
+            out = std::make_unique<T>(std::move(buffer.front()));
+        else
+            out = std::move(buffer.front());
+        buffer.pop_front();
+        if(buffer.empty())
+            m_non_empty &= ~(mask_t{1} << level);
+        --m_size;
+        // producers may wait for different levels, so all of them are woken
+        if(m_parked_producers)
+            m_on_space_available.notify_all();
+    }
+
+    /// \brief Wake all parked threads, e.g. to let them check a stop request.
+    void wake_all()
+    {
+        std::scoped_lock lk {m_mutex};
+        m_on_not_empty.notify_all();
+        m_on_space_available.notify_all();
+    }
+
+    template<typename Ready>
+    void wait(std::unique_lock<std::mutex>& lk, std::condition_variable& cv, std::size_t& parked, Ready ready)
+    {
+        while(!ready())
+        {
+            ++parked;
+            cv.wait(lk);
+            --parked;
+        }
+    }
+
+
+    friend class boost::serialization::access;
+    // Number of levels, then elements of each level from the lowest one.
+    template<class Archive>
+    void save(Archive& ar, [[maybe_unused]] const unsigned int version) const
+    {
+        std::scoped_lock lk {m_mutex};
+        const std::size_t num_of_levels {LEVELS};
+        ar & BOOST_SERIALIZATION_NVP(num_of_levels);
+        for(const auto& level:m_levels)
+            ar & boost::serialization::make_nvp("m_level", *level);
+    }
+
+    /// \throws std::length_error if archive has other number of levels
+    ///         or more elements than a level may keep
+    template<class Archive>
+    void load(Archive& ar, [[maybe_unused]] const unsigned int version)
+    {
+        std::scoped_lock lk {m_mutex};
+        std::size_t num_of_levels {0};
+        ar & BOOST_SERIALIZATION_NVP(num_of_levels);
+        if(num_of_levels != LEVELS)
+            throw std::length_error{"Archive has other number of priority levels"};
+        m_non_empty = 0;
+        m_size = 0;
+        m_passed_over.fill(0);
+        for(std::size_t cntr {0}; cntr < LEVELS; ++cntr)
+        {
+            ar & boost::serialization::make_nvp("m_level", *m_levels[cntr]);
+            if(!m_levels[cntr]->empty())
+                m_non_empty |= mask_t{1} << cntr;
+            m_size += m_levels[cntr]->size();
+        }
+        if(m_parked_consumers || m_parked_watchers)
+            m_on_not_empty.notify_all();
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+
+    const std::size_t m_aging {0};
+    std::vector<std::unique_ptr<level_t>> m_levels;
+    mask_t m_non_empty {0};
+    std::size_t m_size {0};
+    /// \note Pops, that passed over a waiting level, per level.
+    std::array<std::size_t, LEVELS> m_passed_over {};
+    std::condition_variable m_on_not_empty;
+    std::condition_variable m_on_space_available;
+    std::size_t m_parked_consumers {0};
+    /// \note Threads in wait_until_empty, they share m_on_not_empty with consumers,
+    ///       but don't take an element, so a single notification may be lost on them.
+    std::size_t m_parked_watchers {0};
+    std::size_t m_parked_producers {0};
+    bool m_closed {false};
+    mutable std::mutex m_mutex;
+};
+
+}
@@ -9,124 +9,927 @@
 #include <condition_variable>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <stop_token>
+#include <type_traits>
+#include <optional>
+#include <limits>
+#include <chrono>
+#include <span>
 
 #include "Queue.hpp"
+#include "LockFreeQueue.hpp"
+#include "SpscQueue.hpp"
+#include "ShardedQueue.hpp"
+#include "ThreadPool.hpp"
 
 namespace producer_consumer
 {
 
 struct PCException{};
 
-template<typename T> class Framework
+/// \brief What Framework::stop does with elements left in queue.
+enum class StopPolicy
 {
+    drain,  ///< consumers handle elements left in queue before they finish
+    abandon ///< elements left in queue are dropped
+};
+
+/// \brief Which CPUs Framework threads run on. An empty list means any CPU.
+struct Placement
+{
+    std::vector<unsigned> producer_cpus;
+    std::vector<unsigned> consumer_cpus;
+    /// \brief Pin i-th producer (consumer) to a single CPU, the i-th of it's list round-robin,
+    ///        instead of letting it run on any CPU of the list.
+    bool one_cpu_per_thread {false};
+    /// \brief Move queue storage to the NUMA node of consumer CPUs before threads are started.
+    bool numa_local_queue {false};
+};
+
+/// \brief Producer or consumer of \b Queue: void(std::stop_token, Queue&) or void(Queue&).
+template<typename F, typename Queue>
+concept role_for = std::is_invocable_v<const F&, Queue&> || std::is_invocable_v<const F&, std::stop_token, Queue&>;
+
+/// \brief Consumer autoscaling of Framework. Queue is sampled every sample_interval.
+///        A consumer is added when queue is overloaded, and retired when it is underloaded,
+///        for samples_to_scale samples in a row. Up and down thresholds differ, so the number
+///        of consumers doesn't flap around one threshold.
+/// \note  Latency is time an element waits in queue, estimated by Little's law as
+///        depth / dequeue rate. It's measured for queues with QueueStats only, 0 otherwise.
+struct Autoscaling
+{
+    std::size_t min_consumers {1};
+    std::size_t max_consumers {1};
+    /// \brief Overloaded: depth is at least scale_up_depth or latency is at least scale_up_latency.
+    ///        Latency isn't checked unless scale_up_latency is set.
+    std::size_t scale_up_depth {std::numeric_limits<std::size_t>::max()};
+    std::optional<std::chrono::nanoseconds> scale_up_latency;
+    /// \brief Underloaded: depth is at most scale_down_depth and latency is at most scale_down_latency.
+    ///        Latency isn't checked unless scale_down_latency is set.
+    std::size_t scale_down_depth {0};
+    std::optional<std::chrono::nanoseconds> scale_down_latency;
+    std::chrono::milliseconds sample_interval {10};
+    std::size_t samples_to_scale {3};
+};
+
+/// \brief Consumer autoscaling state at some moment.
+struct ScalingStats
+{
+    std::size_t num_of_consumers {0};
+    std::uint64_t scale_ups {0};
+    std::uint64_t scale_downs {0};
+    std::size_t depth {0};                ///< queue depth of the last sample
+    std::chrono::nanoseconds latency {0}; ///< estimated latency of the last sample
+};
+
+/// \brief Batch sizes and linger times of Framework batch consumers.
+struct BatchingStats
+{
+    threadsafe_containers::Histogram::buckets_t batch_sizes {};
+    threadsafe_containers::Histogram::buckets_t linger_times {}; ///< microseconds from the first element to the call
+};
+
+/// \brief Coroutine consumer of \b Queue: Task(std::stop_token, Queue&) or Task(Queue&).
+template<typename F, typename Queue>
+concept coroutine_for = std::is_same_v<std::invoke_result_t<const F&, Queue&>, threadsafe_containers::Task> ||
+                        std::is_same_v<std::invoke_result_t<const F&, std::stop_token, Queue&>, threadsafe_containers::Task>;
+
+/// \brief Producer or consumer step of executor mode: bool(Queue&).
+template<typename F, typename Queue>
+concept step_for = std::is_invocable_v<const F&, Queue&> && std::is_same_v<std::invoke_result_t<const F&, Queue&>, bool>;
+
+/// \brief Queue shared by \b num_of_consumers. A sharded queue gets a shard per consumer.
+template<typename Queue>
+[[nodiscard]] Queue make_queue(std::size_t num_of_consumers)
+{
+    if constexpr(requires { Queue::is_sharded; })
+        return Queue(std::max<std::size_t>(num_of_consumers, 1));
+    else
+        return Queue();
+}
+
+/// \brief Same as above with capacity \b queue_capacity, that is split between shards of a sharded queue.
+template<typename Queue>
+[[nodiscard]] Queue make_queue(std::size_t num_of_consumers, std::size_t queue_capacity)
+{
+    if constexpr(requires { Queue::is_sharded; })
+    {
+        const auto num_of_shards {std::max<std::size_t>(num_of_consumers, 1)};
+        return Queue(num_of_shards, std::max<std::size_t>((queue_capacity + num_of_shards - 1) / num_of_shards, 1));
+    }
+    else
+        return Queue(queue_capacity);
+}
+
+/// \brief Runs producers and consumers, that share a queue, in a separate threads.
+/// \tparam Q Queue type. Any queue with the interface of threadsafe_containers::Queue,
+///           including close() and open(), e.g. threadsafe_containers::LockFreeQueue. A sharded queue
+///           (threadsafe_containers::ShardedQueue) gets a shard per consumer.
+/// \note  If there are one producer and one consumer and all the callables accept
+///        spsc_queue_t& (e.g. generic lambdas taking auto&), spsc_queue_t is used instead of Q.
+/// \note  Producers and consumers get a std::stop_token, if they accept it. Stop is requested
+///        by stop() or destructor. Cancellable queue waits (e.g. wait_and_pop(v, stop_token))
+///        return as soon as stop is requested, but not before queue is drained.
+///        Then queue is closed (see threadsafe_containers::Queue::close), so a consumer
+///        without a stop token is stopped too: once queue is drained, it's wait_and_pop(v)
+///        throws threadsafe_containers::QueueClosed, which is caught by Framework.
+/// \note  Executor mode: if producer and consumer return bool, they are steps run as tasks
+///        of a ThreadPool instead of a thread per producer and consumer. A step must not block
+///        on queue (use push/try_pop) and returns true if it should be run again, false
+///        if the producer (consumer) is done. Number of threads doesn't depend on the number
+///        of producers and consumers then. A step, that leaves queue empty (full for a producer),
+///        backs off before it's run again.
+/// \note  Coroutine mode: if consumer returns threadsafe_containers::Task, consumers are coroutines
+///        run by a ThreadPool, while producers have a thread each. A consumer waits with
+///        co_await queue.async_pop(stop_token) (see threadsafe_containers::Queue), so a waiting
+///        consumer is a suspended frame and thousands of consumers share a few threads.
+/// \note  Batch mode: if consumer accepts std::span<T>, consumer threads collect up to
+///        max batch size elements, waiting no more than linger time after the first one,
+///        and call the consumer once per batch (see set_batching).
+/// \note  Producers and consumers may be pinned to CPUs and queue may be moved to the NUMA node
+///        of consumers (see set_placement). Placement isn't applied to executor mode.
+template<typename T, typename Q = threadsafe_containers::Queue<T>> class Framework
+{
+    static_assert(std::is_same_v<typename Q::value_type, T>, "Queue must keep elements of type T");
+    static_assert(requires(Q& q) { q.close(); q.open(); },
+                  "Queue must be closable, so consumers without a stop token are stopped");
+
 public:
-    using queue_t = threadsafe_containers::Queue<T>;
+    using queue_t = Q;
+    using spsc_queue_t = threadsafe_containers::SpscQueue<T>;
 
-//    using ProducerT = void(std::stop_token stop_token, queue_t& queue);
-//    using ConsumerT = void(std::stop_token stop_token, queue_t& queue);
-    using ProducerT = void(queue_t& queue);
-    using ConsumerT = void(queue_t& queue);
+    using ProducerT = void(std::stop_token stop_token, queue_t& queue);
+    using ConsumerT = void(std::stop_token stop_token, queue_t& queue);
     using MainT = void(queue_t& queue);
 
+    using CoroutineConsumerT = threadsafe_containers::Task(std::stop_token stop_token, queue_t& queue);
+    using BatchConsumerT = void(std::span<T> batch);
+
+    using ProducerStepT = bool(queue_t& queue);
+    using ConsumerStepT = bool(queue_t& queue);
+
+    using SpscProducerT = void(std::stop_token stop_token, spsc_queue_t& queue);
+    using SpscConsumerT = void(std::stop_token stop_token, spsc_queue_t& queue);
+    using SpscMainT = void(spsc_queue_t& queue);
+
 public:
     template<typename P, typename C, typename M>
     Framework(const P& producer, std::size_t num_of_producers,
               const C& consumer, std::size_t num_of_consumers,
               const M& main_cycle):
-        m_producer{producer},
-        m_consumer{consumer},
+        m_queue(make_queue<queue_t>(num_of_consumers)),
+        m_producer{role<queue_t>(producer)},
+        m_consumer{role<queue_t>(consumer)},
         m_main{main_cycle},
         m_num_of_producers{num_of_producers},
         m_num_of_consumers{num_of_consumers}
-    {}
+    {
+        bind_steps(producer, consumer);
+        bind_coroutines(consumer);
+        bind_batches(consumer);
+        if(!executor_mode() && !coroutine_mode())
+            bind_spsc(producer, consumer, main_cycle);
+    }
+
+    /// \brief Same as above, but queue is created with capacity \b queue_capacity.
+    template<typename P, typename C, typename M>
+        requires std::constructible_from<queue_t, std::size_t>
+    Framework(const P& producer, std::size_t num_of_producers,
+              const C& consumer, std::size_t num_of_consumers,
+              const M& main_cycle, std::size_t queue_capacity):
+        m_queue(make_queue<queue_t>(num_of_consumers, queue_capacity)),
+        m_producer{role<queue_t>(producer)},
+        m_consumer{role<queue_t>(consumer)},
+        m_main{main_cycle},
+        m_num_of_producers{num_of_producers},
+        m_num_of_consumers{num_of_consumers}
+    {
+        bind_steps(producer, consumer);
+        bind_coroutines(consumer);
+        bind_batches(consumer);
+        if(!executor_mode() && !coroutine_mode())
+            bind_spsc(producer, consumer, main_cycle);
+    }
 
     ~Framework()
     {
-//        if(producers_left)
-//        {
-//            for(auto& t:m_producers)
-//                t.request_stop();
-//        }
-//        if(consumers_left)
-//        {
-//            for(auto& t:m_consumers)
-//                t.request_stop();
-//        }
-//        wait();
+        stop();
+    }
+
+    /// \return True if elements are passed through spsc_queue_t.
+    [[nodiscard]] bool spsc_mode() const noexcept
+    {
+        return static_cast<bool>(m_spsc_main);
+    }
+
+    /// \return True if producers and consumers are run as tasks of a thread pool.
+    [[nodiscard]] bool executor_mode() const noexcept
+    {
+        return static_cast<bool>(m_producer_step);
+    }
+
+    /// \return True if consumers are coroutines run by a thread pool.
+    [[nodiscard]] bool coroutine_mode() const noexcept
+    {
+        return static_cast<bool>(m_coroutine_consumer);
+    }
+
+    /// \return True if consumer is called with batches of elements.
+    [[nodiscard]] bool batch_mode() const noexcept
+    {
+        return static_cast<bool>(m_batch_consumer);
+    }
+
+    /// \brief Batch consumer is called with up to \b max_batch_size elements, once the batch
+    ///        is full or \b linger_time passes since it's first element is taken.
+    ///        64 elements and 1 ms by default.
+    void set_batching(std::size_t max_batch_size, std::chrono::microseconds linger_time) noexcept
+    {
+        m_max_batch_size = std::max<std::size_t>(max_batch_size, 1);
+        m_linger_time = linger_time;
+    }
+
+    [[nodiscard]] BatchingStats batching_stats() const noexcept
+    {
+        return {m_batch_sizes.snapshot(), m_linger_times.snapshot()};
+    }
+
+    /// \brief Number of pool threads in executor and coroutine modes, hardware concurrency by default.
+    void set_num_of_workers(std::size_t num_of_workers) noexcept
+    {
+        m_num_of_workers = num_of_workers;
     }
 
+    /// \brief Add and retire consumers of next runs between autoscaling bounds while producers run.
+    ///        Applies to a thread per consumer of queue_t. Sharded queues have a shard
+    ///        per consumer given to constructor, so they aren't scaled.
+    /// \note  A consumer is retired by a stop request, so it must return when stop is requested.
+    void set_autoscaling(Autoscaling autoscaling)
+        requires (!requires { queue_t::is_sharded; })
+    {
+        m_autoscaling = autoscaling;
+    }
+
+    /// \return Snapshot of autoscaling state. Doesn't block the controller.
+    [[nodiscard]] ScalingStats scaling_stats() const noexcept
+    {
+        return {m_scaling.num_of_consumers.load(std::memory_order_relaxed),
+                m_scaling.scale_ups.load(std::memory_order_relaxed),
+                m_scaling.scale_downs.load(std::memory_order_relaxed),
+                m_scaling.depth.load(std::memory_order_relaxed),
+                std::chrono::nanoseconds{m_scaling.latency.load(std::memory_order_relaxed)}};
+    }
+
+    /// \brief CPUs producers and consumers of next runs are pinned to.
+    void set_placement(Placement placement)
+    {
+        m_placement = std::move(placement);
+    }
+
+    /// \brief Start producers and consumers and run main cycle in the calling thread.
+    ///        Producers and consumers of a previous run are stopped first.
+    /// \note  In executor mode returns when all producers and consumers are done.
     void run()
+    {
+        stop();
+        m_stop_source = std::stop_source{};
+        m_coroutines_stop_source = std::stop_source{};
+        m_queue.open();
+        if(m_spsc_queue)
+            m_spsc_queue->open();
+        if(executor_mode())
+            run_executor();
+        else if(coroutine_mode())
+            run_coroutines();
+        else if(spsc_mode())
+            run(*m_spsc_queue, m_spsc_producer, m_spsc_consumer, m_spsc_main);
+        else
+            run(m_queue, m_producer, m_consumer, m_main);
+    }
+
+    /// \brief Wait until producers and consumers finish their work.
+    ///        Wakes as soon as the last of them is done.
+    void join()
+    {
+        wait_for(producers_left);
+        stop_autoscaling();
+        wait_for(consumers_left);
+        m_producers.clear();
+        m_consumers.clear();
+        m_retired_consumers.clear();
+        m_scheduler.reset();
+    }
+
+    /// \brief Request stop of producers and wait until they are done,
+    ///        then request stop of consumers, close queue and wait until consumers are done.
+    /// \param policy With StopPolicy::abandon queue is cleared before consumers are stopped.
+    /// \note  In spsc mode queue may be cleared only after the consumer is done,
+    ///        so the consumer may handle elements left in queue.
+    void stop(StopPolicy policy = StopPolicy::drain)
+    {
+        m_stop_policy = policy;
+        m_stop_source.request_stop();
+        for(auto& producer:m_producers)
+            producer.request_stop();
+        wait_for(producers_left);
+        stop_autoscaling();
+        if(policy == StopPolicy::abandon)
+            m_queue.clear();
+        for(auto& consumer:m_consumers)
+            consumer.thread.request_stop();
+        m_coroutines_stop_source.request_stop();
+        m_queue.close();
+        if(m_spsc_queue)
+            m_spsc_queue->close();
+        join();
+        if(policy == StopPolicy::abandon && m_spsc_queue)
+            m_spsc_queue->clear();
+    }
+
+private:
+    using threads_cntr_t = std::atomic<std::size_t>;
+    using clock = std::chrono::steady_clock;
+
+    /// \brief Consumer thread and it's flag set when it's done, so a retired consumer
+    ///        may be joined without waiting for it.
+    struct Consumer
+    {
+        std::unique_ptr<std::atomic_bool> done {std::make_unique<std::atomic_bool>(false)};
+        /// \note Declared after the flag, so the thread is joined before the flag is destroyed.
+        std::jthread thread;
+    };
+
+    /// \brief Pauses of idle steps in executor mode.
+    static constexpr std::chrono::microseconds min_idle_pause {10};
+    static constexpr std::chrono::microseconds max_idle_pause {1000};
+
+    /// \brief Written by autoscaling controller, read by scaling_stats().
+    struct Scaling
+    {
+        std::atomic<std::size_t> num_of_consumers {0};
+        std::atomic<std::uint64_t> scale_ups {0};
+        std::atomic<std::uint64_t> scale_downs {0};
+        std::atomic<std::size_t> depth {0};
+        std::atomic<std::chrono::nanoseconds::rep> latency {0};
+    };
+
+    template<typename Queue, typename F>
+    [[nodiscard]] static std::function<void(std::stop_token, Queue&)> role(const F& f)
+    {
+        if constexpr(std::is_invocable_v<const F&, std::stop_token, Queue&>)
+            return f;
+        else if constexpr(std::is_invocable_v<const F&, Queue&>)
+            return [f](std::stop_token, Queue& queue){ f(queue); };
+        else
+            return {};
+    }
+
+    static void wait_for(const threads_cntr_t& left)
+    {
+        for(auto n {left.load()}; n; n = left.load())
+            left.wait(n);
+    }
+
+    static void finished(threads_cntr_t& left)
+    {
+        if(--left == 0)
+            left.notify_all();
+    }
+
+    /// \brief Pin the calling thread, \b index-th of it's role, to \b cpus.
+    void place(const std::vector<unsigned>& cpus, std::size_t index) const
+    {
+        if(cpus.empty())
+            return;
+        if(m_placement.one_cpu_per_thread)
+            threadsafe_containers::pin_current_thread({cpus[index % cpus.size()]});
+        else
+            threadsafe_containers::pin_current_thread(cpus);
+    }
+
+    /// \brief Move storage of \b queue to the NUMA node of consumer CPUs, if it is requested.
+    ///        A queue, that can't bind it's own storage, stays where it is.
+    template<typename Queue>
+    void place(const Queue& queue) const
+    {
+        if(!m_placement.numa_local_queue || m_placement.consumer_cpus.empty())
+            return;
+        // node is that of the CPU a thread pinned to consumer CPUs is run on
+        unsigned node {0};
+        std::jthread{[this, &node]
+        {
+            threadsafe_containers::pin_current_thread(m_placement.consumer_cpus);
+            node = threadsafe_containers::current_numa_node();
+        }}.join();
+        if constexpr(requires { queue.bind_to_numa_node(node); })
+            queue.bind_to_numa_node(node);
+    }
+
+    /// \brief Keep callables for spsc_queue_t if they accept it and there are
+    ///        one producer and one consumer.
+    template<typename P, typename C, typename M>
+    void bind_spsc(const P& producer, const C& consumer, const M& main_cycle)
+    {
+        if constexpr(role_for<P, spsc_queue_t> && role_for<C, spsc_queue_t> &&
+                     std::is_invocable_v<const M&, spsc_queue_t&>)
+        {
+            if(m_num_of_producers == 1 && m_num_of_consumers == 1)
+            {
+                m_spsc_producer = role<spsc_queue_t>(producer);
+                m_spsc_consumer = role<spsc_queue_t>(consumer);
+                m_spsc_main = main_cycle;
+                m_spsc_queue = std::make_unique<spsc_queue_t>(m_queue.max_size());
+            }
+        }
+    }
+
+    /// \brief Keep producer and consumer as steps if both of them return bool.
+    template<typename P, typename C>
+    void bind_steps(const P& producer, const C& consumer)
+    {
+        if constexpr(step_for<P, queue_t> && step_for<C, queue_t>)
+        {
+            m_producer_step = producer;
+            m_consumer_step = consumer;
+        }
+    }
+
+    /// \brief Keep consumer as a coroutine if it returns Task.
+    template<typename C>
+    void bind_coroutines(const C& consumer)
+    {
+        if constexpr(coroutine_for<C, queue_t>)
+        {
+            if constexpr(std::is_invocable_v<const C&, std::stop_token, queue_t&>)
+                m_coroutine_consumer = consumer;
+            else
+                m_coroutine_consumer = [consumer](std::stop_token, queue_t& queue){ return consumer(queue); };
+        }
+    }
+
+    /// \brief Keep consumer as a batch consumer if it accepts std::span<T>.
+    template<typename C>
+    void bind_batches(const C& consumer)
+    {
+        if constexpr(std::is_invocable_v<const C&, std::span<T>> && !role_for<C, queue_t>)
+        {
+            m_batch_consumer = consumer;
+            m_consumer = [this](std::stop_token stop_token, queue_t& queue){ consume_batches(stop_token, queue); };
+        }
+    }
+
+    void consume_batches(std::stop_token stop_token, queue_t& queue)
+    {
+        std::vector<T> batch;
+        batch.reserve(m_max_batch_size);
+        T v;
+        while(queue.wait_and_pop(v, stop_token))
+        {
+            const auto first {clock::now()};
+            batch.push_back(std::move(v));
+            collect(queue, batch, first + m_linger_time);
+            m_batch_sizes.add(batch.size());
+            m_linger_times.add(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - first).count());
+            m_batch_consumer(std::span<T>{batch});
+            batch.clear();
+        }
+    }
+
+    /// \brief Add elements to \b batch until it is full, or queue is empty after \b deadline.
+    void collect(queue_t& queue, std::vector<T>& batch, clock::time_point deadline)
+    {
+        while(batch.size() < m_max_batch_size)
+        {
+            if constexpr(requires { queue.wait_and_pop_bulk_until(std::back_inserter(batch), m_max_batch_size, deadline); })
+            {
+                if(!queue.wait_and_pop_bulk_until(std::back_inserter(batch), m_max_batch_size - batch.size(), deadline))
+                    return;
+            }
+            else
+            {
+                // the queue can't wait with a timeout, so it's polled
+                T v;
+                if(queue.pop(v))
+                    batch.push_back(std::move(v));
+                else if(clock::now() < deadline)
+                    std::this_thread::yield();
+                else
+                    return;
+            }
+        }
+    }
+
+    /// \brief Run \b step as a task, which reschedules itself until the step is done
+    ///        or it is stopped. A step, that left nothing to do (empty queue for a consumer,
+    ///        full one for a producer), runs again after a pause, that doubles up to
+    ///        max_idle_pause while it stays idle, so idle steps don't keep workers polling.
+    /// \note  The pause is skipped if queue state changed meanwhile.
+    void schedule(ThreadPool& pool, std::function<bool(queue_t&)>& step, threads_cntr_t& left, bool consumer,
+                  std::chrono::microseconds pause = {})
+    {
+        pool.submit([this, &pool, &step, &left, consumer, pause]()
+        {
+            if(pause.count() && idle(consumer) && !stopped(consumer))
+                std::this_thread::sleep_for(pause);
+            if(!stopped(consumer) && step(m_queue))
+                schedule(pool, step, left, consumer, idle(consumer) ? std::clamp(2 * pause, min_idle_pause, max_idle_pause):
+                                                                      std::chrono::microseconds{});
+            else
+                finished(left);
+        });
+    }
+
+    /// \return True if a consumer (producer) step has nothing to do.
+    [[nodiscard]] bool idle(bool consumer) const
+    {
+        return consumer ? m_queue.empty(): m_queue.full();
+    }
+
+    /// \brief Producers stop as soon as stop is requested. Consumers stop after producers
+    ///        are done and queue is drained, or at once if it is abandoned.
+    [[nodiscard]] bool stopped(bool consumer) const
+    {
+        if(!m_stop_source.stop_requested())
+            return false;
+        if(!consumer)
+            return true;
+        return !producers_left && (m_stop_policy == StopPolicy::abandon || m_queue.empty());
+    }
+
+    void run_executor()
     {
         producers_left = m_num_of_producers;
         consumers_left = m_num_of_consumers;
 
-//        auto producer_wrapper = [this](std::stop_token stop_token)
-//        {
-//            m_producer(stop_token, m_queue);
-//            --producers_left;
-//        };
-//        auto consumer_wrapper = [this](std::stop_token stop_token)
-//        {
-//            m_consumer(stop_token, m_queue);
-//            --consumers_left;
-//        };
-        auto producer_wrapper = [this]()
-        {
-            m_producer(m_queue);
-            --producers_left;
-        };
-        auto consumer_wrapper = [this]()
+        // every producer and consumer has at most one task at a time
+        ThreadPool pool {m_num_of_workers, m_num_of_producers + m_num_of_consumers};
+        for(std::size_t cntr {0}; cntr < m_num_of_producers; ++cntr)
+            schedule(pool, m_producer_step, producers_left, false);
+        for(std::size_t cntr {0}; cntr < m_num_of_consumers; ++cntr)
+            schedule(pool, m_consumer_step, consumers_left, true);
+
+        m_main(m_queue);
+        pool.wait();
+    }
+
+    /// \brief Consumer coroutine, that counts itself finished when it's done.
+    threadsafe_containers::Task consume(std::stop_token stop_token)
+    {
+        co_await m_coroutine_consumer(stop_token, m_queue);
+        finished(consumers_left);
+    }
+
+    void run_coroutines()
+    {
+        producers_left = m_num_of_producers;
+        consumers_left = m_num_of_consumers;
+
+        place(m_queue);
+
+        // every consumer is scheduled at most once at a time
+        m_scheduler = std::make_unique<ThreadPool>(m_num_of_workers, m_num_of_consumers + 1);
+        for(std::size_t cntr {0}; cntr < m_num_of_consumers; ++cntr)
+            consume(m_coroutines_stop_source.get_token()).start(*m_scheduler);
+        start_producers(m_queue, m_producer);
+
+        m_main(m_queue);
+    }
+
+    template<typename Queue>
+    void start_producers(Queue& queue, std::function<void(std::stop_token, Queue&)>& producer)
+    {
+        auto producer_wrapper = [this, &queue, &producer](std::stop_token stop_token, std::size_t index)
         {
-            m_consumer(m_queue);
-            --consumers_left;
+            place(m_placement.producer_cpus, index);
+            try
+            {
+                producer(stop_token, queue);
+            }
+            catch(const threadsafe_containers::QueueClosed&)
+            {}
+            finished(producers_left);
         };
 
         m_producers.reserve(m_num_of_producers);
         for(std::size_t cntr {0}; cntr < m_num_of_producers; ++cntr)
-            m_producers.emplace_back(producer_wrapper);
+            m_producers.emplace_back(producer_wrapper, cntr);
+    }
 
-        m_consumers.reserve(m_num_of_consumers);
-        for(std::size_t cntr {0}; cntr < m_num_of_consumers; ++cntr)
-            m_consumers.emplace_back(consumer_wrapper);
+    /// \return Number of elements dequeued so far, if queue counts them.
+    [[nodiscard]] std::uint64_t dequeued() const noexcept
+    {
+        if constexpr(requires { m_queue.stats(); })
+            return m_queue.stats().pops;
+        else
+            return 0;
+    }
 
-        for(auto& prod:m_producers)
-        {
-            if(prod.joinable())
-                prod.detach();
-        }
-        for(auto& cons:m_consumers)
+    /// \brief Little's law: an element waits depth / dequeue rate.
+    ///        With nothing dequeued, waiting elements wait forever as far as it's known.
+    [[nodiscard]] static std::chrono::nanoseconds latency(std::size_t depth, std::uint64_t popped,
+                                                          std::chrono::nanoseconds elapsed) noexcept
+    {
+        if(!depth)
+            return std::chrono::nanoseconds{0};
+        if(!popped)
+            return std::chrono::nanoseconds::max();
+        return elapsed * static_cast<std::chrono::nanoseconds::rep>(depth) / static_cast<std::chrono::nanoseconds::rep>(popped);
+    }
+
+    /// \brief Autoscaling controller. The only writer of m_consumers while it runs.
+    void autoscale(std::stop_token stop_token)
+    {
+        const auto& autoscaling {*m_autoscaling};
+        std::mutex mutex;
+        std::condition_variable_any sleep;
+        std::unique_lock lk {mutex};
+        std::size_t overloaded {0};
+        std::size_t underloaded {0};
+        auto last_dequeued {dequeued()};
+        auto last_sample {clock::now()};
+        for(;;)
         {
-            if(cons.joinable())
-                cons.detach();
+            sleep.wait_for(lk, stop_token, autoscaling.sample_interval, []{ return false; });
+            if(stop_token.stop_requested())
+                return;
+
+            const auto depth {m_queue.size()};
+            const auto now {clock::now()};
+            const auto popped {dequeued()};
+            const auto wait {requires { m_queue.stats(); } ? latency(depth, popped - last_dequeued, now - last_sample)
+                                                           : std::chrono::nanoseconds{0}};
+            last_dequeued = popped;
+            last_sample = now;
+            m_scaling.depth.store(depth, std::memory_order_relaxed);
+            m_scaling.latency.store(wait.count(), std::memory_order_relaxed);
+
+            const bool slow {autoscaling.scale_up_latency && wait >= *autoscaling.scale_up_latency};
+            const bool fast {!autoscaling.scale_down_latency || wait <= *autoscaling.scale_down_latency};
+            overloaded = depth >= autoscaling.scale_up_depth || slow ? overloaded + 1 : 0;
+            underloaded = depth <= autoscaling.scale_down_depth && fast ? underloaded + 1 : 0;
+            if(overloaded >= autoscaling.samples_to_scale && m_consumers.size() < autoscaling.max_consumers)
+            {
+                ++consumers_left;
+                start_consumer(m_queue, m_consumer, m_consumers.size());
+                m_scaling.scale_ups.fetch_add(1, std::memory_order_relaxed);
+                overloaded = 0;
+            }
+            else if(underloaded >= autoscaling.samples_to_scale && m_consumers.size() > autoscaling.min_consumers)
+            {
+                retire_consumer();
+                m_scaling.scale_downs.fetch_add(1, std::memory_order_relaxed);
+                underloaded = 0;
+            }
+            m_scaling.num_of_consumers.store(m_consumers.size(), std::memory_order_relaxed);
         }
+    }
 
-        m_main(m_queue);
-//        wait();
+    /// \brief Request stop of the last consumer. It's joined later, so the controller doesn't wait
+    ///        for it: by join(), or by a later retirement once it's done, so they don't pile up.
+    void retire_consumer()
+    {
+        m_consumers.back().thread.request_stop();
+        m_retired_consumers.push_back(std::move(m_consumers.back()));
+        m_consumers.pop_back();
+        std::erase_if(m_retired_consumers, [](const Consumer& consumer){ return consumer.done->load(std::memory_order_acquire); });
     }
 
-private:
-    using threads_cntr_t = std::atomic<std::size_t>;
+    /// \brief Stop the controller, so consumers aren't added or retired any more.
+    void stop_autoscaling()
+    {
+        m_controller = std::jthread{};
+    }
 
-    /// \brief wait until consumers and producers finish their work
-    void wait()
+    template<typename Queue>
+    void start_consumer(Queue& queue, std::function<void(std::stop_token, Queue&)>& consumer, std::size_t index)
     {
-        while(consumers_left || producers_left)
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        auto& done {*m_consumers.emplace_back().done};
+        m_consumers.back().thread = std::jthread{[this, &queue, &consumer, &done](std::stop_token stop_token, std::size_t index)
+        {
+            place(m_placement.consumer_cpus, index);
+            try
+            {
+                consumer(stop_token, queue);
+            }
+            catch(const threadsafe_containers::QueueClosed&)
+            {}
+            finished(consumers_left);
+            done.store(true, std::memory_order_release);
+        }, index};
+    }
+
+    template<typename Queue>
+    void run(Queue& queue,
+             std::function<void(std::stop_token, Queue&)>& producer,
+             std::function<void(std::stop_token, Queue&)>& consumer,
+             std::function<void(Queue&)>& main_cycle)
+    {
+        constexpr bool scalable {std::is_same_v<Queue, queue_t>};
+        const bool autoscaled {scalable && m_autoscaling};
+        const auto num_of_consumers {autoscaled ? std::clamp(m_num_of_consumers, m_autoscaling->min_consumers,
+                                                             std::max(m_autoscaling->min_consumers, m_autoscaling->max_consumers))
+                                                : m_num_of_consumers};
+        producers_left = m_num_of_producers;
+        consumers_left = num_of_consumers;
+
+        place(queue);
+
+        start_producers(queue, producer);
+
+        m_consumers.reserve(autoscaled ? m_autoscaling->max_consumers : num_of_consumers);
+        for(std::size_t cntr {0}; cntr < num_of_consumers; ++cntr)
+            start_consumer(queue, consumer, cntr);
+        m_scaling.num_of_consumers.store(num_of_consumers, std::memory_order_relaxed);
+
+        if constexpr(scalable)
+        {
+            if(autoscaled)
+                m_controller = std::jthread{[this](std::stop_token stop_token){ autoscale(stop_token); }};
+        }
+
+        main_cycle(queue);
     }
 
     queue_t m_queue;
+    /// \brief Created only in spsc mode, since it takes as much memory as the queue.
+    std::unique_ptr<spsc_queue_t> m_spsc_queue;
 
     std::function<ProducerT> m_producer;
     std::function<ConsumerT> m_consumer;
     std::function<MainT>     m_main;
+    std::function<ProducerStepT> m_producer_step;
+    std::function<ConsumerStepT> m_consumer_step;
+    std::function<CoroutineConsumerT> m_coroutine_consumer;
+    std::function<BatchConsumerT> m_batch_consumer;
+    std::function<SpscProducerT> m_spsc_producer;
+    std::function<SpscConsumerT> m_spsc_consumer;
+    std::function<SpscMainT>     m_spsc_main;
     std::size_t m_num_of_producers {1};
     std::size_t m_num_of_consumers {1};
+    std::size_t m_num_of_workers {ThreadPool::default_num_of_threads()};
+    Placement m_placement;
+    std::optional<Autoscaling> m_autoscaling;
+    Scaling m_scaling;
+    std::size_t m_max_batch_size {64};
+    std::chrono::microseconds m_linger_time {1000};
+    threadsafe_containers::Histogram m_batch_sizes;
+    threadsafe_containers::Histogram m_linger_times;
 
-    std::vector<std::thread> m_producers;
-    std::vector<std::thread> m_consumers;
-
+    std::stop_source m_stop_source;
+    /// \brief Stop of coroutine consumers is requested after producers are done.
+    std::stop_source m_coroutines_stop_source;
+    std::atomic<StopPolicy> m_stop_policy {StopPolicy::drain};
     threads_cntr_t producers_left {0};
     threads_cntr_t consumers_left {0};
+
+    std::vector<std::jthread> m_producers;
+    std::vector<Consumer> m_consumers;
+    std::vector<Consumer> m_retired_consumers;
+    /// \brief Autoscaling controller.
+    std::jthread m_controller;
+    /// \brief Runs coroutine consumers. Must be destroyed before the queue they wait on.
+    std::unique_ptr<ThreadPool> m_scheduler;
+};
+
+/// \brief Framework variant, that keeps producer, consumer and main cycle of their own types
+///        instead of std::function: calls of them may be inlined and captures of lambdas aren't
+///        moved to the heap. Thread per producer and consumer, like Framework thread mode.
+/// \tparam Q Queue type, any queue with the interface of threadsafe_containers::Queue.
+/// \tparam P Producer: void(std::stop_token, Q&) or void(Q&).
+/// \tparam C Consumer: void(std::stop_token, Q&) or void(Q&).
+/// \tparam M Main cycle: void(Q&).
+/// \note  See make_framework, that deduces callable types.
+template<typename Q, typename P, typename C, typename M>
+    requires role_for<P, Q> && role_for<C, Q> && std::is_invocable_v<M&, Q&>
+class InlineFramework
+{
+    static_assert(requires(Q& q) { q.close(); q.open(); },
+                  "Queue must be closable, so consumers without a stop token are stopped");
+
+public:
+    using queue_t = Q;
+
+    InlineFramework(P producer, std::size_t num_of_producers,
+                    C consumer, std::size_t num_of_consumers,
+                    M main_cycle):
+        m_queue(make_queue<queue_t>(num_of_consumers)),
+        m_producer{std::move(producer)},
+        m_consumer{std::move(consumer)},
+        m_main{std::move(main_cycle)},
+        m_num_of_producers{num_of_producers},
+        m_num_of_consumers{num_of_consumers}
+    {}
+
+    /// \brief Same as above, but queue is created with capacity \b queue_capacity.
+    InlineFramework(P producer, std::size_t num_of_producers,
+                    C consumer, std::size_t num_of_consumers,
+                    M main_cycle, std::size_t queue_capacity)
+        requires std::constructible_from<queue_t, std::size_t>:
+        m_queue(make_queue<queue_t>(num_of_consumers, queue_capacity)),
+        m_producer{std::move(producer)},
+        m_consumer{std::move(consumer)},
+        m_main{std::move(main_cycle)},
+        m_num_of_producers{num_of_producers},
+        m_num_of_consumers{num_of_consumers}
+    {}
+
+    InlineFramework(const InlineFramework&) = delete;
+    InlineFramework(InlineFramework&&) = delete;
+    InlineFramework& operator=(const InlineFramework&) = delete;
+    InlineFramework& operator=(InlineFramework&&) = delete;
+
+    ~InlineFramework()
+    {
+        stop();
+    }
+
+    /// \brief Start producers and consumers and run main cycle in the calling thread.
+    ///        Producers and consumers of a previous run are stopped first.
+    void run()
+    {
+        stop();
+        m_queue.open();
+        m_producers.reserve(m_num_of_producers);
+        for(std::size_t cntr {0}; cntr < m_num_of_producers; ++cntr)
+            m_producers.emplace_back([this](std::stop_token stop_token){ invoke(m_producer, stop_token); });
+        m_consumers.reserve(m_num_of_consumers);
+        for(std::size_t cntr {0}; cntr < m_num_of_consumers; ++cntr)
+            m_consumers.emplace_back([this](std::stop_token stop_token){ invoke(m_consumer, stop_token); });
+        m_main(m_queue);
+    }
+
+    /// \brief Wait until producers and consumers finish their work.
+    void join()
+    {
+        for(auto& producer:m_producers)
+            producer.join();
+        for(auto& consumer:m_consumers)
+            consumer.join();
+        m_producers.clear();
+        m_consumers.clear();
+    }
+
+    /// \brief Request stop of producers and wait until they are done,
+    ///        then request stop of consumers, close queue and wait until consumers are done.
+    /// \param policy With StopPolicy::abandon queue is cleared before consumers are stopped.
+    void stop(StopPolicy policy = StopPolicy::drain)
+    {
+        for(auto& producer:m_producers)
+            producer.request_stop();
+        m_producers.clear();
+        if(policy == StopPolicy::abandon)
+            m_queue.clear();
+        for(auto& consumer:m_consumers)
+            consumer.request_stop();
+        m_queue.close();
+        m_consumers.clear();
+    }
+
+private:
+    template<typename F>
+    void invoke(const F& f, std::stop_token stop_token)
+    {
+        try
+        {
+            if constexpr(std::is_invocable_v<const F&, std::stop_token, queue_t&>)
+                f(std::move(stop_token), m_queue);
+            else
+                f(m_queue);
+        }
+        catch(const threadsafe_containers::QueueClosed&)
+        {}
+    }
+
+    queue_t m_queue;
+    P m_producer;
+    C m_consumer;
+    M m_main;
+    std::size_t m_num_of_producers {1};
+    std::size_t m_num_of_consumers {1};
+    std::vector<std::jthread> m_producers;
+    std::vector<std::jthread> m_consumers;
 };
 
+/// \brief InlineFramework of queue \b Q with types of callables deduced.
+template<typename Q, typename P, typename C, typename M>
+[[nodiscard]] InlineFramework<Q, P, C, M> make_framework(P producer, std::size_t num_of_producers,
+                                                         C consumer, std::size_t num_of_consumers,
+                                                         M main_cycle)
+{
+    return {std::move(producer), num_of_producers, std::move(consumer), num_of_consumers, std::move(main_cycle)};
+}
+
+/// \brief Same as above, but queue is created with capacity \b queue_capacity.
+template<typename Q, typename P, typename C, typename M>
+[[nodiscard]] InlineFramework<Q, P, C, M> make_framework(P producer, std::size_t num_of_producers,
+                                                         C consumer, std::size_t num_of_consumers,
+                                                         M main_cycle, std::size_t queue_capacity)
+{
+    return {std::move(producer), num_of_producers, std::move(consumer), num_of_consumers, std::move(main_cycle), queue_capacity};
+}
+
 }
@@ -2,12 +2,24 @@
 
 #include <cstdlib>
 #include <memory>
+#include <optional>
 #include <deque>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <filesystem>
 #include <fstream>
+#include <algorithm>
+#include <iterator>
+#include <ranges>
+#include <stdexcept>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <stop_token>
+#include <coroutine>
+#include <type_traits>
+#include <utility>
 
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
@@ -17,21 +29,110 @@
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/serialization/access.hpp>
 #include <boost/serialization/deque.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/split_member.hpp>
+
+#include "WaitStrategy.hpp"
+#include "RingBuffer.hpp"
+#include "QueueStats.hpp"
+#include "Overflow.hpp"
+#include "QueueClosed.hpp"
+#include "JournalHook.hpp"
+#include "Coroutine.hpp"
 
 namespace threadsafe_containers
 {
 
 namespace fs = std::filesystem;
 
+/// \brief Copy of queue elements, see Queue::snapshot.
+///        Archive layout is the same as of Queue, so a saved snapshot is loaded as a queue.
+template<typename T> class QueueSnapshot
+{
+public:
+    QueueSnapshot(std::unique_ptr<RingBuffer<T>> elements, std::chrono::nanoseconds hold_time) noexcept:
+        m_elements{std::move(elements)},
+        m_hold_time{hold_time}
+    {}
+
+    [[nodiscard]] const RingBuffer<T>& elements() const noexcept
+    {
+        return *m_elements;
+    }
+
+    /// \return Time the queue lock was held to copy elements.
+    [[nodiscard]] std::chrono::nanoseconds hold_time() const noexcept
+    {
+        return m_hold_time;
+    }
+
+private:
+    friend class boost::serialization::access;
+    template<class Archive>
+    void save(Archive& ar, [[maybe_unused]] const unsigned int version) const
+    {
+        ar << boost::serialization::make_nvp("m_queue", *m_elements);
+    }
+
+    template<class Archive>
+    void load([[maybe_unused]] Archive& ar, [[maybe_unused]] const unsigned int version)
+    {
+        static_assert(!Archive::is_loading::value, "Snapshot is loaded as a queue");
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+    std::unique_ptr<RingBuffer<T>> m_elements;
+    std::chrono::nanoseconds m_hold_time;
+};
+
 /// \brief Simple threadsafe queue
-template<typename T, std::size_t SIZE = 2> class Queue
+/// \tparam SIZE Default capacity. Used if capacity isn't passed to constructor.
+/// \tparam WaitStrategy How blocking operations wait: BlockingWait, SpinThenParkWait or BusyPollWait.
+/// \tparam Storage Container of elements: RingBuffer, that allocates memory once, or std::deque.
+/// \tparam Stats Instrumentation: NoQueueStats (no cost) or QueueStats, see stats().
+/// \note  Producers are stopped when queue size reaches high watermark and resumed
+///        only when it falls down to low watermark. By default high watermark is equal to
+///        capacity and low watermark is one less, i.e. producers resume on any free slot.
+/// \note  Coroutines wait with co_await async_pop() / async_push(v): a waiting coroutine is
+///        a suspended frame instead of a blocked thread. It's resumed by a Scheduler with
+///        the element (the slot) handed over to it under the lock.
+/// \note  Saving copies elements under the lock and writes them without it (see snapshot).
+/// \note  Operations may be journaled for persistence (see set_journal).
+/// \note  wait_and_push follows overflow policy (see set_overflow), by default it blocks
+///        until there is space. push() and async_push() don't drop elements.
+/// \note  Waits on a closed queue don't block (see close).
+template<typename T, std::size_t SIZE = 2, typename WaitStrategy = BlockingWait,
+         template<typename...> class Storage = RingBuffer, typename Stats = NoQueueStats> class Queue
 {
+    static_assert(SIZE > 0, "Queue must have at least one slot");
+    static_assert(WaitStrategy::spin_limit > 0 || WaitStrategy::parks, "Wait strategy must either spin or park");
+
 public:
     using value_type = T;
     using pointer_type = std::unique_ptr<T>;
 
     Queue() = default;
 
+    /// \throws std::invalid_argument
+    explicit Queue(std::size_t capacity):
+        Queue{capacity, capacity, capacity - 1}
+    {}
+
+    /// \throws std::invalid_argument
+    Queue(std::size_t capacity, std::size_t high_watermark, std::size_t low_watermark):
+        m_capacity{capacity},
+        m_high_watermark{high_watermark},
+        m_low_watermark{low_watermark}
+    {
+        if(capacity == 0)
+            throw std::invalid_argument{"Capacity must be positive"};
+        if(high_watermark > capacity || high_watermark == 0)
+            throw std::invalid_argument{"High watermark must be in range (0, capacity]"};
+        if(low_watermark >= high_watermark)
+            throw std::invalid_argument{"Low watermark must be less than high watermark"};
+    }
+
     Queue(const Queue&) = delete;
     Queue(Queue&&) = delete;
     Queue& operator=(const Queue&) = delete;
@@ -39,28 +140,220 @@ public:
 
     ~Queue() = default;
 
+private:
+    /// \brief Coroutine suspended on queue. Linked into a list of waiters under the lock.
+    struct AsyncWaiter
+    {
+        /// \note The waiter may be destroyed as soon as it's scheduled.
+        void resume()
+        {
+            m_scheduler->schedule(m_handle);
+        }
+
+        std::coroutine_handle<> m_handle;
+        Scheduler* m_scheduler {nullptr};
+        AsyncWaiter* m_prev {nullptr};
+        AsyncWaiter* m_next {nullptr};
+        const void* m_list {nullptr};   ///< list the waiter is linked into
+    };
+
+    struct PopWaiter: AsyncWaiter
+    {
+        std::optional<T> m_value;
+    };
+
+    struct PushWaiter: AsyncWaiter
+    {
+        explicit PushWaiter(T v):
+            m_value{std::move(v)}
+        {}
+
+        T m_value;
+        bool m_pushed {false};
+    };
+
+    /// \brief Intrusive FIFO list of suspended coroutines.
+    template<typename Waiter>
+    class AsyncWaiters
+    {
+    public:
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return !m_head;
+        }
+
+        void push_back(Waiter& waiter) noexcept
+        {
+            waiter.m_prev = m_tail;
+            waiter.m_next = nullptr;
+            (m_tail ? m_tail->m_next : m_head) = &waiter;
+            m_tail = &waiter;
+            waiter.m_list = this;
+        }
+
+        [[nodiscard]] Waiter& pop_front() noexcept
+        {
+            auto& waiter {static_cast<Waiter&>(*m_head)};
+            static_cast<void>(erase(waiter));
+            return waiter;
+        }
+
+        /// \return False if \b waiter isn't in this list.
+        [[nodiscard]] bool erase(Waiter& waiter) noexcept
+        {
+            if(waiter.m_list != this)
+                return false;
+            (waiter.m_prev ? waiter.m_prev->m_next : m_head) = waiter.m_next;
+            (waiter.m_next ? waiter.m_next->m_prev : m_tail) = waiter.m_prev;
+            waiter.m_list = nullptr;
+            return true;
+        }
+
+        /// \brief  Unlink all waiters, so they aren't in any list. Waiters keep m_next links.
+        /// \return The first waiter.
+        [[nodiscard]] AsyncWaiter* detach() noexcept
+        {
+            for(auto* waiter {m_head}; waiter; waiter = waiter->m_next)
+                waiter->m_list = nullptr;
+            m_tail = nullptr;
+            return std::exchange(m_head, nullptr);
+        }
+
+    private:
+        AsyncWaiter* m_head {nullptr};
+        AsyncWaiter* m_tail {nullptr};
+    };
+
+    /// \brief Stop callback of a suspended coroutine.
+    template<typename Waiter>
+    struct Cancel
+    {
+        void operator()() const
+        {
+            m_queue->cancel(m_waiters, *m_waiter);
+        }
+
+        Queue* m_queue;
+        AsyncWaiters<Waiter>& m_waiters;
+        Waiter* m_waiter;
+    };
+
+public:
+    /// \brief Awaitable of async_pop.
+    /// \tparam Cancellable The wait is cancelled when stop is requested on a stop token.
+    template<bool Cancellable>
+    class PopAwaiter: PopWaiter
+    {
+    public:
+        PopAwaiter(Queue& queue, Scheduler* scheduler, std::stop_token stop_token) noexcept:
+            m_queue{queue},
+            m_stop_token{std::move(stop_token)}
+        {
+            this->m_scheduler = scheduler;
+        }
+
+        PopAwaiter(const PopAwaiter&) = delete;
+        PopAwaiter& operator=(const PopAwaiter&) = delete;
+
+        [[nodiscard]] bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        [[nodiscard]] bool await_suspend(std::coroutine_handle<> handle)
+        {
+            if constexpr(Cancellable)
+                m_on_stop.emplace(m_stop_token, Cancel<PopWaiter>{&m_queue, m_queue.m_async_consumers, this});
+            return m_queue.suspend(m_queue.m_async_consumers, static_cast<PopWaiter&>(*this), handle, m_stop_token,
+                                   [this]{ return m_queue.take_front(this->m_value); });
+        }
+
+        /// \return Dequeued value. If the wait is cancelled, std::nullopt.
+        [[nodiscard]] std::conditional_t<Cancellable, std::optional<T>, T> await_resume()
+        {
+            if constexpr(Cancellable)
+                return std::move(this->m_value);
+            else
+                return std::move(*this->m_value);
+        }
+
+    private:
+        Queue& m_queue;
+        std::stop_token m_stop_token;
+        std::optional<std::stop_callback<Cancel<PopWaiter>>> m_on_stop;
+    };
+
+    /// \brief Awaitable of async_push.
+    /// \tparam Cancellable The wait is cancelled when stop is requested on a stop token.
+    template<bool Cancellable>
+    class PushAwaiter: PushWaiter
+    {
+    public:
+        PushAwaiter(Queue& queue, T v, Scheduler* scheduler, std::stop_token stop_token):
+            PushWaiter{std::move(v)},
+            m_queue{queue},
+            m_stop_token{std::move(stop_token)}
+        {
+            this->m_scheduler = scheduler;
+        }
+
+        PushAwaiter(const PushAwaiter&) = delete;
+        PushAwaiter& operator=(const PushAwaiter&) = delete;
+
+        [[nodiscard]] bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        [[nodiscard]] bool await_suspend(std::coroutine_handle<> handle)
+        {
+            if constexpr(Cancellable)
+                m_on_stop.emplace(m_stop_token, Cancel<PushWaiter>{&m_queue, m_queue.m_async_producers, this});
+            return m_queue.suspend(m_queue.m_async_producers, static_cast<PushWaiter&>(*this), handle, m_stop_token,
+                                   [this]{ return this->m_pushed = m_queue.put_back(this->m_value); });
+        }
+
+        /// \return False if the wait is cancelled, the value isn't pushed then.
+        std::conditional_t<Cancellable, bool, void> await_resume() const noexcept
+        {
+            if constexpr(Cancellable)
+                return this->m_pushed;
+        }
+
+    private:
+        Queue& m_queue;
+        std::stop_token m_stop_token;
+        std::optional<std::stop_callback<Cancel<PushWaiter>>> m_on_stop;
+    };
+
+    /// \brief Wake one parked consumer per pushed element.
     void notify_on_not_empty()
     {
-        if(m_queue.size() == 1)
-//        if(m_queue.size())
-            m_on_not_empty.notify_all();
+        signal_not_empty(1);
+        serve_async_waiters();
     }
 
+    /// \brief Resume parked producers if queue fell down to low watermark.
+    ///        Wake no more producers than there are slots until high watermark.
     void notify_on_space_available()
     {
-        if(m_queue.size() == SIZE - 1)
-//        if(m_queue.size() < SIZE)
-            m_on_space_available.notify_all();
+        signal_space_available();
+        serve_async_waiters();
     }
 
     /// \brief  Push value into queue
     /// \return False if queue has no space left to push \b v, true otherwise.
     [[nodiscard]] bool push(T v)
     {
-        std::scoped_lock lk {m_mutex};
+        auto lk {lock()};
         if(full_nonblocking())
+        {
+            m_stats.on_failed_push();
             return false;
-        m_queue.emplace_back(std::move(v));
+        }
+        append(std::move(v));
+        m_stats.on_push(1, m_queue.size());
+        check_high_watermark();
         notify_on_not_empty();
         return true;
     }
@@ -70,11 +363,12 @@ public:
     ///         True otherwise, \b v contains dequeued value.
     [[nodiscard]] bool pop(T& v)
     {
-        std::scoped_lock lk {m_mutex};
+        auto lk {lock()};
         if(m_queue.empty())
             return false;
         v = std::move(m_queue.front());
-        m_queue.pop_front();
+        remove_front();
+        m_stats.on_pop(1);
         notify_on_space_available();
         return true;
     }
@@ -83,103 +377,318 @@ public:
     /// \return nullptr if queue is empty, dequeued value otherwise.
     [[nodiscard]] pointer_type pop()
     {
-        std::scoped_lock lk {m_mutex};
+        auto lk {lock()};
         if(m_queue.empty())
             return nullptr;
-        auto p {std::make_unique<T>(m_queue.front())};
-        m_queue.pop_front();
+        auto p {std::make_unique<T>(std::move(m_queue.front()))};
+        remove_front();
+        m_stats.on_pop(1);
         notify_on_space_available();
         return p;
     }
 
+    /// \brief  Dequeue element without allocation.
+    /// \return std::nullopt if queue is empty, dequeued value otherwise.
+    [[nodiscard]] std::optional<T> try_pop()
+    {
+        auto lk {lock()};
+        if(m_queue.empty())
+            return std::nullopt;
+        std::optional<T> v {std::move(m_queue.front())};
+        remove_front();
+        m_stats.on_pop(1);
+        notify_on_space_available();
+        return v;
+    }
+
     /// \brief Wait until queue is empty.
+    /// \throws QueueClosed If queue is closed while it's empty.
     void wait_until_empty()
     {
-        std::unique_lock lk {m_mutex};
-        while(m_queue.empty())
-            m_on_not_empty.wait(lk, [this]{ return !m_queue.empty(); });
+        auto lk {lock()};
+        wait_for_element(lk, m_parked_consumers.watchers, never);
+        if(m_queue.empty())
+            throw QueueClosed{};
     }
 
     /// \brief Wait until queue is full.
+    /// \throws QueueClosed If queue is closed while it's full.
     void wait_until_full()
     {
-        std::unique_lock lk {m_mutex};
-        while(full_nonblocking())
-            m_on_space_available.wait(lk, [this]{ return !full_nonblocking(); });
+        auto lk {lock()};
+        wait_for_space(lk, m_parked_producers.watchers, never);
+        if(full_nonblocking())
+            throw QueueClosed{};
     }
 
     /// \return True if queue is empty, false otherwise.
     [[nodiscard]] bool empty() const
     {
-        std::scoped_lock lk {m_mutex};
+        auto lk {lock()};
         return m_queue.empty();
     }
 
     /// \return True if queue is false, false otherwise.
     [[nodiscard]] bool full() const
     {
-        std::scoped_lock lk {m_mutex};
+        auto lk {lock()};
         return full_nonblocking();
     }
 
     /// \brief  Wait if queue is full, push \b v into queue.
+    ///         If overflow policy drops \b v, it's passed to the drop callback.
+    /// \throws QueueClosed If queue is closed while it's full.
     void wait_and_push(T v)
     {
-        std::unique_lock lk {m_mutex};
-        // condition_variable::wait atomically unlocks lk, blocks the current executing thread,
-        // and adds it to the list of threads waiting on *this. The thread will be unblocked
-        // when notify_all() or notify_all() is executed. It may also be unblocked spuriously.
-        // When unblocked, regardless of the reason, lock is reacquired and wait exits.
-        // Thus, deadlock is impossible.
-        // Overload with predicate may be used to ignore spurious awakenings.
-        while(full_nonblocking())
-            m_on_space_available.wait(lk, [this]{ return !full_nonblocking(); });
-//            m_on_space_available.wait(lk, [this]{ return m_queue.size() < SIZE; });
-        m_queue.emplace_back(std::move(v));
-        notify_on_not_empty();
+        static_cast<void>(push_or_drop(std::move(v), never));
+    }
+
+    /// \brief  Wait if queue is full, push \b v into queue.
+    ///         The wait is cancelled when stop is requested on \b stop_token.
+    /// \return False if stop is requested or queue is closed while it's full,
+    ///         or overflow policy drops \b v, true otherwise.
+    [[nodiscard]] bool wait_and_push(T v, std::stop_token stop_token)
+    {
+        const std::stop_callback on_stop {stop_token, [this]{ wake_all(); }};
+        auto stop_requested = [&stop_token]{ return stop_token.stop_requested(); };
+        return push_or_drop(std::move(v), stop_requested);
+    }
+
+    /// \brief Set what wait_and_push does when queue is full.
+    ///        Must be called before queue is used by producers.
+    /// \throws std::invalid_argument If sample_drop policy has no priority function.
+    void set_overflow(Overflow<T> overflow)
+    {
+        if(overflow.policy == OverflowPolicy::sample_drop && !overflow.priority)
+            throw std::invalid_argument{"Sample drop policy needs priority of elements"};
+        auto lk {lock()};
+        m_overflow = std::move(overflow);
     }
 
-    /// \brief Wait until queue is empty, dequeue element and place it's value into \b v.
+    /// \brief Copy elements under the lock, so they may be serialized without holding it,
+    ///        e.g. by a background thread (see serialization::Serializer::save_async).
+    ///        Memory of the copy is allocated before the lock is taken.
+    [[nodiscard]] QueueSnapshot<T> snapshot() const
+    {
+        auto elements {std::make_unique<RingBuffer<T>>(m_capacity)};
+        auto lk {lock()};
+        const auto start {clock::now()};
+        for(std::size_t cntr {0}; cntr < m_queue.size(); ++cntr)
+            elements->emplace_back(m_queue[cntr]);
+        return {std::move(elements), clock::now() - start};
+    }
+
+    /// \brief Journal pushes and pops into \b journal, nullptr stops journaling.
+    ///        Journal starts with a snapshot of queue elements, so replay it before.
+    ///        The journal must outlive the queue or be detached.
+    void set_journal(JournalHook<T>* journal)
+    {
+        auto lk {lock()};
+        m_journal = journal;
+        if(m_journal)
+            snapshot_journal();
+    }
+
+    /// \return Numbers of elements dropped by overflow policy.
+    [[nodiscard]] OverflowStats overflow_stats() const noexcept
+    {
+        OverflowStats stats;
+        stats.timed_out = m_drops.timed_out.load(std::memory_order_relaxed);
+        stats.rejected = m_drops.rejected.load(std::memory_order_relaxed);
+        stats.evicted = m_drops.evicted.load(std::memory_order_relaxed);
+        stats.sampled = m_drops.sampled.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    /// \brief  Wait until queue is empty, dequeue element and place it's value into \b v.
+    /// \throws QueueClosed If queue is closed while it's empty.
     void wait_and_pop(T& v)
     {
-        std::unique_lock lk {m_mutex};
-        while(m_queue.empty())
-            m_on_not_empty.wait(lk, [this]{ return !m_queue.empty(); });
+        auto lk {lock()};
+        const auto start {now()};
+        wait_for_element(lk, m_parked_consumers.takers, never);
+        m_stats.on_blocked_pop(since(start));
+        if(m_queue.empty())
+            throw QueueClosed{};
         v = std::move(m_queue.front());
-        m_queue.pop_front();
+        remove_front();
+        m_stats.on_pop(1);
         notify_on_space_available();
     }
 
-    /// \brief Wait until queue is empty, dequeue element and return it's value.
+    /// \brief  Wait until queue is empty, dequeue element and return it's value.
+    /// \throws QueueClosed If queue is closed while it's empty.
     [[nodiscard]] pointer_type wait_and_pop()
     {
-        std::unique_lock lk {m_mutex};
-        while(m_queue.empty())
-            m_on_not_empty.wait(lk, [this]{ return !m_queue.empty(); });
-        auto p {std::make_unique<T>(m_queue.front())};
-        m_queue.pop_front();
+        auto lk {lock()};
+        const auto start {now()};
+        wait_for_element(lk, m_parked_consumers.takers, never);
+        m_stats.on_blocked_pop(since(start));
+        if(m_queue.empty())
+            throw QueueClosed{};
+        auto p {std::make_unique<T>(std::move(m_queue.front()))};
+        remove_front();
+        m_stats.on_pop(1);
         notify_on_space_available();
         return p;
     }
 
+    /// \brief  Wait until queue is not empty or \b exit_condition is true,
+    ///         dequeue element and place it's value into \b v.
+    /// \return False if exit condition is met or queue is closed on empty queue, \b v keeps it's value.
+    /// \note   \b exit_condition may be called without the queue lock held while spinning.
+    template<typename P>
+    [[nodiscard]] bool wait_and_pop(T& v, P exit_condition)
+    {
+        auto lk {lock()};
+        const auto start {now()};
+        wait_for_element(lk, m_parked_consumers.takers, exit_condition);
+        m_stats.on_blocked_pop(since(start));
+        if(m_queue.empty())
+            return false;
+        v = std::move(m_queue.front());
+        remove_front();
+        m_stats.on_pop(1);
+        notify_on_space_available();
+        return true;
+    }
+
+    /// \brief  Wait until queue is not empty, dequeue element and place it's value into \b v.
+    ///         The wait is cancelled when stop is requested on \b stop_token,
+    ///         so elements left in queue are still dequeued after that.
+    /// \return False if stop is requested on empty queue, \b v keeps it's value.
+    [[nodiscard]] bool wait_and_pop(T& v, std::stop_token stop_token)
+    {
+        const std::stop_callback on_stop {stop_token, [this]{ wake_all(); }};
+        return wait_and_pop(v, [&stop_token]{ return stop_token.stop_requested(); });
+    }
+
+    /// \note \b exit_condition may be called without the queue lock held while spinning.
     template<typename P>
     [[nodiscard]] pointer_type wait_and_pop(P exit_condition)
     {
-        std::unique_lock lk {m_mutex};
-        //while(m_queue.empty())
-            m_on_not_empty.wait(lk, [this, &exit_condition]{ return !m_queue.empty() || exit_condition(); });
+        auto lk {lock()};
+        const auto start {now()};
+        wait_for_element(lk, m_parked_consumers.takers, exit_condition);
+        m_stats.on_blocked_pop(since(start));
         if(m_queue.empty())
             return nullptr;
-        auto p {std::make_unique<T>(m_queue.front())};
-        m_queue.pop_front();
+        auto p {std::make_unique<T>(std::move(m_queue.front()))};
+        remove_front();
+        m_stats.on_pop(1);
         notify_on_space_available();
         return p;
     }
 
+    /// \brief  co_await async_pop() returns the front element. The coroutine is suspended while
+    ///         queue is empty and is resumed by \b scheduler.
+    /// \throws std::logic_error When awaited with no scheduler, e.g. by a thread of no Scheduler.
+    [[nodiscard]] PopAwaiter<false> async_pop(Scheduler* scheduler = Scheduler::current()) noexcept
+    {
+        return {*this, scheduler, {}};
+    }
+
+    /// \brief  co_await async_pop(stop_token) returns the front element, or std::nullopt if stop
+    ///         is requested on \b stop_token on empty queue.
+    /// \throws std::logic_error When awaited with no scheduler.
+    [[nodiscard]] PopAwaiter<true> async_pop(std::stop_token stop_token, Scheduler* scheduler = Scheduler::current()) noexcept
+    {
+        return {*this, scheduler, std::move(stop_token)};
+    }
+
+    /// \brief  co_await async_push(v) pushes \b v. The coroutine is suspended while queue is full
+    ///         and is resumed by \b scheduler.
+    /// \throws std::logic_error When awaited with no scheduler.
+    [[nodiscard]] PushAwaiter<false> async_push(T v, Scheduler* scheduler = Scheduler::current())
+    {
+        return {*this, std::move(v), scheduler, {}};
+    }
+
+    /// \brief  co_await async_push(v, stop_token) pushes \b v and returns true,
+    ///         or returns false if stop is requested on \b stop_token while queue is full.
+    /// \throws std::logic_error When awaited with no scheduler.
+    [[nodiscard]] PushAwaiter<true> async_push(T v, std::stop_token stop_token, Scheduler* scheduler = Scheduler::current())
+    {
+        return {*this, std::move(v), scheduler, std::move(stop_token)};
+    }
+
+    /// \brief  Push as many elements of \b range as queue may keep, under one lock.
+    ///         Elements are moved if \b range is an rvalue container, that owns them.
+    ///         A view, e.g. std::ranges::subrange, refers to elements of another container,
+    ///         so they are copied (moved if the view yields rvalues, e.g. of std::move_iterator).
+    /// \return Number of pushed elements.
+    template<std::ranges::input_range R>
+    [[nodiscard]] std::size_t push_bulk(R&& range)
+    {
+        auto lk {lock()};
+        const auto prev_size {m_queue.size()};
+        auto it {std::ranges::begin(range)};
+        const auto end {std::ranges::end(range)};
+        for(; it != end && !full_nonblocking(); ++it)
+        {
+            if constexpr(std::is_lvalue_reference_v<R> || std::ranges::view<std::remove_cvref_t<R>>)
+                append(*it);
+            else
+                append(std::move(*it));
+            check_high_watermark();
+        }
+        if(m_queue.size() != prev_size)
+            m_stats.on_push(m_queue.size() - prev_size, m_queue.size());
+        notify_on_not_empty(prev_size);
+        return m_queue.size() - prev_size;
+    }
+
+    /// \brief  Dequeue up to \b max elements into \b out under one lock.
+    /// \return Number of dequeued elements.
+    template<std::output_iterator<T> OutputIt>
+    [[nodiscard]] std::size_t try_pop_bulk(OutputIt out, std::size_t max)
+    {
+        auto lk {lock()};
+        return pop_bulk_nonblocking(out, max);
+    }
+
+    /// \brief  Wait until queue is not empty or \b exit_condition is true,
+    ///         dequeue up to \b max elements into \b out.
+    /// \return Number of dequeued elements. Zero if exit condition is met or queue is closed on empty queue.
+    template<std::output_iterator<T> OutputIt, typename P>
+    [[nodiscard]] std::size_t wait_and_pop_bulk(OutputIt out, std::size_t max, P exit_condition)
+    {
+        auto lk {lock()};
+        const auto start {now()};
+        wait_for_element(lk, m_parked_consumers.takers, exit_condition);
+        m_stats.on_blocked_pop(since(start));
+        return pop_bulk_nonblocking(out, max);
+    }
+
+    /// \brief  Wait until queue is not empty or \b deadline passes,
+    ///         dequeue up to \b max elements into \b out.
+    /// \return Number of dequeued elements. Zero if deadline passes on empty queue.
+    template<std::output_iterator<T> OutputIt>
+    [[nodiscard]] std::size_t wait_and_pop_bulk_until(OutputIt out, std::size_t max, std::chrono::steady_clock::time_point deadline)
+    {
+        auto lk {lock()};
+        const auto start {now()};
+        wait_for_element(lk, m_parked_consumers.takers, never, deadline);
+        m_stats.on_blocked_pop(since(start));
+        return pop_bulk_nonblocking(out, max);
+    }
+
+    /// \brief  Dequeue all elements into \b out under one lock.
+    /// \return Number of dequeued elements.
+    template<std::output_iterator<T> OutputIt>
+    std::size_t drain(OutputIt out)
+    {
+        auto lk {lock()};
+        return pop_bulk_nonblocking(out, m_queue.size());
+    }
+
     void clear()
     {
-        std::scoped_lock lk {m_mutex};
+        auto lk {lock()};
+        if(m_journal)
+            m_journal->on_pop(m_queue.size());
         m_queue.clear();
+        notify_on_space_available();
     }
 
     [[nodiscard]] std::size_t size() const noexcept
@@ -189,7 +698,65 @@ public:
 
     [[nodiscard]] constexpr std::size_t max_size() const noexcept
     {
-        return SIZE;
+        return m_capacity;
+    }
+
+    [[nodiscard]] std::size_t high_watermark() const noexcept
+    {
+        return m_high_watermark;
+    }
+
+    [[nodiscard]] std::size_t low_watermark() const noexcept
+    {
+        return m_low_watermark;
+    }
+
+    /// \brief  Move elements of queue to NUMA \b node, if they are kept in RingBuffer.
+    ///         Queue object itself stays where it is, it may share pages with memory of it's owner.
+    /// \return False if it isn't supported or elements aren't moved (see RingBuffer::bind_to_numa_node).
+    bool bind_to_numa_node(unsigned node) const noexcept
+    {
+        if constexpr(std::is_same_v<queue_t, RingBuffer<T>>)
+            return m_queue.bind_to_numa_node(node);
+        else
+        {
+            static_cast<void>(node);
+            return false;
+        }
+    }
+
+    /// \brief Close queue for waiting: threads blocked on it are woken and waits don't block
+    ///        any more. A wait, that can't report failure (e.g. wait_and_pop(v)), throws QueueClosed,
+    ///        other waits return as if their exit condition is met. Elements left in queue are still
+    ///        dequeued and elements may still be pushed while there is space.
+    ///        Lets consumers, that don't take a stop token, be stopped once queue is drained.
+    /// \note  Coroutines suspended on queue are not affected, they are cancelled by stop tokens.
+    void close()
+    {
+        auto lk {lock()};
+        m_closed.store(true, std::memory_order_relaxed);
+        m_on_not_empty.notify_all();
+        m_on_space_available.notify_all();
+    }
+
+    /// \brief Let waits block again.
+    void open()
+    {
+        auto lk {lock()};
+        m_closed.store(false, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool closed() const noexcept
+    {
+        return m_closed.load(std::memory_order_relaxed);
+    }
+
+    /// \return Snapshot of counters. Cheap, doesn't take the queue lock,
+    ///         so it may be scraped periodically, e.g. from Framework main cycle.
+    [[nodiscard]] QueueStatsSnapshot stats() const noexcept
+        requires Stats::enabled
+    {
+        return m_stats.snapshot();
     }
 
     [[nodiscard]] friend bool operator==(const Queue& l, const Queue& r)
@@ -198,51 +765,503 @@ public:
     }
 
 private:
+    /// \brief Number of threads parked on a condition variable.
+    struct Parked
+    {
+        std::size_t takers {0};   ///< take an element (a slot) when woken
+        std::size_t watchers {0}; ///< only observe the state of queue
+    };
+
+    /// \brief Counters of OverflowStats. Written under the lock, atomic to be read without it.
+    struct Drops
+    {
+        std::atomic<std::uint64_t> timed_out {0};
+        std::atomic<std::uint64_t> rejected {0};
+        std::atomic<std::uint64_t> evicted {0};
+        std::atomic<std::uint64_t> sampled {0};
+    };
+
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto never = []{ return false; };
+
+    /// \brief Lock of the queue, that schedules coroutines handed an element (a slot) under it
+    ///        after it's released. Scheduler may block, e.g. on a full queue of a thread pool,
+    ///        whose workers may need this queue to make progress.
+    class Lock: public std::unique_lock<std::mutex>
+    {
+    public:
+        Lock(Queue& queue, std::unique_lock<std::mutex> lk) noexcept:
+            std::unique_lock<std::mutex>{std::move(lk)},
+            m_queue{&queue}
+        {}
+
+        Lock(Lock&& other) noexcept:
+            std::unique_lock<std::mutex>{std::move(other)},
+            m_queue{std::exchange(other.m_queue, nullptr)}
+        {}
+
+        Lock& operator=(Lock&&) = delete;
+
+        ~Lock()
+        {
+            if(!m_queue || !owns_lock() || m_queue->m_ready.empty())
+                return;
+            // waiters are detached under the lock, so a stop callback doesn't cancel a served one
+            auto* waiter {m_queue->m_ready.detach()};
+            unlock();
+            // a waiter may be destroyed as soon as it's scheduled, so the next one is taken before
+            while(waiter)
+                std::exchange(waiter, waiter->m_next)->resume();
+        }
+
+    private:
+        Queue* m_queue;
+    };
+
+    [[nodiscard]] Lock lock()
+    {
+        return {*this, std::as_const(*this).lock()};
+    }
+
+    /// \brief Lock the queue. With Stats enabled, time of contended acquisitions is counted.
+    [[nodiscard]] std::unique_lock<std::mutex> lock() const
+    {
+        if constexpr(Stats::enabled)
+        {
+            std::unique_lock lk {m_mutex, std::try_to_lock};
+            if(!lk.owns_lock())
+            {
+                const auto start {clock::now()};
+                lk.lock();
+                m_stats.on_lock_wait(since(start));
+            }
+            return lk;
+        }
+        else
+            return std::unique_lock{m_mutex};
+    }
+
+    /// \brief Current time if Stats is enabled, the clock isn't read otherwise.
+    [[nodiscard]] static clock::time_point now() noexcept
+    {
+        if constexpr(Stats::enabled)
+            return clock::now();
+        else
+            return {};
+    }
+
+    [[nodiscard]] static std::chrono::nanoseconds since(clock::time_point start) noexcept
+    {
+        if constexpr(Stats::enabled)
+            return clock::now() - start;
+        else
+            return {};
+    }
+
     [[nodiscard]] bool full_nonblocking() const noexcept
     {
-        return !(m_queue.size() < SIZE);
+        return m_throttled.load(std::memory_order_relaxed);
     }
 
+    /// \brief Dequeue element into \b v, if there is one. Must be called under the lock.
+    [[nodiscard]] bool take_front(std::optional<T>& v)
+    {
+        if(m_queue.empty())
+            return false;
+        v.emplace(std::move(m_queue.front()));
+        remove_front();
+        m_stats.on_pop(1);
+        notify_on_space_available();
+        return true;
+    }
 
-    friend class boost::serialization::access;
-    // When the class Archive corresponds to an output archive, the
-    // & operator is defined similar to <<.  Likewise, when the class Archive
-    // is a type of input archive the & operator is defined similar to >>.
-    template<class Archive>
-    void serialize(Archive& ar, [[maybe_unused]] const unsigned int version)
+    /// \brief Push \b v, if there is space left. Must be called under the lock.
+    [[nodiscard]] bool put_back(T& v)
+    {
+        if(full_nonblocking())
+            return false;
+        append(std::move(v));
+        m_stats.on_push(1, m_queue.size());
+        check_high_watermark();
+        notify_on_not_empty();
+        return true;
+    }
+
+    /// \brief Push \b v into storage and journal it. Must be called under the lock.
+    template<typename U>
+    void append(U&& v)
+    {
+        m_queue.emplace_back(std::forward<U>(v));
+        if(m_journal)
+        {
+            m_journal->on_push(m_queue.back());
+            compact_journal();
+        }
+    }
+
+    /// \brief Remove the front element from storage and journal it. Must be called under the lock.
+    void remove_front()
+    {
+        m_queue.pop_front();
+        if(m_journal)
+        {
+            m_journal->on_pop(1);
+            compact_journal();
+        }
+    }
+
+    void compact_journal()
+    {
+        if(m_journal->needs_compaction())
+            snapshot_journal();
+    }
+
+    /// \brief Pass queue elements to journal as a snapshot. Must be called under the lock.
+    void snapshot_journal()
+    {
+        m_journal->snapshot(m_queue.size(), [this](std::size_t pos) -> const T& { return m_queue[pos]; });
+    }
+
+    /// \brief Stop producers if queue reached high watermark.
+    void check_high_watermark() noexcept
+    {
+        if(!(m_queue.size() < m_high_watermark))
+            m_throttled.store(true, std::memory_order_relaxed);
+    }
+
+    /// \brief Wake consumers once per element pushed by a bulk operation.
+    void notify_on_not_empty(std::size_t prev_size)
+    {
+        signal_not_empty(m_queue.size() - prev_size);
+        serve_async_waiters();
+    }
+
+    void signal_not_empty(std::size_t pushed)
+    {
+        m_size.store(m_queue.size(), std::memory_order_relaxed);
+        wake(m_on_not_empty, m_parked_consumers, pushed);
+    }
+
+    void signal_space_available()
+    {
+        m_size.store(m_queue.size(), std::memory_order_relaxed);
+        if(full_nonblocking())
+        {
+            if(m_queue.size() > m_low_watermark)
+                return;
+            m_throttled.store(false, std::memory_order_relaxed);
+        }
+        else if(!m_parked_producers.takers)
+            return;
+        // producers woken before may finish without filling queue up to high watermark again,
+        // so the rest of parked producers are woken while there is space
+        wake(m_on_space_available, m_parked_producers, m_high_watermark - m_queue.size());
+    }
+
+    /// \brief Hand elements over to suspended consumers and slots to suspended producers,
+    ///        in FIFO order. They are scheduled when the lock is released (see Lock).
+    ///        Must be called under the lock.
+    void serve_async_waiters()
+    {
+        for(bool served {true}; served;)
+        {
+            served = false;
+            if(!m_async_consumers.empty() && !m_queue.empty())
+            {
+                while(!m_async_consumers.empty() && !m_queue.empty())
+                {
+                    auto& waiter {m_async_consumers.pop_front()};
+                    waiter.m_value.emplace(std::move(m_queue.front()));
+                    remove_front();
+                    m_stats.on_pop(1);
+                    m_ready.push_back(waiter);
+                }
+                signal_space_available();
+                served = true;
+            }
+            if(!m_async_producers.empty() && !full_nonblocking())
+            {
+                const auto prev_size {m_queue.size()};
+                while(!m_async_producers.empty() && !full_nonblocking())
+                {
+                    auto& waiter {m_async_producers.pop_front()};
+                    append(std::move(waiter.m_value));
+                    m_stats.on_push(1, m_queue.size());
+                    check_high_watermark();
+                    waiter.m_pushed = true;
+                    m_ready.push_back(waiter);
+                }
+                signal_not_empty(m_queue.size() - prev_size);
+                served = true;
+            }
+        }
+    }
+
+    /// \brief Suspend coroutine of \b waiter unless \b ready, that is called under the lock,
+    ///        takes an element (a slot) or stop is requested on \b stop_token.
+    /// \return True if the coroutine is suspended.
+    template<typename Waiter, typename Ready>
+    [[nodiscard]] bool suspend(AsyncWaiters<Waiter>& waiters, Waiter& waiter, std::coroutine_handle<> handle,
+                               const std::stop_token& stop_token, Ready ready)
+    {
+        if(!waiter.m_scheduler)
+            throw std::logic_error{"Coroutine awaiting queue must be run by a Scheduler"};
+        waiter.m_handle = handle;
+        auto lk {lock()};
+        if(ready() || stop_token.stop_requested())
+            return false;
+        waiters.push_back(waiter);
+        return true;
+    }
+
+    /// \brief Resume \b waiter with nothing taken, if it's still suspended.
+    template<typename Waiter>
+    void cancel(AsyncWaiters<Waiter>& waiters, Waiter& waiter)
+    {
+        auto lk {lock()};
+        if(waiters.erase(waiter))
+            m_ready.push_back(waiter);
+    }
+
+    /// \brief Wake up to \b n takers, and all watchers. Must be called under the lock.
+    static void wake(std::condition_variable& cv, const Parked& parked, std::size_t n)
+    {
+        if(parked.watchers || (parked.takers && n >= parked.takers))
+            cv.notify_all();
+        else
+        {
+            for(std::size_t cntr {0}; cntr < std::min(n, parked.takers); ++cntr)
+                cv.notify_one();
+        }
+    }
+
+    /// \brief Block until \b ready is true or \b deadline passes, time_point::max() is no deadline.
+    ///        \b lk is held on entry and on exit.
+    ///        Depending on WaitStrategy, spin on lock free \b hint before parking on \b cv.
+    ///        Parked threads are counted in \b parked, so notifiers wake only those.
+    template<typename Ready, typename Hint>
+    void wait_for_state(std::unique_lock<std::mutex>& lk, std::condition_variable& cv, std::size_t& parked,
+                        Ready ready, Hint hint, clock::time_point deadline = clock::time_point::max())
     {
-        std::scoped_lock lk {m_mutex};
+        const bool timed {deadline != clock::time_point::max()};
+        while(!ready())
+        {
+            if(timed && !(clock::now() < deadline))
+                return;
+            if constexpr(WaitStrategy::spin_limit > 0)
+            {
+                lk.unlock();
+                const bool hinted {spin<WaitStrategy>(hint)};
+                lk.lock();
+                if(hinted)
+                    continue;
+            }
+            if constexpr(WaitStrategy::parks)
+            {
+                // condition_variable::wait atomically unlocks lk, blocks the current executing thread,
+                // and adds it to the list of threads waiting on *this. The thread will be unblocked
+                // when notify_one() or notify_all() is executed. It may also be unblocked spuriously.
+                // When unblocked, regardless of the reason, lock is reacquired and wait exits.
+                // Thus, deadlock is impossible.
+                ++parked;
+                if(timed)
+                    cv.wait_until(lk, deadline);
+                else
+                    cv.wait(lk);
+                --parked;
+                if constexpr(Stats::enabled)
+                    m_stats.on_wakeup(ready());
+            }
+        }
+    }
 
-        constexpr bool is_text_or_bin_arc {
-            std::is_same_v<Archive, boost::archive::text_oarchive> ||
-            std::is_same_v<Archive, boost::archive::text_iarchive> ||
-            std::is_same_v<Archive, boost::archive::binary_oarchive> ||
-            std::is_same_v<Archive, boost::archive::binary_iarchive>
-        };
+    template<typename P>
+    void wait_for_element(std::unique_lock<std::mutex>& lk, std::size_t& parked, P& exit_condition,
+                          clock::time_point deadline = clock::time_point::max())
+    {
+        wait_for_state(lk, m_on_not_empty, parked,
+                       [this, &exit_condition]{ return !m_queue.empty() || exit_condition() || closed(); },
+                       [this, &exit_condition]{ return m_size.load(std::memory_order_relaxed) || exit_condition() || closed(); },
+                       deadline);
+    }
 
-        constexpr bool is_xml_arc {
-            std::is_same_v<Archive, boost::archive::xml_oarchive> ||
-            std::is_same_v<Archive, boost::archive::xml_iarchive>
-        };
+    template<typename P>
+    void wait_for_space(std::unique_lock<std::mutex>& lk, std::size_t& parked, P& exit_condition,
+                        clock::time_point deadline = clock::time_point::max())
+    {
+        wait_for_state(lk, m_on_space_available, parked,
+                       [this, &exit_condition]{ return !full_nonblocking() || exit_condition() || closed(); },
+                       [this, &exit_condition]{ return !full_nonblocking() || exit_condition() || closed(); },
+                       deadline);
+    }
 
-        if constexpr(is_text_or_bin_arc)
+    /// \brief Move \b v into \b dropped and count it. Must be called under the lock.
+    static void drop(std::optional<T>& dropped, T& v, std::atomic<std::uint64_t>& counter)
+    {
+        dropped.emplace(std::move(v));
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    /// \brief  Push \b v following overflow policy. A dropped element is passed to
+    ///         the drop callback after the lock is released.
+    /// \return False if \b v isn't pushed.
+    template<typename P>
+    [[nodiscard]] bool push_or_drop(T v, P& exit_condition)
+    {
+        std::optional<T> dropped;
+        bool pushed {false};
         {
-            ar & m_queue;
+            auto lk {lock()};
+            switch(m_overflow.policy)
+            {
+            case OverflowPolicy::block:
+            {
+                const auto start {now()};
+                if(m_overflow.timeout.count())
+                    wait_for_space(lk, m_parked_producers.takers, exit_condition, clock::now() + m_overflow.timeout);
+                else
+                    wait_for_space(lk, m_parked_producers.takers, exit_condition);
+                m_stats.on_blocked_push(since(start));
+                if(full_nonblocking() && exit_condition())
+                    return false;
+                if(full_nonblocking() && closed())
+                {
+                    if constexpr(std::is_same_v<std::remove_cv_t<P>, std::remove_cv_t<decltype(never)>>)
+                        throw QueueClosed{};
+                    else
+                        return false;
+                }
+                if(full_nonblocking())
+                    drop(dropped, v, m_drops.timed_out);
+                break;
+            }
+            case OverflowPolicy::reject_newest:
+                if(full_nonblocking())
+                    drop(dropped, v, m_drops.rejected);
+                break;
+            case OverflowPolicy::drop_oldest:
+                // the front element gives it's slot to v, so queue stays throttled
+                if(full_nonblocking())
+                {
+                    drop(dropped, m_queue.front(), m_drops.evicted);
+                    remove_front();
+                }
+                break;
+            case OverflowPolicy::sample_drop:
+                if(full_nonblocking())
+                    drop(dropped, v, m_drops.rejected);
+                else if(sampled_out(v))
+                    drop(dropped, v, m_drops.sampled);
+                break;
+            }
+            pushed = !dropped || m_overflow.policy == OverflowPolicy::drop_oldest;
+            if(pushed)
+            {
+                append(std::move(v));
+                m_stats.on_push(1, m_queue.size());
+                check_high_watermark();
+                notify_on_not_empty();
+            }
         }
-        else if constexpr(is_xml_arc)
+        if(dropped && m_overflow.on_drop)
+            m_overflow.on_drop(std::move(*dropped), m_overflow.policy);
+        return pushed;
+    }
+
+    /// \return True if sample_drop policy drops \b v. Must be called under the lock.
+    [[nodiscard]] bool sampled_out(const T& v)
+    {
+        const auto threshold {m_overflow.sample_threshold};
+        if(m_queue.size() < threshold || threshold >= m_high_watermark)
+            return false;
+        const auto fill {static_cast<double>(m_queue.size() - threshold + 1) / static_cast<double>(m_high_watermark - threshold + 1)};
+        const auto probability {fill / static_cast<double>(m_overflow.priority(v) + 1)};
+        return std::uniform_real_distribution<double>{0, 1}(m_random) < probability;
+    }
+
+    /// \brief Wake all parked threads, e.g. to let them check a stop request.
+    ///        The lock is taken, so a thread that is about to park doesn't miss the wakeup.
+    void wake_all()
+    {
+        auto lk {lock()};
+        m_on_not_empty.notify_all();
+        m_on_space_available.notify_all();
+    }
+
+    template<typename OutputIt>
+    std::size_t pop_bulk_nonblocking(OutputIt out, std::size_t max)
+    {
+        const auto n {std::min(max, m_queue.size())};
+        for(std::size_t cntr {0}; cntr < n; ++cntr, ++out)
         {
-            using boost::serialization::make_nvp;
-            //ar & make_nvp("queue", m_queue);
-            ar & BOOST_SERIALIZATION_NVP(m_queue);
+            *out = std::move(m_queue.front());
+            remove_front();
         }
+        m_stats.on_pop(n);
+        notify_on_space_available();
+        return n;
+    }
+
+
+    friend class boost::serialization::access;
+    // When the class Archive corresponds to an output archive, the
+    // << operator is used, otherwise >>. Saving doesn't hold the lock
+    // during I/O: elements are copied under it and the copy is written.
+    template<class Archive>
+    void save(Archive& ar, [[maybe_unused]] const unsigned int version) const
+    {
+        const auto copy {snapshot()};
+        ar << boost::serialization::make_nvp("m_queue", copy.elements());
+    }
+
+    template<class Archive>
+    void load(Archive& ar, [[maybe_unused]] const unsigned int version)
+    {
+        auto lk {lock()};
+        ar >> BOOST_SERIALIZATION_NVP(m_queue);
+        if(m_journal)
+            snapshot_journal();
+        m_throttled.store(false, std::memory_order_relaxed);
+        check_high_watermark();
+        notify_on_not_empty(0);
     }
 
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+
+    using queue_t = Storage<T>;
+
+    [[nodiscard]] static queue_t make_queue(std::size_t capacity)
+    {
+        if constexpr(std::is_constructible_v<queue_t, std::size_t> && !std::is_same_v<queue_t, std::deque<T>>)
+            return queue_t{capacity};
+        else
+            return queue_t{};
+    }
 
-    using queue_t = std::deque<T>;
-    queue_t m_queue;
+    std::size_t m_capacity {SIZE};
+    std::size_t m_high_watermark {SIZE};
+    std::size_t m_low_watermark {SIZE - 1};
+    /// \note Written under the lock, read without it by spinning threads.
+    std::atomic_bool m_throttled {false};
+    std::atomic_bool m_closed {false};
+    std::atomic<std::size_t> m_size {0};
+    queue_t m_queue {make_queue(m_capacity)};
     std::condition_variable m_on_not_empty;
     std::condition_variable m_on_space_available;
+    Parked m_parked_consumers;
+    Parked m_parked_producers;
+    AsyncWaiters<PopWaiter> m_async_consumers;
+    AsyncWaiters<PushWaiter> m_async_producers;
+    /// \note Waiters to schedule when the lock is released.
+    AsyncWaiters<AsyncWaiter> m_ready;
+    Overflow<T> m_overflow;
+    JournalHook<T>* m_journal {nullptr};
+    std::minstd_rand m_random;
+    Drops m_drops;
     mutable std::mutex m_mutex;
+    [[no_unique_address]] mutable Stats m_stats;
 };
 
 }
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdexcept>
+
+namespace threadsafe_containers
+{
+
+/// \brief Thrown by a wait, that would block forever on a closed queue (see Queue::close).
+struct QueueClosed: std::runtime_error
+{
+    QueueClosed():
+        std::runtime_error{"Queue is closed"}
+    {}
+};
+
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <atomic>
+#include <array>
+#include <bit>
+
+namespace threadsafe_containers
+{
+
+/// \brief Values of QueueStats counters at some moment.
+struct QueueStatsSnapshot
+{
+    std::uint64_t pushes {0};
+    std::uint64_t pops {0};
+    std::uint64_t failed_pushes {0};                ///< push returned false because queue is full
+    std::chrono::nanoseconds blocked_push_time {0}; ///< time wait_and_push waited for space
+    std::chrono::nanoseconds blocked_pop_time {0};  ///< time wait_and_pop waited for an element
+    std::uint64_t contended_locks {0};              ///< lock acquisitions that had to wait
+    std::chrono::nanoseconds lock_wait_time {0};
+    std::uint64_t max_depth {0};
+    double average_depth {0};                       ///< average size of queue right after a push
+    std::uint64_t wakeups {0};                      ///< returns from condition variable wait
+    std::uint64_t useful_wakeups {0};               ///< wakeups that found the awaited state
+};
+
+/// \brief Disables instrumentation of Queue. All the calls are no-op and Queue
+///        doesn't read the clock, so there is no cost.
+struct NoQueueStats
+{
+    static constexpr bool enabled {false};
+
+    void on_push([[maybe_unused]] std::uint64_t n, [[maybe_unused]] std::uint64_t depth) noexcept {}
+    void on_failed_push() noexcept {}
+    void on_pop([[maybe_unused]] std::uint64_t n) noexcept {}
+    void on_blocked_push([[maybe_unused]] std::chrono::nanoseconds time) noexcept {}
+    void on_blocked_pop([[maybe_unused]] std::chrono::nanoseconds time) noexcept {}
+    void on_lock_wait([[maybe_unused]] std::chrono::nanoseconds time) noexcept {}
+    void on_wakeup([[maybe_unused]] bool useful) noexcept {}
+};
+
+/// \brief Counters of Queue operations, contention and depth.
+/// \note  Counters are modified only under the queue lock, so they are updated with
+///        plain relaxed loads and stores instead of read-modify-write operations.
+///        They are atomic only to let snapshot() be taken without the lock.
+class QueueStats
+{
+public:
+    static constexpr bool enabled {true};
+
+    /// \param depth Size of queue after \b n elements are pushed. Each of them is counted
+    ///        with the size right after it's push, i.e. depth - n + 1, ..., depth.
+    void on_push(std::uint64_t n, std::uint64_t depth) noexcept
+    {
+        add(m_pushes, n);
+        add(m_depth_sum, n * depth - n * (n - 1) / 2);
+        if(depth > m_max_depth.load(std::memory_order_relaxed))
+            m_max_depth.store(depth, std::memory_order_relaxed);
+    }
+
+    void on_failed_push() noexcept
+    {
+        add(m_failed_pushes, 1);
+    }
+
+    void on_pop(std::uint64_t n) noexcept
+    {
+        add(m_pops, n);
+    }
+
+    void on_blocked_push(std::chrono::nanoseconds time) noexcept
+    {
+        add(m_blocked_push_ns, time.count());
+    }
+
+    void on_blocked_pop(std::chrono::nanoseconds time) noexcept
+    {
+        add(m_blocked_pop_ns, time.count());
+    }
+
+    void on_lock_wait(std::chrono::nanoseconds time) noexcept
+    {
+        add(m_contended_locks, 1);
+        add(m_lock_wait_ns, time.count());
+    }
+
+    void on_wakeup(bool useful) noexcept
+    {
+        add(m_wakeups, 1);
+        if(useful)
+            add(m_useful_wakeups, 1);
+    }
+
+    /// \note Counters are read one by one, so they may be slightly inconsistent
+    ///       with each other if queue is in use.
+    [[nodiscard]] QueueStatsSnapshot snapshot() const noexcept
+    {
+        QueueStatsSnapshot s;
+        s.pushes = get(m_pushes);
+        s.pops = get(m_pops);
+        s.failed_pushes = get(m_failed_pushes);
+        s.blocked_push_time = std::chrono::nanoseconds{get(m_blocked_push_ns)};
+        s.blocked_pop_time = std::chrono::nanoseconds{get(m_blocked_pop_ns)};
+        s.contended_locks = get(m_contended_locks);
+        s.lock_wait_time = std::chrono::nanoseconds{get(m_lock_wait_ns)};
+        s.max_depth = get(m_max_depth);
+        s.average_depth = s.pushes ? static_cast<double>(get(m_depth_sum)) / static_cast<double>(s.pushes): 0;
+        s.wakeups = get(m_wakeups);
+        s.useful_wakeups = get(m_useful_wakeups);
+        return s;
+    }
+
+private:
+    using counter_t = std::atomic<std::uint64_t>;
+
+    static void add(counter_t& counter, std::uint64_t n) noexcept
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] static std::uint64_t get(const counter_t& counter) noexcept
+    {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+    counter_t m_pushes {0};
+    counter_t m_pops {0};
+    counter_t m_failed_pushes {0};
+    counter_t m_blocked_push_ns {0};
+    counter_t m_blocked_pop_ns {0};
+    counter_t m_contended_locks {0};
+    counter_t m_lock_wait_ns {0};
+    counter_t m_max_depth {0};
+    counter_t m_depth_sum {0};
+    counter_t m_wakeups {0};
+    counter_t m_useful_wakeups {0};
+};
+
+/// \brief Histogram with power of two buckets: bucket 0 counts zeros, bucket i counts
+///        values in [2^(i-1), 2^i). Safe to add to from many threads.
+class Histogram
+{
+public:
+    static constexpr std::size_t num_of_buckets {65};
+    using buckets_t = std::array<std::uint64_t, num_of_buckets>;
+
+    void add(std::uint64_t value) noexcept
+    {
+        m_buckets[std::bit_width(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] buckets_t snapshot() const noexcept
+    {
+        buckets_t buckets {};
+        for(std::size_t cntr {0}; cntr < num_of_buckets; ++cntr)
+            buckets[cntr] = m_buckets[cntr].load(std::memory_order_relaxed);
+        return buckets;
+    }
+
+    /// \return Lower bound of values counted in bucket \b i.
+    [[nodiscard]] static constexpr std::uint64_t lower_bound(std::size_t i) noexcept
+    {
+        return i ? std::uint64_t{1} << (i - 1) : 0;
+    }
+
+private:
+    std::array<std::atomic<std::uint64_t>, num_of_buckets> m_buckets {};
+};
+
+}
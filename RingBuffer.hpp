@@ -0,0 +1,254 @@
+#pragma once
+
+#include <cstdlib>
+#include <new>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <deque>
+#include <span>
+
+#include <boost/mpl/int.hpp>
+#include <boost/mpl/integral_c_tag.hpp>
+
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/collection_size_type.hpp>
+#include <boost/serialization/item_version_type.hpp>
+#include <boost/serialization/library_version_type.hpp>
+#include <boost/serialization/detail/stack_constructor.hpp>
+#include <boost/serialization/version.hpp>
+#include <boost/serialization/level.hpp>
+#include <boost/serialization/deque.hpp>
+
+#include "Platform.hpp"
+
+namespace threadsafe_containers
+{
+
+/// \brief Fixed capacity FIFO in one contiguous, cache line aligned block of memory.
+///        The block is allocated in constructor, there are no allocations afterwards.
+///        A block of a page or more takes whole pages, so it may be moved to a NUMA node
+///        without memory of others (see bind_to_numa_node).
+///        Not threadsafe, used as a storage of Queue.
+/// \note  Archive layout is the same as of std::deque, so they may be loaded one from another.
+template<typename T> class RingBuffer
+{
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+
+    explicit RingBuffer(std::size_t capacity):
+        m_capacity{capacity},
+        m_data{static_cast<T*>(::operator new(block_size(capacity), std::align_val_t{block_alignment(capacity)}))}
+    {}
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer(RingBuffer&&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+    RingBuffer& operator=(RingBuffer&&) = delete;
+
+    ~RingBuffer()
+    {
+        clear();
+        ::operator delete(m_data, std::align_val_t{block_alignment(m_capacity)});
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return m_size == 0;
+    }
+
+    [[nodiscard]] std::size_t capacity() const noexcept
+    {
+        return m_capacity;
+    }
+
+    /// \throws std::length_error if buffer is full
+    template<typename... Args> T& emplace_back(Args&&... args)
+    {
+        if(!(m_size < m_capacity))
+            throw std::length_error{"Ring buffer is full"};
+        auto* p {::new(static_cast<void*>(m_data + index(m_size))) T(std::forward<Args>(args)...)};
+        ++m_size;
+        return *p;
+    }
+
+    [[nodiscard]] T& front() noexcept
+    {
+        return m_data[m_head];
+    }
+
+    [[nodiscard]] const T& front() const noexcept
+    {
+        return m_data[m_head];
+    }
+
+    void pop_front() noexcept
+    {
+        m_data[m_head].~T();
+        m_head = index(1);
+        --m_size;
+    }
+
+    [[nodiscard]] T& back() noexcept
+    {
+        return m_data[index(m_size - 1)];
+    }
+
+    [[nodiscard]] const T& back() const noexcept
+    {
+        return m_data[index(m_size - 1)];
+    }
+
+    void pop_back() noexcept
+    {
+        back().~T();
+        --m_size;
+    }
+
+    void clear() noexcept
+    {
+        while(!empty())
+            pop_front();
+        m_head = 0;
+    }
+
+    /// \return Start of the memory block of elements, capacity() * sizeof(T) bytes.
+    [[nodiscard]] const void* data() const noexcept
+    {
+        return m_data;
+    }
+
+    /// \brief  Move the memory block of elements to NUMA \b node.
+    /// \return False if it isn't supported or the block is smaller than a page,
+    ///         so it shares it's page with other memory.
+    bool bind_to_numa_node(unsigned node) const noexcept
+    {
+        return bind_memory_to_node(m_data, block_size(m_capacity), node);
+    }
+
+    /// \return Elements in FIFO order as two contiguous parts.
+    ///         The second part is empty unless elements wrap around the end of the block.
+    [[nodiscard]] std::pair<std::span<const T>, std::span<const T>> segments() const noexcept
+    {
+        const auto first {std::min(m_size, m_capacity - m_head)};
+        return {{m_data + m_head, first}, {m_data, m_size - first}};
+    }
+
+    /// \return Element at \b pos counting from front.
+    [[nodiscard]] const T& operator[](std::size_t pos) const noexcept
+    {
+        return m_data[index(pos)];
+    }
+
+    [[nodiscard]] friend bool operator==(const RingBuffer& l, const RingBuffer& r)
+    {
+        if(l.size() != r.size())
+            return false;
+        for(std::size_t cntr {0}; cntr < l.size(); ++cntr)
+        {
+            if(!(l[cntr] == r[cntr]))
+                return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr std::size_t alignment {std::max(cache_line_size, alignof(T))};
+
+    [[nodiscard]] static bool takes_whole_pages(std::size_t capacity) noexcept
+    {
+        return std::max<std::size_t>(capacity, 1) * sizeof(T) >= page_size();
+    }
+
+    [[nodiscard]] static std::size_t block_alignment(std::size_t capacity) noexcept
+    {
+        return takes_whole_pages(capacity) ? std::max(page_size(), alignment) : alignment;
+    }
+
+    /// \return Size of the block of elements, rounded up to whole pages if it takes a page or more.
+    [[nodiscard]] static std::size_t block_size(std::size_t capacity) noexcept
+    {
+        const auto size {std::max<std::size_t>(capacity, 1) * sizeof(T)};
+        if(!takes_whole_pages(capacity))
+            return size;
+        return (size + page_size() - 1) / page_size() * page_size();
+    }
+
+    /// \brief Index of the slot \b pos positions after head.
+    [[nodiscard]] std::size_t index(std::size_t pos) const noexcept
+    {
+        const auto i {m_head + pos};
+        return i < m_capacity ? i: i - m_capacity;
+    }
+
+
+    friend class boost::serialization::access;
+    // Same layout as boost::serialization writes for std::deque:
+    // count, item version, items.
+    template<class Archive>
+    void save(Archive& ar, [[maybe_unused]] const unsigned int version) const
+    {
+        using namespace boost::serialization;
+        const collection_size_type count(m_size);
+        ar << BOOST_SERIALIZATION_NVP(count);
+        const item_version_type item_version(boost::serialization::version<T>::value);
+        ar << BOOST_SERIALIZATION_NVP(item_version);
+        for(std::size_t cntr {0}; cntr < m_size; ++cntr)
+            ar << make_nvp("item", (*this)[cntr]);
+    }
+
+    /// \throws std::length_error if archive holds more elements than buffer may keep
+    template<class Archive>
+    void load(Archive& ar, [[maybe_unused]] const unsigned int version)
+    {
+        using namespace boost::serialization;
+        collection_size_type count;
+        ar >> BOOST_SERIALIZATION_NVP(count);
+        item_version_type item_version(0);
+        if(library_version_type(3) < ar.get_library_version())
+            ar >> BOOST_SERIALIZATION_NVP(item_version);
+        if(count > m_capacity)
+            throw std::length_error{"Archive holds more elements than ring buffer may keep"};
+        clear();
+        for(std::size_t cntr {0}; cntr < count; ++cntr)
+        {
+            detail::stack_construct<Archive, T> u(ar, item_version);
+            ar >> make_nvp("item", u.reference());
+            auto& el {emplace_back(std::move(u.reference()))};
+            ar.reset_object_address(&el, u.address());
+        }
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+
+    const std::size_t m_capacity;
+    T* const m_data;
+    std::size_t m_head {0};
+    std::size_t m_size {0};
+};
+
+}
+
+namespace boost::serialization
+{
+
+/// \brief Write class information for RingBuffer<T> iff it is written for std::deque<T>.
+template<typename T>
+struct implementation_level_impl<const threadsafe_containers::RingBuffer<T>>
+{
+    typedef mpl::integral_c_tag tag;
+    typedef mpl::int_<implementation_level<std::deque<T>>::value> type;
+    BOOST_STATIC_CONSTANT(int, value = type::value);
+};
+
+}
@@ -0,0 +1,538 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <stop_token>
+
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/deque.hpp>
+
+#include "Platform.hpp"
+#include "WaitStrategy.hpp"
+#include "RingBuffer.hpp"
+#include "QueueClosed.hpp"
+
+namespace threadsafe_containers
+{
+
+/// \brief Work-stealing queue with a shard (local deque) per consumer.
+///        Producers distribute elements round-robin (push) or by key (push_keyed).
+///        A consumer thread is bound to a shard on it's first pop and takes elements
+///        from the front of it's shard. If it's shard is empty, it steals from the back
+///        of the neighbour shards. Has the same public API as Queue.
+/// \tparam SIZE Default capacity of a shard.
+/// \note  Elements of one shard leave it in FIFO order unless they are stolen.
+///        There is no FIFO order between shards.
+/// \note  Waits on a closed queue don't block (see close).
+template<typename T, std::size_t SIZE = 2> class ShardedQueue
+{
+public:
+    using value_type = T;
+    using pointer_type = std::unique_ptr<T>;
+
+    /// \brief Lets producer_consumer::Framework create a shard per consumer.
+    static constexpr bool is_sharded {true};
+
+    /// \brief A shard per hardware thread.
+    ShardedQueue():
+        ShardedQueue{std::max<std::size_t>(std::thread::hardware_concurrency(), 1)}
+    {}
+
+    /// \throws std::invalid_argument
+    explicit ShardedQueue(std::size_t num_of_shards, std::size_t shard_capacity = SIZE)
+    {
+        if(num_of_shards == 0)
+            throw std::invalid_argument{"Number of shards must be positive"};
+        if(shard_capacity == 0)
+            throw std::invalid_argument{"Capacity must be positive"};
+        m_shards.reserve(num_of_shards);
+        for(std::size_t cntr {0}; cntr < num_of_shards; ++cntr)
+            m_shards.emplace_back(std::make_unique<Shard>(shard_capacity));
+    }
+
+    ShardedQueue(const ShardedQueue&) = delete;
+    ShardedQueue(ShardedQueue&&) = delete;
+    ShardedQueue& operator=(const ShardedQueue&) = delete;
+    ShardedQueue& operator=(ShardedQueue&&) = delete;
+
+    ~ShardedQueue() = default;
+
+    /// \brief  Push value into the next shard of the calling producer (round-robin).
+    ///         If the shard is full, other shards are tried.
+    /// \return False if queue has no space left to push \b v, true otherwise.
+    [[nodiscard]] bool push(T v)
+    {
+        if(!enqueue(v))
+            return false;
+        m_not_empty.notify_all();
+        return true;
+    }
+
+    /// \brief  Push value into the shard of \b key, so elements of one key are
+    ///         handled by one consumer unless they are stolen.
+    /// \return False if the shard has no space left to push \b v, true otherwise.
+    [[nodiscard]] bool push_keyed(std::size_t key, T v)
+    {
+        if(!shard_of(key).push(v))
+            return false;
+        m_not_empty.notify_all();
+        return true;
+    }
+
+    /// \brief  Push value into the shard of the calling consumer, e.g. a worker
+    ///         scheduling a follow-up task for itself. If the shard is full,
+    ///         other shards are tried.
+    /// \return False if queue has no space left to push \b v, true otherwise.
+    /// \note   Binds the calling thread to a shard, as pop does.
+    [[nodiscard]] bool push_local(T v)
+    {
+        const auto own {consumer_shard()};
+        for(std::size_t cntr {0}; cntr < m_shards.size(); ++cntr)
+        {
+            if(shard_of(own + cntr).push(v))
+            {
+                m_not_empty.notify_all();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// \brief  Dequeue element and place it's value into \b v.
+    /// \return False if queue is empty, \b v keeps it's value.
+    ///         True otherwise, \b v contains dequeued value.
+    [[nodiscard]] bool pop(T& v)
+    {
+        if(!dequeue(v))
+            return false;
+        m_space_available.notify_all();
+        return true;
+    }
+
+    /// \brief  Dequeue element and return it's value.
+    /// \return nullptr if queue is empty, dequeued value otherwise.
+    [[nodiscard]] pointer_type pop()
+    {
+        pointer_type p;
+        if(!dequeue(p))
+            return nullptr;
+        m_space_available.notify_all();
+        return p;
+    }
+
+    /// \brief  Dequeue element without allocation.
+    /// \return std::nullopt if queue is empty, dequeued value otherwise.
+    [[nodiscard]] std::optional<T> try_pop()
+    {
+        std::optional<T> v;
+        if(!dequeue(v))
+            return std::nullopt;
+        m_space_available.notify_all();
+        return v;
+    }
+
+    /// \brief Wait until queue is empty.
+    /// \throws QueueClosed If queue is closed while it's empty.
+    void wait_until_empty()
+    {
+        m_not_empty.wait_until([this]{ return !empty() || closed(); });
+        if(empty())
+            throw QueueClosed{};
+    }
+
+    /// \brief Wait until queue is full.
+    /// \throws QueueClosed If queue is closed while it's full.
+    void wait_until_full()
+    {
+        m_space_available.wait_until([this]{ return !full() || closed(); });
+        if(full())
+            throw QueueClosed{};
+    }
+
+    /// \return True if queue is empty, false otherwise.
+    [[nodiscard]] bool empty() const
+    {
+        return size() == 0;
+    }
+
+    /// \return True if queue is false, false otherwise.
+    [[nodiscard]] bool full() const
+    {
+        return size() >= max_size();
+    }
+
+    /// \brief  Wait if queue is full, push \b v into queue.
+    /// \throws QueueClosed If queue is closed while it's full.
+    void wait_and_push(T v)
+    {
+        bool pushed {false};
+        m_space_available.wait_until([this, &v, &pushed]{ return (pushed = enqueue(v)) || closed(); });
+        if(!pushed)
+            throw QueueClosed{};
+        m_not_empty.notify_all();
+    }
+
+    /// \brief  Wait if the shard of \b key is full, push \b v into it.
+    /// \throws QueueClosed If queue is closed while the shard is full.
+    void wait_and_push_keyed(std::size_t key, T v)
+    {
+        auto& shard {shard_of(key)};
+        bool pushed {false};
+        m_space_available.wait_until([this, &shard, &v, &pushed]{ return (pushed = shard.push(v)) || closed(); });
+        if(!pushed)
+            throw QueueClosed{};
+        m_not_empty.notify_all();
+    }
+
+    /// \brief  Wait until queue is empty, dequeue element and place it's value into \b v.
+    /// \throws QueueClosed If queue is closed while it's empty.
+    void wait_and_pop(T& v)
+    {
+        bool popped {false};
+        m_not_empty.wait_until([this, &v, &popped]{ return (popped = dequeue(v)) || closed(); });
+        if(!popped)
+            throw QueueClosed{};
+        m_space_available.notify_all();
+    }
+
+    /// \brief  Wait until queue is empty, dequeue element and return it's value.
+    /// \throws QueueClosed If queue is closed while it's empty.
+    [[nodiscard]] pointer_type wait_and_pop()
+    {
+        pointer_type p;
+        m_not_empty.wait_until([this, &p]{ return dequeue(p) || closed(); });
+        if(!p)
+            throw QueueClosed{};
+        m_space_available.notify_all();
+        return p;
+    }
+
+    /// \brief  Wait until queue is not empty or \b exit_condition is true,
+    ///         dequeue element and place it's value into \b v.
+    /// \return False if exit condition is met or queue is closed on empty queue, \b v keeps it's value.
+    template<typename P>
+    [[nodiscard]] bool wait_and_pop(T& v, P exit_condition)
+    {
+        bool popped {false};
+        m_not_empty.wait_until([this, &v, &popped, &exit_condition]{ return (popped = dequeue(v)) || exit_condition() || closed(); });
+        if(!popped)
+            return false;
+        m_space_available.notify_all();
+        return true;
+    }
+
+    /// \brief  Wait if queue is full, push \b v into queue.
+    ///         The wait is cancelled when stop is requested on \b stop_token.
+    /// \return False if stop is requested or queue is closed while it's full, true otherwise.
+    [[nodiscard]] bool wait_and_push(T v, std::stop_token stop_token)
+    {
+        const std::stop_callback on_stop {stop_token, [this]{ m_space_available.notify_all(); }};
+        bool pushed {false};
+        m_space_available.wait_until([this, &v, &pushed, &stop_token]{ return (pushed = enqueue(v)) || stop_token.stop_requested() || closed(); });
+        if(!pushed)
+            return false;
+        m_not_empty.notify_all();
+        return true;
+    }
+
+    /// \brief  Wait until queue is not empty, dequeue element and place it's value into \b v.
+    ///         The wait is cancelled when stop is requested on \b stop_token,
+    ///         so elements left in queue are still dequeued after that.
+    /// \return False if stop is requested on empty queue, \b v keeps it's value.
+    [[nodiscard]] bool wait_and_pop(T& v, std::stop_token stop_token)
+    {
+        const std::stop_callback on_stop {stop_token, [this]{ m_not_empty.notify_all(); }};
+        return wait_and_pop(v, [&stop_token]{ return stop_token.stop_requested(); });
+    }
+
+    template<typename P>
+    [[nodiscard]] pointer_type wait_and_pop(P exit_condition)
+    {
+        pointer_type p;
+        m_not_empty.wait_until([this, &p, &exit_condition]{ return dequeue(p) || exit_condition() || closed(); });
+        if(!p)
+            return nullptr;
+        m_space_available.notify_all();
+        return p;
+    }
+
+    void clear()
+    {
+        for(auto& shard:m_shards)
+            shard->clear();
+        m_space_available.notify_all();
+    }
+
+    /// \return Sum of sizes of all shards.
+    /// \note   The value is exact only if there are no concurrent operations.
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        std::size_t size {0};
+        for(const auto& shard:m_shards)
+            size += shard->size();
+        return size;
+    }
+
+    [[nodiscard]] std::size_t max_size() const noexcept
+    {
+        return m_shards.size() * m_shards.front()->capacity();
+    }
+
+    [[nodiscard]] std::size_t num_of_shards() const noexcept
+    {
+        return m_shards.size();
+    }
+
+    /// \return Size of shard \b index.
+    [[nodiscard]] std::size_t shard_size(std::size_t index) const noexcept
+    {
+        return m_shards[index]->size();
+    }
+
+    /// \brief Close queue for waiting: threads blocked on it are woken and waits don't block
+    ///        any more (see Queue::close). Elements left in queue are still dequeued.
+    void close()
+    {
+        m_closed.store(true, std::memory_order_relaxed);
+        m_not_empty.notify_all();
+        m_space_available.notify_all();
+    }
+
+    /// \brief Let waits block again.
+    void open() noexcept
+    {
+        m_closed.store(false, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool closed() const noexcept
+    {
+        return m_closed.load(std::memory_order_relaxed);
+    }
+
+    /// \note Must not be called concurrently with operations which modify queue.
+    [[nodiscard]] friend bool operator==(const ShardedQueue& l, const ShardedQueue& r)
+    {
+        return l.contents() == r.contents();
+    }
+
+private:
+    template<typename Out> static void assign(Out& out, T& v)
+    {
+        if constexpr(std::is_same_v<Out, pointer_type>)
+            out = std::make_unique<T>(std::move(v));
+        else
+            out = std::move(v);
+    }
+
+    /// \brief Local deque of a consumer. Producers push to the back, the owner pops
+    ///        from the front and thieves steal from the back.
+    /// \note  Producers are not the owners of a shard, so a lock free single-owner
+    ///        deque doesn't apply. A lock per shard is contended only by it's owner,
+    ///        the producers which picked it and occasional thieves.
+    class alignas(cache_line_size) Shard
+    {
+    public:
+        explicit Shard(std::size_t capacity):
+            m_buffer{capacity}
+        {}
+
+        [[nodiscard]] bool push(T& v)
+        {
+            std::scoped_lock lk {m_mutex};
+            if(!(m_buffer.size() < m_buffer.capacity()))
+                return false;
+            m_buffer.emplace_back(std::move(v));
+            m_size.store(m_buffer.size(), std::memory_order_relaxed);
+            return true;
+        }
+
+        template<typename Out> [[nodiscard]] bool pop_front(Out& out)
+        {
+            if(!size())
+                return false;
+            std::scoped_lock lk {m_mutex};
+            if(m_buffer.empty())
+                return false;
+            assign(out, m_buffer.front());
+            m_buffer.pop_front();
+            m_size.store(m_buffer.size(), std::memory_order_relaxed);
+            return true;
+        }
+
+        template<typename Out> [[nodiscard]] bool steal(Out& out)
+        {
+            if(!size())
+                return false;
+            std::scoped_lock lk {m_mutex};
+            if(m_buffer.empty())
+                return false;
+            assign(out, m_buffer.back());
+            m_buffer.pop_back();
+            m_size.store(m_buffer.size(), std::memory_order_relaxed);
+            return true;
+        }
+
+        void clear()
+        {
+            std::scoped_lock lk {m_mutex};
+            m_buffer.clear();
+            m_size.store(0, std::memory_order_relaxed);
+        }
+
+        /// \brief Append elements of shard to \b q.
+        void copy_to(std::deque<T>& q) const
+        {
+            std::scoped_lock lk {m_mutex};
+            for(std::size_t cntr {0}; cntr < m_buffer.size(); ++cntr)
+                q.push_back(m_buffer[cntr]);
+        }
+
+        /// \brief Lock free size, lets consumers skip empty shards without locking them.
+        [[nodiscard]] std::size_t size() const noexcept
+        {
+            return m_size.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] std::size_t capacity() const noexcept
+        {
+            return m_buffer.capacity();
+        }
+
+    private:
+        mutable std::mutex m_mutex;
+        RingBuffer<T> m_buffer;
+        std::atomic<std::size_t> m_size {0};
+    };
+
+    [[nodiscard]] Shard& shard_of(std::size_t key) noexcept
+    {
+        return *m_shards[key % m_shards.size()];
+    }
+
+    /// \brief Round-robin over shards. The counter is per producer thread,
+    ///        so producers don't contend on it.
+    [[nodiscard]] std::size_t next_shard() noexcept
+    {
+        thread_local std::size_t counter {std::hash<std::thread::id>{}(std::this_thread::get_id())};
+        return counter++ % m_shards.size();
+    }
+
+    /// \brief Shard of the calling consumer. A thread is bound to a shard of each queue on it's first pop.
+    /// \note  A thread keeps bindings to the last few queues it used, so a thread, that alternates
+    ///        between queues, e.g. a pipeline stage, keeps it's shard in each of them.
+    [[nodiscard]] std::size_t consumer_shard()
+    {
+        struct Binding
+        {
+            std::uint64_t queue_id {0};
+            std::size_t shard {0};
+        };
+        static constexpr std::size_t max_bindings {16};
+        thread_local std::vector<Binding> bindings;
+        const auto it {std::ranges::find(bindings, m_id, &Binding::queue_id)};
+        if(it != bindings.end())
+            return it->shard;
+        // ids of destroyed queues are never reused, so the oldest binding is forgotten
+        if(bindings.size() == max_bindings)
+            bindings.erase(bindings.begin());
+        bindings.push_back({m_id, m_next_consumer.fetch_add(1, std::memory_order_relaxed) % m_shards.size()});
+        return bindings.back().shard;
+    }
+
+    [[nodiscard]] static std::uint64_t make_id() noexcept
+    {
+        static std::atomic<std::uint64_t> last_id {0};
+        return ++last_id;
+    }
+
+    /// \brief \b v is left untouched if queue is full.
+    [[nodiscard]] bool enqueue(T& v)
+    {
+        const auto first {next_shard()};
+        for(std::size_t cntr {0}; cntr < m_shards.size(); ++cntr)
+        {
+            if(shard_of(first + cntr).push(v))
+                return true;
+        }
+        return false;
+    }
+
+    /// \brief Pop from own shard, steal from neighbours if it is empty.
+    template<typename Out> [[nodiscard]] bool dequeue(Out& out)
+    {
+        const auto own {consumer_shard()};
+        if(shard_of(own).pop_front(out))
+            return true;
+        for(std::size_t cntr {1}; cntr < m_shards.size(); ++cntr)
+        {
+            if(shard_of(own + cntr).steal(out))
+                return true;
+        }
+        return false;
+    }
+
+    /// \brief Copy of elements of all shards, shard by shard.
+    [[nodiscard]] std::deque<T> contents() const
+    {
+        std::deque<T> q;
+        for(const auto& shard:m_shards)
+            shard->copy_to(q);
+        return q;
+    }
+
+
+    friend class boost::serialization::access;
+    // Elements of all shards are stored as one std::deque<T> under the same name
+    // as in Queue, so archives of both queues are interchangeable.
+    /// \note Shards are saved one by one, so the archive is a consistent view only
+    ///       if there are no concurrent operations.
+    template<class Archive>
+    void save(Archive& ar, [[maybe_unused]] const unsigned int version) const
+    {
+        const auto q {contents()};
+        ar & boost::serialization::make_nvp("m_queue", q);
+    }
+
+    /// \brief Loaded elements are distributed over shards round-robin.
+    template<class Archive>
+    void load(Archive& ar, [[maybe_unused]] const unsigned int version)
+    {
+        std::deque<T> q;
+        ar & boost::serialization::make_nvp("m_queue", q);
+        if(q.size() > max_size())
+            throw std::length_error{"Archive holds more elements than queue may keep"};
+        clear();
+        std::size_t index {0};
+        for(auto& v:q)
+        {
+            while(!shard_of(index++).push(v))
+                ;
+        }
+        m_not_empty.notify_all();
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+
+    const std::uint64_t m_id {make_id()};
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    alignas(cache_line_size) std::atomic<std::size_t> m_next_consumer {0};
+    alignas(cache_line_size) EventCount m_not_empty;
+    alignas(cache_line_size) EventCount m_space_available;
+    std::atomic_bool m_closed {false};
+};
+
+}
@@ -0,0 +1,429 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <deque>
+#include <atomic>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <stop_token>
+
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/deque.hpp>
+
+#include "Platform.hpp"
+#include "QueueClosed.hpp"
+
+namespace threadsafe_containers
+{
+
+/// \brief Wait-free bounded single-producer single-consumer queue.
+///        Has the same public API as Queue, but only one thread may push
+///        and only one thread may pop at a time.
+/// \tparam SIZE Default capacity. Used if capacity isn't passed to constructor.
+/// \note  Elements are passed with acquire/release operations on head and tail indices
+///        only. Each side caches the index of the other side and rereads it only when
+///        the queue looks empty (full). A push (pop) checks if the peer is parked by a flag,
+///        that is written only when a side parks, and takes no fence: a side, that parks,
+///        issues a barrier for both sides (see heavy_barrier).
+template<typename T, std::size_t SIZE = 2> class SpscQueue
+{
+    static_assert(SIZE > 0, "Queue must have at least one slot");
+
+public:
+    using value_type = T;
+    using pointer_type = std::unique_ptr<T>;
+
+    SpscQueue():
+        SpscQueue{SIZE}
+    {}
+
+    /// \brief Slots are allocated here once, queue doesn't allocate memory afterwards.
+    /// \throws std::invalid_argument
+    explicit SpscQueue(std::size_t capacity):
+        m_num_of_slots{capacity + 1},
+        m_slots{capacity ? std::make_unique<Slot[]>(capacity + 1): nullptr}
+    {
+        if(capacity == 0)
+            throw std::invalid_argument{"Capacity must be positive"};
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue(SpscQueue&&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+    SpscQueue& operator=(SpscQueue&&) = delete;
+
+    ~SpscQueue()
+    {
+        clear();
+    }
+
+    /// \brief  Push value into queue
+    /// \return False if queue has no space left to push \b v, true otherwise.
+    [[nodiscard]] bool push(T v)
+    {
+        if(!enqueue(v))
+            return false;
+        notify(m_pushed, m_consumer_parked);
+        return true;
+    }
+
+    /// \brief  Dequeue element and place it's value into \b v.
+    /// \return False if queue is empty, \b v keeps it's value.
+    ///         True otherwise, \b v contains dequeued value.
+    [[nodiscard]] bool pop(T& v)
+    {
+        if(!dequeue(v))
+            return false;
+        notify(m_popped, m_producer_parked);
+        return true;
+    }
+
+    /// \brief  Dequeue element and return it's value.
+    /// \return nullptr if queue is empty, dequeued value otherwise.
+    [[nodiscard]] pointer_type pop()
+    {
+        pointer_type p;
+        if(!dequeue(p))
+            return nullptr;
+        notify(m_popped, m_producer_parked);
+        return p;
+    }
+
+    /// \brief  Dequeue element without allocation.
+    /// \return std::nullopt if queue is empty, dequeued value otherwise.
+    [[nodiscard]] std::optional<T> try_pop()
+    {
+        std::optional<T> v;
+        if(!dequeue(v))
+            return std::nullopt;
+        notify(m_popped, m_producer_parked);
+        return v;
+    }
+
+    /// \brief Wait until queue is empty.
+    /// \throws QueueClosed If queue is closed while it's empty.
+    void wait_until_empty()
+    {
+        park(m_pushed, m_consumer_parked, [this]{ return !empty() || closed(); });
+        if(empty())
+            throw QueueClosed{};
+    }
+
+    /// \brief Wait until queue is full.
+    /// \throws QueueClosed If queue is closed while it's full.
+    void wait_until_full()
+    {
+        park(m_popped, m_producer_parked, [this]{ return !full() || closed(); });
+        if(full())
+            throw QueueClosed{};
+    }
+
+    /// \return True if queue is empty, false otherwise.
+    [[nodiscard]] bool empty() const
+    {
+        return size() == 0;
+    }
+
+    /// \return True if queue is false, false otherwise.
+    [[nodiscard]] bool full() const
+    {
+        return size() >= max_size();
+    }
+
+    /// \brief  Wait if queue is full, push \b v into queue.
+    /// \throws QueueClosed If queue is closed while it's full.
+    void wait_and_push(T v)
+    {
+        bool pushed {false};
+        park(m_popped, m_producer_parked, [this, &v, &pushed]{ return (pushed = enqueue(v)) || closed(); });
+        if(!pushed)
+            throw QueueClosed{};
+        notify(m_pushed, m_consumer_parked);
+    }
+
+    /// \brief  Wait until queue is empty, dequeue element and place it's value into \b v.
+    /// \throws QueueClosed If queue is closed while it's empty.
+    void wait_and_pop(T& v)
+    {
+        bool popped {false};
+        park(m_pushed, m_consumer_parked, [this, &v, &popped]{ return (popped = dequeue(v)) || closed(); });
+        if(!popped)
+            throw QueueClosed{};
+        notify(m_popped, m_producer_parked);
+    }
+
+    /// \brief  Wait until queue is empty, dequeue element and return it's value.
+    /// \throws QueueClosed If queue is closed while it's empty.
+    [[nodiscard]] pointer_type wait_and_pop()
+    {
+        pointer_type p;
+        park(m_pushed, m_consumer_parked, [this, &p]{ return dequeue(p) || closed(); });
+        if(!p)
+            throw QueueClosed{};
+        notify(m_popped, m_producer_parked);
+        return p;
+    }
+
+    /// \brief  Wait until queue is not empty or \b exit_condition is true,
+    ///         dequeue element and place it's value into \b v.
+    /// \return False if exit condition is met or queue is closed on empty queue, \b v keeps it's value.
+    template<typename P>
+    [[nodiscard]] bool wait_and_pop(T& v, P exit_condition)
+    {
+        bool popped {false};
+        park(m_pushed, m_consumer_parked, [this, &v, &popped, &exit_condition]{ return (popped = dequeue(v)) || exit_condition() || closed(); });
+        if(!popped)
+            return false;
+        notify(m_popped, m_producer_parked);
+        return true;
+    }
+
+    /// \brief  Wait if queue is full, push \b v into queue.
+    ///         The wait is cancelled when stop is requested on \b stop_token.
+    /// \return False if stop is requested or queue is closed while it's full, true otherwise.
+    [[nodiscard]] bool wait_and_push(T v, std::stop_token stop_token)
+    {
+        const std::stop_callback on_stop {stop_token, [this]{ notify(m_popped, m_producer_parked); }};
+        bool pushed {false};
+        park(m_popped, m_producer_parked, [this, &v, &pushed, &stop_token]{ return (pushed = enqueue(v)) || stop_token.stop_requested() || closed(); });
+        if(!pushed)
+            return false;
+        notify(m_pushed, m_consumer_parked);
+        return true;
+    }
+
+    /// \brief  Wait until queue is not empty, dequeue element and place it's value into \b v.
+    ///         The wait is cancelled when stop is requested on \b stop_token,
+    ///         so elements left in queue are still dequeued after that.
+    /// \return False if stop is requested on empty queue, \b v keeps it's value.
+    [[nodiscard]] bool wait_and_pop(T& v, std::stop_token stop_token)
+    {
+        const std::stop_callback on_stop {stop_token, [this]{ notify(m_pushed, m_consumer_parked); }};
+        return wait_and_pop(v, [&stop_token]{ return stop_token.stop_requested(); });
+    }
+
+    template<typename P>
+    [[nodiscard]] pointer_type wait_and_pop(P exit_condition)
+    {
+        pointer_type p;
+        park(m_pushed, m_consumer_parked, [this, &p, &exit_condition]{ return dequeue(p) || exit_condition() || closed(); });
+        if(!p)
+            return nullptr;
+        notify(m_popped, m_producer_parked);
+        return p;
+    }
+
+    /// \note Consumer side operation.
+    void clear()
+    {
+        std::optional<T> v;
+        while(dequeue(v))
+            notify(m_popped, m_producer_parked);
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        const auto head {m_head.load(std::memory_order_acquire)};
+        const auto tail {m_tail.load(std::memory_order_acquire)};
+        return tail >= head ? tail - head: tail + m_num_of_slots - head;
+    }
+
+    [[nodiscard]] constexpr std::size_t max_size() const noexcept
+    {
+        return m_num_of_slots - 1;
+    }
+
+    /// \brief Close queue for waiting: parked producer and consumer are woken and waits
+    ///        don't park any more (see Queue::close).
+    void close()
+    {
+        m_closed.store(true, std::memory_order_relaxed);
+        wake(m_pushed, m_consumer_parked);
+        wake(m_popped, m_producer_parked);
+    }
+
+    /// \brief Let waits park again.
+    void open() noexcept
+    {
+        m_closed.store(false, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool closed() const noexcept
+    {
+        return m_closed.load(std::memory_order_relaxed);
+    }
+
+    /// \note Must not be called concurrently with operations which modify queue.
+    [[nodiscard]] friend bool operator==(const SpscQueue& l, const SpscQueue& r)
+    {
+        return l.contents() == r.contents();
+    }
+
+private:
+    using index_t = std::size_t;
+    using epoch_t = std::atomic<std::uint32_t>;
+    using parked_t = std::atomic<bool>;
+
+    struct Slot
+    {
+        alignas(T) unsigned char m_storage[sizeof(T)];
+
+        T* value() noexcept
+        {
+            return std::launder(reinterpret_cast<T*>(m_storage));
+        }
+
+        const T* value() const noexcept
+        {
+            return std::launder(reinterpret_cast<const T*>(m_storage));
+        }
+    };
+
+    /// \brief Index of the slot following \b index.
+    ///        One slot is always kept free to tell a full queue from an empty one.
+    [[nodiscard]] index_t next(index_t index) const noexcept
+    {
+        return ++index == m_num_of_slots ? 0: index;
+    }
+
+    /// \brief Producer side. \b v is left untouched if queue is full.
+    [[nodiscard]] bool enqueue(T& v)
+    {
+        const auto tail {m_tail.load(std::memory_order_relaxed)};
+        const auto next_tail {next(tail)};
+        if(next_tail == m_cached_head)
+        {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if(next_tail == m_cached_head)
+                return false;
+        }
+        ::new(static_cast<void*>(m_slots[tail].m_storage)) T(std::move(v));
+        m_tail.store(next_tail, std::memory_order_release);
+        return true;
+    }
+
+    /// \brief Consumer side.
+    template<typename Out> [[nodiscard]] bool dequeue(Out& out)
+    {
+        const auto head {m_head.load(std::memory_order_relaxed)};
+        if(head == m_cached_tail)
+        {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            if(head == m_cached_tail)
+                return false;
+        }
+        auto* value {m_slots[head].value()};
+        if constexpr(std::is_same_v<Out, pointer_type>)
+            out = std::make_unique<T>(std::move(*value));
+        else
+            out = std::move(*value);
+        value->~T();
+        m_head.store(next(head), std::memory_order_release);
+        return true;
+    }
+
+    /// \brief Retry \b op until it succeeds. Sleep on \b epoch between attempts.
+    template<typename Op> void park(epoch_t& epoch, parked_t& parked, Op op)
+    {
+        if(op())
+            return;
+        for(;;)
+        {
+            parked.store(true, std::memory_order_relaxed);
+            // pairs with light_barrier of notify(): either the peer sees the flag or op() sees it's change
+            heavy_barrier();
+            const auto e {epoch.load(std::memory_order_acquire)};
+            if(op())
+                break;
+            epoch.wait(e, std::memory_order_acquire);
+        }
+        parked.store(false, std::memory_order_relaxed);
+    }
+
+    /// \brief Wake the peer if it is parked on \b epoch.
+    ///        The flag is reset here, so the peer is woken once per park, not once per element.
+    void notify(epoch_t& epoch, parked_t& parked)
+    {
+        light_barrier();
+        if(parked.load(std::memory_order_relaxed) && parked.exchange(false, std::memory_order_relaxed))
+        {
+            epoch.fetch_add(1, std::memory_order_release);
+            epoch.notify_one();
+        }
+    }
+
+    /// \brief Wake the peer parked on \b epoch, even if it has just checked the flag.
+    void wake(epoch_t& epoch, parked_t& parked)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        parked.store(false, std::memory_order_relaxed);
+        epoch.fetch_add(1, std::memory_order_release);
+        epoch.notify_all();
+    }
+
+    /// \brief Copy of queue elements from head to tail.
+    [[nodiscard]] std::deque<T> contents() const
+    {
+        std::deque<T> q;
+        const auto head {m_head.load(std::memory_order_acquire)};
+        const auto tail {m_tail.load(std::memory_order_acquire)};
+        for(auto pos {head}; pos != tail; pos = next(pos))
+            q.push_back(*m_slots[pos].value());
+        return q;
+    }
+
+
+    friend class boost::serialization::access;
+    // Elements are stored as std::deque<T> under the same name as in Queue,
+    // so archives of both queues are interchangeable.
+    /// \note Must not be called concurrently with operations which modify queue.
+    template<class Archive>
+    void save(Archive& ar, [[maybe_unused]] const unsigned int version) const
+    {
+        const auto q {contents()};
+        ar & boost::serialization::make_nvp("m_queue", q);
+    }
+
+    template<class Archive>
+    void load(Archive& ar, [[maybe_unused]] const unsigned int version)
+    {
+        std::deque<T> q;
+        ar & boost::serialization::make_nvp("m_queue", q);
+        if(q.size() > max_size())
+            throw std::length_error{"Archive holds more elements than queue may keep"};
+        clear();
+        for(auto& v:q)
+        {
+            if(!enqueue(v))
+                throw std::length_error{"Queue is modified while being loaded"};
+        }
+        notify(m_pushed, m_consumer_parked);
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+
+    // consumer's line
+    alignas(cache_line_size) std::atomic<index_t> m_head {0};
+    index_t m_cached_tail {0};
+    // producer's line
+    alignas(cache_line_size) std::atomic<index_t> m_tail {0};
+    index_t m_cached_head {0};
+    // parking line, written only when a side parks or wakes the other one,
+    // so both sides keep it in cache and check the flags of the peer for free
+    alignas(cache_line_size) parked_t m_consumer_parked {false};
+    parked_t m_producer_parked {false};
+    epoch_t m_popped {0};
+    epoch_t m_pushed {0};
+    alignas(cache_line_size) const std::size_t m_num_of_slots;
+    std::unique_ptr<Slot[]> m_slots;
+    std::atomic_bool m_closed {false};
+};
+
+}
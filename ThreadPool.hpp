@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+
+#include "ShardedQueue.hpp"
+#include "Coroutine.hpp"
+
+namespace producer_consumer
+{
+
+/// \brief Fixed size pool of worker threads with a task deque per worker.
+///        A worker runs tasks of it's own deque in FIFO order and steals tasks from
+///        the back of other deques when it's own is empty (see threadsafe_containers::ShardedQueue).
+///        Tasks submitted by a worker go to it's own deque, tasks submitted by other
+///        threads are spread over deques round-robin.
+/// \note  Tasks must not block waiting for each other: a blocked task holds a worker.
+///        Coroutines suspended on queues by workers are resumed as tasks of the pool.
+class ThreadPool: public threadsafe_containers::Scheduler
+{
+public:
+    using task_t = std::function<void()>;
+
+    /// \param num_of_threads Number of workers, hardware concurrency by default.
+    /// \param worker_capacity Number of tasks a worker deque may keep.
+    explicit ThreadPool(std::size_t num_of_threads = default_num_of_threads(), std::size_t worker_capacity = 1024):
+        m_tasks(std::max<std::size_t>(num_of_threads, 1), worker_capacity)
+    {
+        m_workers.reserve(m_tasks.num_of_shards());
+        for(std::size_t cntr {0}; cntr < m_tasks.num_of_shards(); ++cntr)
+            m_workers.emplace_back([this]{ work(); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ThreadPool& operator=(ThreadPool&&) = delete;
+
+    /// \brief Wait until submitted tasks are done and stop workers.
+    ~ThreadPool() override
+    {
+        wait();
+        // an empty task stops the worker that takes it
+        for(std::size_t cntr {0}; cntr < m_workers.size(); ++cntr)
+            m_tasks.wait_and_push({});
+        for(auto& worker:m_workers)
+            worker.join();
+    }
+
+    /// \brief Schedule \b task. Waits if deques are full.
+    void submit(task_t task)
+    {
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        if(current_pool() == this && m_tasks.push_local(task))
+            return;
+        m_tasks.wait_and_push(std::move(task));
+    }
+
+    /// \brief Resume \b handle as a task. Waits if deques are full, queues schedule coroutines
+    ///        after their lock is released, so workers may use them meanwhile.
+    void schedule(std::coroutine_handle<> handle) override
+    {
+        submit([handle]{ handle.resume(); });
+    }
+
+    /// \brief Wait until all submitted tasks, and tasks submitted by them, are done.
+    void wait() const
+    {
+        for(auto pending {m_pending.load()}; pending; pending = m_pending.load())
+            m_pending.wait(pending);
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return m_workers.size();
+    }
+
+    [[nodiscard]] static std::size_t default_num_of_threads() noexcept
+    {
+        return std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+    }
+
+private:
+    /// \brief Pool of the calling worker, nullptr for other threads.
+    [[nodiscard]] static const ThreadPool*& current_pool() noexcept
+    {
+        thread_local const ThreadPool* pool {nullptr};
+        return pool;
+    }
+
+    void work()
+    {
+        current_pool() = this;
+        Scheduler::current() = this;
+        for(;;)
+        {
+            task_t task;
+            m_tasks.wait_and_pop(task);
+            if(!task)
+                break;
+            task();
+            if(m_pending.fetch_sub(1) == 1)
+                m_pending.notify_all();
+        }
+    }
+
+    threadsafe_containers::ShardedQueue<task_t> m_tasks;
+    std::vector<std::thread> m_workers;
+    /// \brief Submitted tasks which are not done yet.
+    std::atomic<std::size_t> m_pending {0};
+};
+
+}
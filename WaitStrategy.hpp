@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <atomic>
+
+#include "Platform.hpp"
+
+namespace threadsafe_containers
+{
+
+/// \brief Wait strategies for blocking operations of Queue.
+///        spin_limit - number of spins on a lock free hint before parking,
+///        parks      - whether a thread sleeps on a condition variable (futex on Linux)
+///                     when spinning didn't help.
+
+/// \brief Park at once. Lowest CPU usage, a futex wake per handoff to a sleeping thread.
+struct BlockingWait
+{
+    static constexpr std::size_t spin_limit {0};
+    static constexpr bool parks {true};
+};
+
+/// \brief Spin up to SPINS times with a pause instruction, then park.
+///        Short waits never reach the futex, so notifiers don't pay for a wake.
+template<std::size_t SPINS = 4096> struct SpinThenParkWait
+{
+    static constexpr std::size_t spin_limit {SPINS};
+    static constexpr bool parks {true};
+};
+
+/// \brief Never park. For threads pinned to dedicated latency-critical cores.
+struct BusyPollWait
+{
+    static constexpr std::size_t spin_limit {std::numeric_limits<std::size_t>::max()};
+    static constexpr bool parks {false};
+};
+
+/// \brief  Spin on \b hint as WaitStrategy allows.
+/// \return True if \b hint became true.
+template<typename WaitStrategy, typename Hint> [[nodiscard]] bool spin(Hint hint)
+{
+    for(std::size_t cntr {0}; cntr < WaitStrategy::spin_limit; ++cntr)
+    {
+        if(hint())
+            return true;
+        cpu_relax();
+    }
+    return false;
+}
+
+/// \brief Lets lock free containers park threads until the state they wait for may have changed.
+///        Parked threads are counted, so notify_all() neither writes shared memory nor makes
+///        a system call if no one sleeps: notifiers of a busy container don't contend on it.
+class EventCount
+{
+public:
+    /// \brief Retry \b op until it succeeds, sleep between attempts.
+    ///        Epoch is read before an attempt, so a notification made after
+    ///        a failed attempt is never missed.
+    template<typename Op> void wait_until(Op op)
+    {
+        if(op())
+            return;
+        ++m_waiters;
+        // pairs with the fence of notify_all(): either the notifier sees the waiter
+        // or the waiter sees the state changed before the notification
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for(;;)
+        {
+            const auto e {m_epoch.load()};
+            if(op())
+                break;
+            m_epoch.wait(e);
+        }
+        --m_waiters;
+    }
+
+    void notify_all() noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!m_waiters.load(std::memory_order_relaxed))
+            return;
+        ++m_epoch;
+        m_epoch.notify_all();
+    }
+
+private:
+    std::atomic<std::uint32_t> m_epoch {0};
+    std::atomic<std::uint32_t> m_waiters {0};
+};
+
+}
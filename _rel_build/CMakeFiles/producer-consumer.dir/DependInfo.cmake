@@ -0,0 +1,21 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/ProducerConsumer.cpp" "CMakeFiles/producer-consumer.dir/ProducerConsumer.cpp.o" "gcc" "CMakeFiles/producer-consumer.dir/ProducerConsumer.cpp.o.d"
+  "/root/repo/main.cpp" "CMakeFiles/producer-consumer.dir/main.cpp.o" "gcc" "CMakeFiles/producer-consumer.dir/main.cpp.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  "/root/repo/_rel_build/CMakeFiles/serialization_lib.dir/DependInfo.cmake"
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
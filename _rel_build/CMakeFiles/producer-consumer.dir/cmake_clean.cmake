@@ -0,0 +1,13 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/producer-consumer.dir/ProducerConsumer.cpp.o"
+  "CMakeFiles/producer-consumer.dir/ProducerConsumer.cpp.o.d"
+  "CMakeFiles/producer-consumer.dir/main.cpp.o"
+  "CMakeFiles/producer-consumer.dir/main.cpp.o.d"
+  "producer-consumer"
+  "producer-consumer.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/producer-consumer.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/serialization_lib.dir/serialization.cpp.o"
+  "CMakeFiles/serialization_lib.dir/serialization.cpp.o.d"
+  "libserialization_lib.a"
+  "libserialization_lib.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/serialization_lib.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
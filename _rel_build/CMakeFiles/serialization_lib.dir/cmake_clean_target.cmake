@@ -0,0 +1,3 @@
+file(REMOVE_RECURSE
+  "libserialization_lib.a"
+)
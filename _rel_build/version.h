@@ -0,0 +1,3 @@
+#pragma once
+
+#define PROJECT_VERSION_PATCH 2
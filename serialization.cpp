@@ -1,8 +1,77 @@
 #include "serialization.hpp"
 
+#include <cerrno>
+#include <climits>
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
 namespace serialization
 {
 
+namespace
+{
+
+int open_for_append(const fs::path& path) noexcept
+{
+#if defined(_WIN32)
+    return ::_wopen(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+}
+
+void close_file(int fd) noexcept
+{
+#if defined(_WIN32)
+    ::_close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+bool write_file(int fd, const char* data, std::size_t size) noexcept
+{
+    while(size)
+    {
+#if defined(_WIN32)
+        const auto n {::_write(fd, data, static_cast<unsigned>(std::min<std::size_t>(size, INT_MAX)))};
+#else
+        const auto n {::write(fd, data, size)};
+#endif
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+bool sync_file_data(int fd) noexcept
+{
+#if defined(_WIN32)
+    return ::_commit(fd) == 0;
+#elif defined(__APPLE__)
+    return ::fsync(fd) == 0;
+#else
+    return ::fdatasync(fd) == 0;
+#endif
+}
+
+}
+
 Exception::Exception(const char* message):
     m_message{message}
 {}
@@ -12,4 +81,132 @@ const char* Exception::what() const noexcept
     return m_message.c_str();
 }
 
+
+FileBuffer::FileBuffer(const fs::path& path, std::size_t buffer_size):
+    m_fd{open_for_append(path)},
+    m_buffer(std::max<std::size_t>(buffer_size, 1))
+{
+    if(m_fd < 0)
+        throw Exception{"Can't open file"};
+    setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+}
+
+FileBuffer::~FileBuffer()
+{
+    static_cast<void>(write_buffer());
+    close_file(m_fd);
+}
+
+bool FileBuffer::sync_file()
+{
+    return write_buffer() && sync_file_data(m_fd);
+}
+
+FileBuffer::int_type FileBuffer::overflow(int_type ch)
+{
+    if(!write_buffer())
+        return traits_type::eof();
+    if(!traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+std::streamsize FileBuffer::xsputn(const char* s, std::streamsize n)
+{
+    const auto size {static_cast<std::size_t>(n)};
+    if(size <= static_cast<std::size_t>(epptr() - pptr()))
+    {
+        traits_type::copy(pptr(), s, size);
+        pbump(static_cast<int>(n));
+        return n;
+    }
+    // data, that doesn't fit, goes to the file directly instead of in buffer sized pieces
+    if(!write_buffer() || !write(s, size))
+        return 0;
+    return n;
+}
+
+int FileBuffer::sync()
+{
+    return 0;
+}
+
+bool FileBuffer::flush_file()
+{
+    return write_buffer();
+}
+
+void FileBuffer::discard() noexcept
+{
+    setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+}
+
+bool FileBuffer::write(const char* data, std::size_t size)
+{
+    return write_file(m_fd, data, size);
+}
+
+bool FileBuffer::write_buffer()
+{
+    const auto size {static_cast<std::size_t>(pptr() - pbase())};
+    setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+    return write(m_buffer.data(), size);
+}
+
+
+void append_to_file(const std::string& fname, std::span<const Segment> segments)
+{
+#if defined(_WIN32)
+    // no vectored writes, segments are written one after another
+    const int fd {open_for_append(fs::path{fname})};
+    if(fd < 0)
+        throw Exception{"Can't open file"};
+    for(const auto& segment:segments)
+    {
+        if(!write_file(fd, static_cast<const char*>(segment.data), segment.size))
+        {
+            close_file(fd);
+            throw Exception{"Can't write file"};
+        }
+    }
+    close_file(fd);
+#else
+    std::vector<iovec> iov;
+    iov.reserve(segments.size());
+    for(const auto& segment:segments)
+    {
+        if(segment.size)
+            iov.push_back({const_cast<void*>(segment.data), segment.size});
+    }
+    const int fd {open_for_append(fs::path{fname})};
+    if(fd < 0)
+        throw Exception{"Can't open file"};
+    // writev may write a part of segments, the rest is written again
+    for(std::size_t first {0}; first < iov.size();)
+    {
+        const auto n {::writev(fd, iov.data() + first, static_cast<int>(std::min<std::size_t>(iov.size() - first, IOV_MAX)))};
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            close_file(fd);
+            throw Exception{"Can't write file"};
+        }
+        for(auto written {static_cast<std::size_t>(n)}; written && first < iov.size();)
+        {
+            const auto part {std::min(written, iov[first].iov_len)};
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + part;
+            iov[first].iov_len -= part;
+            written -= part;
+            if(!iov[first].iov_len)
+                ++first;
+        }
+    }
+    close_file(fd);
+#endif
+}
+
 }
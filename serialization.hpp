@@ -5,6 +5,18 @@
 #include <exception>
 #include <string>
 #include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <span>
+#include <type_traits>
+#include <future>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <streambuf>
+#include <ostream>
 
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
@@ -29,17 +41,96 @@ private:
 };
 
 
+/// \brief Output buffer of a file, that is kept open. Data is written to the file
+///        when the buffer is full or on flush_file(), large writes bypass the buffer.
+/// \note  std::ostream::flush() doesn't write the buffer: text archives flush the stream
+///        when they are destroyed, that would make every save a write call.
+class FileBuffer: public std::streambuf
+{
+public:
+    /// \brief Open \b path for appending.
+    /// \throws serialization::Exception
+    FileBuffer(const fs::path& path, std::size_t buffer_size);
+
+    FileBuffer(const FileBuffer&) = delete;
+    FileBuffer(FileBuffer&&) = delete;
+    FileBuffer& operator=(const FileBuffer&) = delete;
+    FileBuffer& operator=(FileBuffer&&) = delete;
+
+    /// \brief Write buffered data and close the file.
+    ~FileBuffer() override;
+
+    /// \brief  Write buffered data to the file.
+    /// \return False on error.
+    bool flush_file();
+
+    /// \brief  Write buffered data and wait until the file is on disk (fdatasync, _commit on Windows).
+    /// \return False on error.
+    bool sync_file();
+
+    /// \brief Drop buffered data, that isn't written to the file yet.
+    void discard() noexcept;
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int sync() override;
+
+private:
+    [[nodiscard]] bool write(const char* data, std::size_t size);
+    [[nodiscard]] bool write_buffer();
+
+    int m_fd {-1};
+    std::vector<char> m_buffer;
+};
+
+
 enum class ArchiveType
 {
     BINARY,
     TEXT,
-    XML
+    XML,
+    RAW     ///< header and bytes of elements, for queues of trivially copyable elements
+};
+
+/// \brief A queue, that may be saved as RAW: it's elements are trivially copyable
+///        and it's snapshot keeps them in contiguous parts.
+template<typename T>
+concept raw_serializable = std::is_trivially_copyable_v<typename T::value_type> &&
+    requires(const T& q) { q.snapshot().elements().segments(); };
+
+/// \brief RAW for queues of trivially copyable elements, BINARY otherwise.
+template<typename T>
+inline constexpr ArchiveType fastest_archive_type {raw_serializable<T> ? ArchiveType::RAW: ArchiveType::BINARY};
+
+/// \brief Header of RAW archive, followed by \b count elements of \b element_size bytes.
+struct RawHeader
+{
+    char magic[8] {'P', 'C', 'Q', 'R', 'A', 'W', '\0', '\0'};
+    std::uint32_t version {1};
+    std::uint32_t element_size {0};
+    std::uint64_t count {0};
 };
 
-template<typename T, ArchiveType ArType> class Serializer
+/// \brief Bytes to write with one call.
+struct Segment
 {
+    const void* data;
+    std::size_t size;
+};
+
+/// \brief  Append \b segments to file \b fname with vectored writes (writev),
+///         on Windows segments are written one after another.
+/// \throws serialization::Exception
+void append_to_file(const std::string& fname, std::span<const Segment> segments);
+
+/// \tparam ArType fastest_archive_type of \b T by default: RAW if it's elements are trivially copyable.
+template<typename T, ArchiveType ArType = fastest_archive_type<T>> class Serializer
+{
+    static_assert(ArType != ArchiveType::RAW || raw_serializable<T>, "RAW archive keeps trivially copyable elements of a queue");
+
 public:
-    Serializer() noexcept = default;
+    Serializer() = default;
 
     /// \throws std::filesystem::filesystem_error, serialization::Exception
     Serializer(const fs::path& path)
@@ -49,15 +140,23 @@ public:
 
     ~Serializer() = default;
 
+    /// \brief Truncate the file. Data of a kept open file, that isn't written yet, is dropped too.
     /// \throws The same exceptions as std::fstream
     void clear()
     {
+        std::scoped_lock lk {*m_mutex};
+        if(m_stream)
+        {
+            m_stream->buffer.discard();
+            m_stream->stream.clear();
+        }
         std::ofstream stream{m_fname, std::ofstream::out | std::ofstream::trunc};
     }
 
     /// \throws std::filesystem::filesystem_error, serialization::Exception
     void set_file_name(const fs::path& path)
     {
+        m_stream.reset();
         if(fs::is_directory(path))
             throw Exception{"Path refers to a directory not a file"};
         if(!path.has_filename())
@@ -80,36 +179,87 @@ public:
         }
     }
 
-    /// \throws The same exceptions as std::fstream
+    /// \brief Keep the file open with a \b buffer_size buffer, so every save appends an archive
+    ///        to one stream instead of opening the file. Saved data reaches the file when
+    ///        the buffer is full or on flush(), and reaches the disk on sync().
+    /// \throws serialization::Exception
+    void keep_open(std::size_t buffer_size = default_buffer_size)
+    {
+        m_stream = std::make_shared<Stream>(m_fname, buffer_size);
+    }
+
+    /// \brief Write buffered data of a kept open file.
+    /// \throws serialization::Exception
+    void flush()
+    {
+        if(!m_stream)
+            return;
+        std::scoped_lock lk {*m_mutex};
+        if(!m_stream->stream || !m_stream->buffer.flush_file())
+            throw Exception{"Can't write file"};
+    }
+
+    /// \brief Write buffered data of a kept open file and wait until it's on disk.
+    /// \throws serialization::Exception
+    void sync()
+    {
+        if(!m_stream)
+            return;
+        std::scoped_lock lk {*m_mutex};
+        if(!m_stream->buffer.sync_file())
+            throw Exception{"Can't sync file"};
+    }
+
+    /// \brief Flush and close a kept open file, saves open the file again.
+    void close() noexcept
+    {
+        m_stream.reset();
+    }
+
+    /// \throws The same exceptions as std::fstream, serialization::Exception
     Serializer<T, ArType>& operator<<(const T& q)
     {
-        using stream_t = std::ofstream;
-        stream_t stream{m_fname, stream_t::out | stream_t::app};
-        if constexpr(ArType == ArchiveType::BINARY)
-        {
-            boost::archive::binary_oarchive ar{stream};
-            ar << q;
-        }
-        else if constexpr(ArType == ArchiveType::TEXT)
-        {
-            boost::archive::text_oarchive ar{stream};
-            ar << q;
-        }
-        else if constexpr(ArType == ArchiveType::XML)
-        {
-            boost::archive::xml_oarchive ar{stream};
-            //ar << boost::serialization::make_nvp("data", q);
-            ar << BOOST_SERIALIZATION_NVP(q);
-        }
+        if constexpr(ArType == ArchiveType::RAW)
+            write_raw(m_fname, m_stream.get(), *m_mutex, q.snapshot());
+        else
+            save(m_fname, m_stream.get(), *m_mutex, q);
         return *this;
     }
 
-    /// \throws The same exceptions as std::fstream
+    /// \brief  Copy elements of \b q under it's lock and write them by a background thread,
+    ///         so \b q is locked only for the copy, not for I/O. The file is loaded with operator>>.
+    ///         Saves of a serializer are written one after another, so overlapping saves
+    ///         append whole archives.
+    /// \return Future, that is ready when the file is written, with the time \b q was locked.
+    ///         The future keeps exception of the write.
+    [[nodiscard]] auto save_async(const T& q) -> std::future<std::chrono::nanoseconds>
+        requires requires { q.snapshot().hold_time(); }
+    {
+        return std::async(std::launch::async, [fname = m_fname, stream = m_stream, mutex = m_mutex, snapshot = q.snapshot()]
+        {
+            if constexpr(ArType == ArchiveType::RAW)
+                write_raw(fname, stream.get(), *mutex, snapshot);
+            else
+                save(fname, stream.get(), *mutex, snapshot);
+            return snapshot.hold_time();
+        });
+    }
+
+    /// \throws The same exceptions as std::fstream, serialization::Exception
     Serializer<T, ArType>& operator>>(T& q)
     {
+        flush();
+        std::scoped_lock lk {*m_mutex};
         using stream_t = std::ifstream;
-        stream_t stream{m_fname, stream_t::in};
-        if constexpr(ArType == ArchiveType::BINARY)
+        // text archives are read in text mode, that translates line ends on Windows
+        constexpr auto mode {ArType == ArchiveType::RAW || ArType == ArchiveType::BINARY ?
+            stream_t::in | stream_t::binary: stream_t::in};
+        stream_t stream{m_fname, mode};
+        if constexpr(ArType == ArchiveType::RAW)
+        {
+            read_raw(stream, q);
+        }
+        else if constexpr(ArType == ArchiveType::BINARY)
         {
             boost::archive::binary_iarchive ar{stream};
             ar >> q;
@@ -129,7 +279,114 @@ public:
     }
 
 private:
+    static constexpr std::size_t default_buffer_size {1 << 20};
+
+    /// \brief Kept open file. Shared with background saves, that may outlive the serializer.
+    struct Stream
+    {
+        Stream(const fs::path& path, std::size_t buffer_size):
+            buffer{path, buffer_size}
+        {}
+
+        FileBuffer buffer;
+        std::ostream stream {&buffer};
+    };
+
+    /// \brief Append archive of \b q to a kept open \b stream, or to file \b fname if it's null.
+    template<typename U>
+    static void save(const std::string& fname, Stream* stream, std::mutex& mutex, const U& q)
+    {
+        std::scoped_lock lk {mutex};
+        if(stream)
+            write(stream->stream, q);
+        else
+        {
+            std::ofstream file{fname, std::ofstream::out | std::ofstream::app};
+            write(file, q);
+        }
+    }
+
+    /// \brief Archive \b q with the same layout and name, whether it's T or a snapshot of T.
+    template<typename U>
+    static void write(std::ostream& stream, const U& q)
+    {
+        if constexpr(ArType == ArchiveType::BINARY)
+        {
+            boost::archive::binary_oarchive ar{stream};
+            ar << q;
+        }
+        else if constexpr(ArType == ArchiveType::TEXT)
+        {
+            boost::archive::text_oarchive ar{stream};
+            ar << q;
+        }
+        else if constexpr(ArType == ArchiveType::XML)
+        {
+            boost::archive::xml_oarchive ar{stream};
+            //ar << boost::serialization::make_nvp("data", q);
+            ar << BOOST_SERIALIZATION_NVP(q);
+        }
+    }
+
+    /// \brief Write RAW archive of \b snapshot: header and up to two contiguous parts of elements,
+    ///        with one vectored write, or with large writes into a kept open \b stream.
+    template<typename Snapshot>
+    static void write_raw(const std::string& fname, Stream* stream, std::mutex& mutex, const Snapshot& snapshot)
+    {
+        const auto& elements {snapshot.elements()};
+        const auto [first, second] {elements.segments()};
+        RawHeader header;
+        header.element_size = sizeof(typename T::value_type);
+        header.count = elements.size();
+        const std::array<Segment, 3> segments {{
+            {&header, sizeof(header)},
+            {first.data(), first.size_bytes()},
+            {second.data(), second.size_bytes()}
+        }};
+        std::scoped_lock lk {mutex};
+        if(!stream)
+        {
+            append_to_file(fname, segments);
+            return;
+        }
+        for(const auto& segment:segments)
+            stream->stream.write(static_cast<const char*>(segment.data), static_cast<std::streamsize>(segment.size));
+        if(!stream->stream)
+            throw Exception{"Can't write file"};
+    }
+
+    /// \brief Replace elements of \b q by elements of RAW archive, that are read with one call.
+    void read_raw(std::istream& stream, T& q) const
+    {
+        using value_t = typename T::value_type;
+        RawHeader header;
+        stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if(!stream || std::memcmp(header.magic, RawHeader{}.magic, sizeof(header.magic)) != 0 ||
+           header.version != RawHeader{}.version || header.element_size != sizeof(value_t))
+            throw Exception{"File isn't a raw archive of this type"};
+        if(header.count > (fs::file_size(m_fname) - sizeof(header)) / sizeof(value_t))
+            throw Exception{"Raw archive is truncated"};
+
+        const auto count {static_cast<std::size_t>(header.count)};
+        // checked before the queue is cleared, so it keeps it's elements if the archive doesn't fit,
+        // push_bulk stops at the high watermark of a queue, that has one
+        std::size_t limit {q.max_size()};
+        if constexpr(requires { q.high_watermark(); })
+            limit = q.high_watermark();
+        if(count > limit)
+            throw Exception{"Queue can't keep all elements of archive"};
+        auto elements {std::make_unique_for_overwrite<value_t[]>(count)};
+        if(!stream.read(reinterpret_cast<char*>(elements.get()), static_cast<std::streamsize>(count * sizeof(value_t))))
+            throw Exception{"Raw archive is truncated"};
+        q.clear();
+        if(q.push_bulk(std::span<const value_t>{elements.get(), count}) != count)
+            throw Exception{"Queue can't keep all elements of archive"};
+    }
+
     std::string m_fname;
+    std::shared_ptr<Stream> m_stream;
+    /// \brief Serializes writes to the file. Shared with background saves, that may outlive the serializer.
+    std::shared_ptr<std::mutex> m_mutex {std::make_shared<std::mutex>()};
 };
 
 
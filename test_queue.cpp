@@ -1,15 +1,26 @@
 #include <vector>
+#include <array>
 #include <list>
 #include <fstream>
 #include <filesystem>
 #include <cassert>
 #include <numeric>
 #include <chrono>
+#include <sstream>
+#include <optional>
 #include "gtest/gtest.h"
 
 #include "Queue.hpp"
+#include "LockFreeQueue.hpp"
+#include "SpscQueue.hpp"
+#include "ShardedQueue.hpp"
+#include "PriorityQueue.hpp"
+#include "ClientAffinityQueue.hpp"
 #include "serialization.hpp"
 #include "ProducerConsumer.hpp"
+#include "Pipeline.hpp"
+#include "MappedSnapshot.hpp"
+#include "Journal.hpp"
 
 
 /// \brief Compare execution time in two cases. First is one producer, one consumer.
@@ -106,28 +117,20 @@ TEST(TEST_QUEUE, producer_consumer)
             }
         };
 
-        std::atomic_bool stopreq {false};
-        auto consumer = [&elements_left, &stopreq]//, &dec]
-                ([[maybe_unused]] std::stop_token stoptoken, queue_t& queue)
+        auto consumer = [&elements_left](std::stop_token stoptoken, queue_t& queue)
         {
             try
             {
-                //while(!queue.empty() && !stoptoken.stop_requested())
-                while(!queue.empty() && !stopreq)
+                data_t el {0};
+                while(queue.wait_and_pop(el, stoptoken))
                 {
-                    //auto cond = [stoptoken](){ return stoptoken.stop_requested(); };
-                    auto cond = [&stopreq](){ return stopreq.load(); };
-                    auto el {queue.wait_and_pop(cond)};
-                    if(el)
-                    {
-                        --elements_left;
-                        //dec();
-                        std::vector<data_t> v;
-                        constexpr std::size_t N {100000};
-                        v.reserve(N);
-                        for(std::size_t cntr {0}; cntr < N; ++cntr)
-                            v.emplace_back(cntr + *el);
-                    }
+                    if(--elements_left == 0)
+                        elements_left.notify_all();
+                    std::vector<data_t> v;
+                    constexpr std::size_t N {100000};
+                    v.reserve(N);
+                    for(std::size_t cntr {0}; cntr < N; ++cntr)
+                        v.emplace_back(cntr + el);
                 }
             }
             catch(const std::exception& e)
@@ -151,14 +154,9 @@ TEST(TEST_QUEUE, producer_consumer)
 
         // main thread
         {
-            using namespace std::chrono_literals;
-            std::this_thread::sleep_for(10ms);
-            while(!queue.empty())
-                std::this_thread::sleep_for(10ms);
-            std::cout << "Queue is empty. Elements produced: " << elements_produced << " Elements left: " << elements_left << std::endl;
-            while(elements_left)
-                std::this_thread::sleep_for(10ms);
-            std::cout << "No elements left" << std::endl;
+            for(auto left {elements_left.load()}; left; left = elements_left.load())
+                elements_left.wait(left);
+            std::cout << "No elements left. Elements produced: " << elements_produced << std::endl;
 
             std::uint8_t cntr {0};
             std::cout << "Request stop to producers: ";
@@ -174,7 +172,6 @@ TEST(TEST_QUEUE, producer_consumer)
             for(auto& t:consumers)
             {
                 t.request_stop();
-                stopreq = true;
                 if(t.joinable())
                     t.join();
             }
@@ -214,6 +211,2400 @@ TEST(TEST_QUEUE, producer_consumer)
     }
 }
 
+TEST(TEST_QUEUE, lock_free_queue)
+{
+    using namespace threadsafe_containers;
+    using data_t = std::uint64_t;
+    using queue_t = LockFreeQueue<data_t, 4>;
+
+    {
+        queue_t q;
+        EXPECT_TRUE(q.empty());
+        for(data_t cntr {0}; cntr < q.max_size(); ++cntr)
+            EXPECT_TRUE(q.push(cntr));
+        EXPECT_TRUE(q.full());
+        EXPECT_FALSE(q.push(100));
+        data_t v {0};
+        EXPECT_TRUE(q.pop(v));
+        EXPECT_EQ(v, 0);
+        EXPECT_EQ(*q.pop(), 1);
+        EXPECT_EQ(q.size(), 2);
+        q.clear();
+        EXPECT_TRUE(q.empty());
+        EXPECT_EQ(q.pop(), nullptr);
+        EXPECT_FALSE(q.pop(v));
+    }
+
+    // multiple producers, multiple consumers: every element is dequeued exactly once
+    {
+        constexpr std::size_t num_of_threads {4};
+        constexpr data_t num_of_elements {10000};
+        queue_t q;
+        std::atomic<data_t> sum {0};
+        std::atomic<data_t> popped {0};
+        {
+            std::vector<std::jthread> threads;
+            for(std::size_t cntr {0}; cntr < num_of_threads; ++cntr)
+            {
+                threads.emplace_back([&q, cntr]()
+                {
+                    for(data_t el {cntr}; el < num_of_elements; el += num_of_threads)
+                        q.wait_and_push(el);
+                });
+                threads.emplace_back([&q, &sum, &popped]()
+                {
+                    auto cond = [&popped](){ return popped.load() >= num_of_elements; };
+                    while(!cond())
+                    {
+                        if(auto el {q.wait_and_pop(cond)}; el)
+                        {
+                            sum += *el;
+                            ++popped;
+                        }
+                    }
+                });
+            }
+            // last consumers may sleep in wait_and_pop while the last element is being popped
+            while(popped < num_of_elements)
+                std::this_thread::yield();
+            for(std::size_t cntr {0}; cntr < num_of_threads; ++cntr)
+                q.wait_and_push(0);
+        }
+        EXPECT_EQ(sum, num_of_elements * (num_of_elements - 1) / 2);
+    }
+
+    // archives of Queue and LockFreeQueue are interchangeable
+    {
+        Queue<data_t, 4> q;
+        EXPECT_TRUE(q.push(1));
+        EXPECT_TRUE(q.push(3));
+        EXPECT_TRUE(q.push(6));
+        std::stringstream stream;
+        {
+            boost::archive::text_oarchive ar{stream};
+            ar << q;
+        }
+        queue_t lfq;
+        {
+            boost::archive::text_iarchive ar{stream};
+            ar >> lfq;
+        }
+        EXPECT_EQ(lfq.size(), 3);
+        std::stringstream stream2;
+        {
+            boost::archive::text_oarchive ar{stream2};
+            ar << lfq;
+        }
+        Queue<data_t, 4> newq;
+        {
+            boost::archive::text_iarchive ar{stream2};
+            ar >> newq;
+        }
+        EXPECT_EQ(newq, q);
+    }
+}
+
+TEST(TEST_QUEUE, spsc_queue)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    using clock = steady_clock;
+    using data_t = std::uint64_t;
+    constexpr data_t num_of_elements {200000};
+
+    // one producer, one consumer: elements keep their order
+    auto transfer = [](auto& q)
+    {
+        bool ordered {true};
+        const auto start {clock::now()};
+        {
+            std::jthread producer {[&q]()
+            {
+                for(data_t el {0}; el < num_of_elements; ++el)
+                    q.wait_and_push(el);
+            }};
+            data_t v {0};
+            for(data_t el {0}; el < num_of_elements; ++el)
+            {
+                q.wait_and_pop(v);
+                ordered = ordered && v == el;
+            }
+        }
+        const auto duration {duration_cast<microseconds>(clock::now() - start).count()};
+        return std::make_pair(ordered, num_of_elements * 1000000 / std::max<data_t>(duration, 1));
+    };
+
+    Queue<data_t, 1024> q;
+    SpscQueue<data_t, 1024> spscq;
+    const auto [q_ordered, q_rate] {transfer(q)};
+    const auto [spsc_ordered, spsc_rate] {transfer(spscq)};
+    EXPECT_TRUE(q_ordered);
+    EXPECT_TRUE(spsc_ordered);
+    EXPECT_TRUE(spscq.empty());
+    std::cout << "ops/sec Queue|SpscQueue: " << q_rate << '|' << spsc_rate << std::endl;
+
+    // a queue of one slot makes both sides park all the time, a lost wakeup hangs the test
+    SpscQueue<data_t, 1> parking_q;
+    EXPECT_TRUE(transfer(parking_q).first);
+
+    // Framework picks SpscQueue for one producer and one consumer if callables accept it
+    {
+        using namespace producer_consumer;
+        auto generic = [](auto&){};
+        auto explicit_type = [](Framework<data_t>::queue_t&){};
+        EXPECT_TRUE((Framework<data_t>{generic, 1, generic, 1, generic}.spsc_mode()));
+        EXPECT_FALSE((Framework<data_t>{generic, 2, generic, 1, generic}.spsc_mode()));
+        EXPECT_FALSE((Framework<data_t>{explicit_type, 1, explicit_type, 1, explicit_type}.spsc_mode()));
+    }
+}
+
+TEST(TEST_QUEUE, bulk_operations)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    using clock = steady_clock;
+    using data_t = std::uint64_t;
+    using queue_t = Queue<data_t, 8>;
+
+    {
+        queue_t q;
+        const std::vector<data_t> in {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+        EXPECT_EQ(q.push_bulk(in), q.max_size());
+        EXPECT_TRUE(q.full());
+
+        std::vector<data_t> out;
+        EXPECT_EQ(q.try_pop_bulk(std::back_inserter(out), 3), 3);
+        EXPECT_EQ(out, (std::vector<data_t>{1, 2, 3}));
+        EXPECT_EQ(q.wait_and_pop_bulk(std::back_inserter(out), 2, []{ return false; }), 2);
+        EXPECT_EQ(q.drain(std::back_inserter(out)), 3);
+        EXPECT_EQ(out, (std::vector<data_t>{1, 2, 3, 4, 5, 6, 7, 8}));
+        EXPECT_TRUE(q.empty());
+        EXPECT_EQ(q.try_pop_bulk(std::back_inserter(out), 3), 0);
+        EXPECT_EQ(q.wait_and_pop_bulk(std::back_inserter(out), 3, []{ return true; }), 0);
+    }
+
+    // elements are moved only out of a container passed as rvalue, a view keeps them intact
+    {
+        Queue<std::string, 8> q;
+        std::vector<std::string> in {"first string, that isn't short", "second string, that isn't short"};
+        const auto copy {in};
+        EXPECT_EQ(q.push_bulk(std::ranges::subrange(in.begin(), in.end())), 2);
+        EXPECT_EQ(q.push_bulk(in | std::views::take(1)), 1);
+        EXPECT_EQ(in, copy);
+        EXPECT_EQ(q.push_bulk(std::move(in)), 2);
+        std::vector<std::string> out;
+        EXPECT_EQ(q.drain(std::back_inserter(out)), 5);
+        EXPECT_EQ(out, (std::vector<std::string>{copy[0], copy[1], copy[0], copy[0], copy[1]}));
+    }
+
+    // consumer, that waits on empty queue, is woken by a bulk push
+    {
+        constexpr data_t num_of_elements {100000};
+        Queue<data_t, 1024> q;
+        const auto start {clock::now()};
+        data_t sum {0};
+        {
+            std::jthread producer {[&q]()
+            {
+                std::vector<data_t> batch;
+                for(data_t el {0}; el < num_of_elements;)
+                {
+                    batch.clear();
+                    for(; batch.size() < 64 && el < num_of_elements; ++el)
+                        batch.push_back(el);
+                    for(auto it {batch.begin()}; it != batch.end();)
+                    {
+                        it += q.push_bulk(std::ranges::subrange(it, batch.end()));
+                        if(it != batch.end())
+                            q.wait_until_full();
+                    }
+                }
+            }};
+            std::vector<data_t> batch;
+            for(data_t popped {0}; popped < num_of_elements;)
+            {
+                batch.clear();
+                popped += q.wait_and_pop_bulk(std::back_inserter(batch), 64, []{ return false; });
+                sum = std::accumulate(batch.begin(), batch.end(), sum);
+            }
+        }
+        EXPECT_EQ(sum, num_of_elements * (num_of_elements - 1) / 2);
+        std::cout << "bulk transfer (us): "
+                  << duration_cast<microseconds>(clock::now() - start).count() << std::endl;
+    }
+}
+
+TEST(TEST_QUEUE, capacity_and_watermarks)
+{
+    using namespace threadsafe_containers;
+    using data_t = std::uint64_t;
+
+    EXPECT_THROW(Queue<data_t>{0}, std::invalid_argument);
+    EXPECT_THROW((Queue<data_t>{4, 5, 1}), std::invalid_argument);
+    EXPECT_THROW((Queue<data_t>{4, 3, 3}), std::invalid_argument);
+
+    {
+        Queue<data_t> q {5};
+        EXPECT_EQ(q.max_size(), 5);
+        for(data_t cntr {0}; cntr < 5; ++cntr)
+            EXPECT_TRUE(q.push(cntr));
+        EXPECT_FALSE(q.push(5));
+        EXPECT_NE(q.pop(), nullptr);
+        EXPECT_TRUE(q.push(5));
+    }
+
+    // producers stop at high watermark and resume at low watermark
+    {
+        Queue<data_t> q {8, 6, 2};
+        for(data_t cntr {0}; cntr < 6; ++cntr)
+            EXPECT_TRUE(q.push(cntr));
+        EXPECT_TRUE(q.full());
+        EXPECT_FALSE(q.push(6));
+        data_t v {0};
+        for(data_t cntr {0}; cntr < 3; ++cntr)
+        {
+            EXPECT_TRUE(q.pop(v));
+            EXPECT_FALSE(q.push(6));
+        }
+        EXPECT_TRUE(q.pop(v));
+        EXPECT_EQ(q.size(), 2);
+        EXPECT_TRUE(q.push(6));
+
+        // blocked producer is resumed by consumer only once, at low watermark
+        for(data_t cntr {0}; cntr < 3; ++cntr)
+            EXPECT_TRUE(q.push(cntr));
+        std::atomic_bool pushed {false};
+        std::jthread producer {[&q, &pushed]()
+        {
+            q.wait_and_push(100);
+            pushed = true;
+        }};
+        for(data_t cntr {0}; cntr < 3; ++cntr)
+        {
+            using namespace std::chrono_literals;
+            std::this_thread::sleep_for(1ms);
+            EXPECT_FALSE(pushed);
+            q.wait_and_pop(v);
+        }
+        q.wait_and_pop(v);
+        producer.join();
+        EXPECT_TRUE(pushed);
+        EXPECT_EQ(q.size(), 3);
+    }
+
+    {
+        SpscQueue<data_t> q {3};
+        EXPECT_EQ(q.max_size(), 3);
+        for(data_t cntr {0}; cntr < 3; ++cntr)
+            EXPECT_TRUE(q.push(cntr));
+        EXPECT_TRUE(q.full());
+        EXPECT_FALSE(q.push(3));
+        EXPECT_EQ(*q.pop(), 0);
+        EXPECT_TRUE(q.push(3));
+        EXPECT_EQ(q.size(), 3);
+    }
+
+    // capacity of Framework queue is set at runtime
+    {
+        using namespace producer_consumer;
+        auto generic = [](auto&){};
+        Framework<data_t> framework {generic, 1, generic, 1, generic, 64};
+        EXPECT_TRUE(framework.spsc_mode());
+    }
+}
+
+TEST(TEST_QUEUE, wait_strategies)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    using clock = steady_clock;
+    using data_t = std::uint64_t;
+    constexpr data_t num_of_elements {20000};
+    constexpr std::size_t num_of_consumers {3};
+
+    auto transfer = [](auto& q)
+    {
+        std::atomic<data_t> sum {0};
+        const auto start {clock::now()};
+        {
+            std::atomic<data_t> popped {0};
+            std::vector<std::jthread> consumers;
+            for(std::size_t cntr {0}; cntr < num_of_consumers; ++cntr)
+            {
+                consumers.emplace_back([&q, &sum, &popped]()
+                {
+                    auto done = [&popped](){ return popped.load() >= num_of_elements; };
+                    while(!done())
+                    {
+                        if(auto el {q.wait_and_pop(done)}; el)
+                        {
+                            sum += *el;
+                            ++popped;
+                        }
+                    }
+                });
+            }
+            for(data_t el {0}; el < num_of_elements; ++el)
+                q.wait_and_push(el);
+            while(popped < num_of_elements)
+                std::this_thread::yield();
+            // wake consumers which are still parked
+            for(std::size_t cntr {0}; cntr < num_of_consumers; ++cntr)
+                q.wait_and_push(0);
+        }
+        EXPECT_EQ(sum, num_of_elements * (num_of_elements - 1) / 2);
+        return duration_cast<microseconds>(clock::now() - start).count();
+    };
+
+    Queue<data_t, 256, BlockingWait> blocking;
+    Queue<data_t, 256, SpinThenParkWait<>> spin_then_park;
+    std::cout << "duration blocking|spin-then-park (us): "
+              << transfer(blocking) << '|'
+              << transfer(spin_then_park) << std::endl;
+
+    // busy polling threads need a core each
+    if(std::thread::hardware_concurrency() > num_of_consumers)
+    {
+        Queue<data_t, 256, BusyPollWait> busy_poll;
+        std::cout << "duration busy-poll (us): " << transfer(busy_poll) << std::endl;
+    }
+}
+
+TEST(TEST_QUEUE, allocation_free_pop)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    using clock = steady_clock;
+
+    // move-only elements
+    auto move_only = [](auto& q)
+    {
+        EXPECT_TRUE(q.push(std::make_unique<int>(1)));
+        EXPECT_TRUE(q.push(std::make_unique<int>(2)));
+        auto v {q.try_pop()};
+        ASSERT_TRUE(v);
+        EXPECT_EQ(**v, 1);
+        std::unique_ptr<int> slot;
+        EXPECT_TRUE(q.wait_and_pop(slot, []{ return false; }));
+        EXPECT_EQ(*slot, 2);
+        EXPECT_FALSE(q.try_pop());
+        EXPECT_FALSE(q.wait_and_pop(slot, []{ return true; }));
+        EXPECT_EQ(*slot, 2);
+    };
+    {
+        Queue<std::unique_ptr<int>, 4> q;
+        move_only(q);
+    }
+    {
+        LockFreeQueue<std::unique_ptr<int>, 4> q;
+        move_only(q);
+    }
+    {
+        SpscQueue<std::unique_ptr<int>, 4> q;
+        move_only(q);
+    }
+
+    // std::optional against std::unique_ptr
+    {
+        using data_t = std::array<std::uint64_t, 8>;
+        constexpr std::size_t num_of_elements {200000};
+        const data_t value {1, 2, 3, 4, 5, 6, 7, 8};
+        Queue<data_t, 1> q;
+        std::size_t total {0};
+
+        auto start {clock::now()};
+        for(std::size_t cntr {0}; cntr < num_of_elements; ++cntr)
+        {
+            q.wait_and_push(value);
+            total += q.pop()->front();
+        }
+        const auto pointer_duration {duration_cast<microseconds>(clock::now() - start).count()};
+
+        start = clock::now();
+        for(std::size_t cntr {0}; cntr < num_of_elements; ++cntr)
+        {
+            q.wait_and_push(value);
+            total += q.try_pop()->front();
+        }
+        const auto optional_duration {duration_cast<microseconds>(clock::now() - start).count()};
+
+        EXPECT_EQ(total, 2 * num_of_elements * value.front());
+        std::cout << "duration pop() unique_ptr|optional (us): "
+                  << pointer_duration << '|' << optional_duration << std::endl;
+    }
+}
+
+TEST(TEST_QUEUE, ring_buffer_storage)
+{
+    using namespace threadsafe_containers;
+    using data_t = std::uint64_t;
+    using ring_queue_t = Queue<data_t, 4>;
+    using deque_queue_t = Queue<data_t, 4, BlockingWait, std::deque>;
+
+    {
+        RingBuffer<data_t> buffer {3};
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(&buffer.front()) % cache_line_size, 0);
+        // wrap around the end of the buffer
+        for(data_t cntr {0}; cntr < 10; ++cntr)
+        {
+            buffer.emplace_back(cntr);
+            buffer.emplace_back(cntr + 1);
+            EXPECT_EQ(buffer.front(), cntr);
+            buffer.pop_front();
+            EXPECT_EQ(buffer.front(), cntr + 1);
+            buffer.pop_front();
+        }
+        EXPECT_TRUE(buffer.empty());
+        buffer.emplace_back(1);
+        buffer.emplace_back(2);
+        buffer.emplace_back(3);
+        EXPECT_THROW(buffer.emplace_back(4), std::length_error);
+    }
+
+    // archives are the same as of a queue over std::deque
+    auto save = [](const auto& q)
+    {
+        std::stringstream stream;
+        {
+            boost::archive::text_oarchive ar{stream};
+            ar << q;
+        }
+        return stream.str();
+    };
+    ring_queue_t ring_q;
+    deque_queue_t deque_q;
+    for(data_t v:{1, 3, 6})
+    {
+        EXPECT_TRUE(ring_q.push(v));
+        EXPECT_TRUE(deque_q.push(v));
+    }
+    data_t v {0};
+    EXPECT_TRUE(ring_q.pop(v));
+    EXPECT_TRUE(deque_q.pop(v));
+    EXPECT_TRUE(ring_q.push(12));
+    EXPECT_TRUE(deque_q.push(12));
+    EXPECT_EQ(save(ring_q), save(deque_q));
+
+    ring_queue_t loaded;
+    {
+        std::stringstream stream {save(deque_q)};
+        boost::archive::text_iarchive ar{stream};
+        ar >> loaded;
+    }
+    EXPECT_EQ(loaded, ring_q);
+}
+
+TEST(TEST_QUEUE, sharded_queue)
+{
+    using namespace threadsafe_containers;
+    using data_t = std::uint64_t;
+    using queue_t = ShardedQueue<data_t, 4>;
+
+    {
+        queue_t q {2};
+        EXPECT_EQ(q.num_of_shards(), 2);
+        EXPECT_EQ(q.max_size(), 8);
+        EXPECT_TRUE(q.empty());
+        // elements of one key go to one shard, other shards are used once it is full
+        for(data_t cntr {0}; cntr < 4; ++cntr)
+            EXPECT_TRUE(q.push_keyed(1, cntr));
+        EXPECT_FALSE(q.push_keyed(1, 100));
+        EXPECT_EQ(q.shard_size(0), 0);
+        EXPECT_EQ(q.shard_size(1), 4);
+        for(data_t cntr {4}; cntr < q.max_size(); ++cntr)
+            EXPECT_TRUE(q.push(cntr));
+        EXPECT_TRUE(q.full());
+        EXPECT_FALSE(q.push(100));
+        EXPECT_EQ(q.size(), 8);
+        q.clear();
+        EXPECT_TRUE(q.empty());
+        EXPECT_EQ(q.pop(), nullptr);
+    }
+
+    // a consumer whose shard is empty steals from the back of other shards
+    {
+        queue_t q {2};
+        for(data_t cntr {0}; cntr < 4; ++cntr)
+            EXPECT_TRUE(q.push_keyed(0, cntr));
+        std::vector<data_t> first, second;
+        std::jthread{[&q, &first]{ first.push_back(*q.try_pop()); first.push_back(*q.try_pop()); }}.join();
+        std::jthread{[&q, &second]{ second.push_back(*q.try_pop()); second.push_back(*q.try_pop()); }}.join();
+        EXPECT_EQ(first, (std::vector<data_t>{0, 1}));
+        EXPECT_EQ(second, (std::vector<data_t>{3, 2}));
+        EXPECT_TRUE(q.empty());
+    }
+
+    // a thread alternating between queues keeps it's shard in each of them
+    {
+        queue_t first {2};
+        queue_t second {2};
+        std::jthread{[&first, &second]
+        {
+            for(data_t cntr {0}; cntr < 4; ++cntr)
+            {
+                EXPECT_TRUE(first.push_local(cntr));
+                EXPECT_TRUE(second.push_local(cntr));
+            }
+        }}.join();
+        EXPECT_EQ(first.shard_size(0), 4);
+        EXPECT_EQ(second.shard_size(0), 4);
+    }
+
+    // multiple producers, multiple consumers: every element is dequeued exactly once
+    {
+        constexpr std::size_t num_of_threads {4};
+        constexpr data_t num_of_elements {10000};
+        queue_t q {num_of_threads};
+        std::atomic<data_t> sum {0};
+        std::atomic<data_t> popped {0};
+        {
+            std::vector<std::jthread> threads;
+            for(std::size_t cntr {0}; cntr < num_of_threads; ++cntr)
+            {
+                threads.emplace_back([&q, cntr]()
+                {
+                    for(data_t el {cntr}; el < num_of_elements; el += num_of_threads)
+                        q.wait_and_push(el);
+                });
+                threads.emplace_back([&q, &sum, &popped]()
+                {
+                    auto cond = [&popped](){ return popped.load() >= num_of_elements; };
+                    data_t el {0};
+                    while(!cond())
+                    {
+                        if(q.wait_and_pop(el, cond))
+                        {
+                            sum += el;
+                            ++popped;
+                        }
+                    }
+                });
+            }
+            while(popped < num_of_elements)
+                std::this_thread::yield();
+            for(std::size_t cntr {0}; cntr < num_of_threads; ++cntr)
+                q.wait_and_push(0);
+        }
+        EXPECT_EQ(sum, num_of_elements * (num_of_elements - 1) / 2);
+    }
+
+    // archives of Queue and ShardedQueue are interchangeable
+    {
+        Queue<data_t, 4> q;
+        EXPECT_TRUE(q.push(1));
+        EXPECT_TRUE(q.push(3));
+        EXPECT_TRUE(q.push(6));
+        std::stringstream stream;
+        {
+            boost::archive::text_oarchive ar{stream};
+            ar << q;
+        }
+        queue_t sq {3, 1};
+        {
+            boost::archive::text_iarchive ar{stream};
+            ar >> sq;
+        }
+        EXPECT_EQ(sq.size(), 3);
+        EXPECT_EQ(sq.shard_size(2), 1);
+        std::stringstream stream2;
+        {
+            boost::archive::text_oarchive ar{stream2};
+            ar << sq;
+        }
+        Queue<data_t, 4> newq;
+        {
+            boost::archive::text_iarchive ar{stream2};
+            ar >> newq;
+        }
+        EXPECT_EQ(newq, q);
+    }
+
+    // framework creates a shard per consumer
+    {
+        auto noop = [](auto&){};
+        producer_consumer::Framework<data_t, queue_t> framework {noop, 2, noop, 3, noop, 7};
+        EXPECT_FALSE(framework.spsc_mode());
+    }
+}
+
+TEST(TEST_QUEUE, priority_queue)
+{
+    using namespace threadsafe_containers;
+    using data_t = std::uint64_t;
+    using queue_t = PriorityQueue<data_t, 3, 4>;
+
+    {
+        queue_t q;
+        EXPECT_TRUE(q.empty());
+        EXPECT_EQ(q.max_size(), 12);
+        EXPECT_THROW((void)q.push(1, 3), std::out_of_range);
+        for(data_t cntr {0}; cntr < 4; ++cntr)
+            EXPECT_TRUE(q.push(cntr));
+        EXPECT_FALSE(q.push(100));
+        EXPECT_TRUE(q.push(10, 2));
+        EXPECT_TRUE(q.push(5, 1));
+        EXPECT_TRUE(q.push(11, 2));
+        EXPECT_EQ(q.size(), 7);
+        EXPECT_EQ(q.size(2), 2);
+        std::vector<data_t> popped;
+        while(auto v {q.try_pop()})
+            popped.push_back(*v);
+        EXPECT_EQ(popped, (std::vector<data_t>{10, 11, 5, 0, 1, 2, 3}));
+        EXPECT_EQ(q.pop(), nullptr);
+    }
+
+    // aging: the lowest level is served after two pops passed it over
+    {
+        queue_t q {8, 2};
+        for(data_t cntr {0}; cntr < 6; ++cntr)
+            EXPECT_TRUE(q.push(100 + cntr, 2));
+        EXPECT_TRUE(q.push(1));
+        EXPECT_TRUE(q.push(2));
+        std::vector<data_t> popped;
+        while(auto v {q.try_pop()})
+            popped.push_back(*v);
+        EXPECT_EQ(popped, (std::vector<data_t>{100, 101, 1, 102, 103, 2, 104, 105}));
+    }
+
+    // aging with three levels: the middle level is served in turn, it isn't starved by the lowest one
+    {
+        queue_t q {8, 2};
+        for(data_t cntr {0}; cntr < 8; ++cntr)
+            EXPECT_TRUE(q.push(200 + cntr, 2));
+        EXPECT_TRUE(q.push(10, 1));
+        EXPECT_TRUE(q.push(11, 1));
+        EXPECT_TRUE(q.push(0));
+        EXPECT_TRUE(q.push(1));
+        std::vector<data_t> popped;
+        while(auto v {q.try_pop()})
+            popped.push_back(*v);
+        EXPECT_EQ(popped, (std::vector<data_t>{200, 201, 10, 0, 202, 203, 11, 1, 204, 205, 206, 207}));
+    }
+
+    // a consumer waits for an element of any level, a producer waits for it's level
+    {
+        queue_t q {1};
+        EXPECT_TRUE(q.push(1, 1));
+        data_t v {0};
+        {
+            std::jthread producer {[&q]{ q.wait_and_push(2, 1); }};
+            std::jthread consumer {[&q, &v]{ q.wait_and_pop(v); }};
+        }
+        EXPECT_EQ(q.size(1), 1);
+        EXPECT_EQ(*q.pop(), v == 1 ? 2: 1);
+        EXPECT_FALSE(q.wait_and_pop(v, []{ return true; }));
+    }
+
+    // threads in wait_until_empty don't take the wakeup of a consumer
+    {
+        queue_t q;
+        std::vector<std::jthread> watchers;
+        for(std::size_t cntr {0}; cntr < 3; ++cntr)
+            watchers.emplace_back([&q]{ q.wait_until_empty(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::atomic_bool popped {false};
+        std::jthread consumer {[&q, &popped](std::stop_token stop_token)
+        {
+            data_t v {0};
+            popped = q.wait_and_pop(v, stop_token);
+        }};
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        EXPECT_TRUE(q.push(1));
+        watchers.clear();
+        for(std::size_t cntr {0}; cntr < 1000 && !popped; ++cntr)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        EXPECT_TRUE(popped);
+    }
+
+    {
+        queue_t q;
+        EXPECT_TRUE(q.push(1));
+        EXPECT_TRUE(q.push(3, 2));
+        EXPECT_TRUE(q.push(6, 1));
+        std::stringstream stream;
+        {
+            boost::archive::xml_oarchive ar{stream};
+            ar << BOOST_SERIALIZATION_NVP(q);
+        }
+        queue_t newq;
+        {
+            boost::archive::xml_iarchive ar{stream};
+            ar >> BOOST_SERIALIZATION_NVP(newq);
+        }
+        EXPECT_EQ(newq, q);
+        EXPECT_EQ(*newq.pop(), 3);
+        EXPECT_EQ(*newq.pop(), 6);
+        EXPECT_EQ(newq.size(), 1);
+    }
+}
+
+TEST(TEST_QUEUE, queue_stats)
+{
+    using namespace threadsafe_containers;
+    using data_t = std::uint64_t;
+    using queue_t = Queue<data_t, 4, BlockingWait, RingBuffer, QueueStats>;
+
+    queue_t q;
+    for(data_t cntr {0}; cntr < 4; ++cntr)
+        EXPECT_TRUE(q.push(cntr));
+    EXPECT_FALSE(q.push(100));
+    data_t v {0};
+    EXPECT_TRUE(q.pop(v));
+    std::vector<data_t> out;
+    EXPECT_EQ(q.try_pop_bulk(std::back_inserter(out), 2), 2);
+    auto stats {q.stats()};
+    EXPECT_EQ(stats.pushes, 4);
+    EXPECT_EQ(stats.pops, 3);
+    EXPECT_EQ(stats.failed_pushes, 1);
+    EXPECT_EQ(stats.max_depth, 4);
+    EXPECT_DOUBLE_EQ(stats.average_depth, 2.5);
+
+    // a consumer parked on empty queue is woken by a push
+    {
+        std::jthread consumer {[&q]
+        {
+            data_t el {0};
+            for(std::size_t cntr {0}; cntr < 2; ++cntr)
+                q.wait_and_pop(el);
+        }};
+        while(q.stats().pops < 4)
+            std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        EXPECT_TRUE(q.push(1));
+    }
+    stats = q.stats();
+    EXPECT_EQ(stats.pops, 5);
+    EXPECT_GE(stats.wakeups, 1);
+    EXPECT_GE(stats.useful_wakeups, 1);
+    EXPECT_LE(stats.useful_wakeups, stats.wakeups);
+    EXPECT_GE(stats.blocked_pop_time, std::chrono::milliseconds(10));
+
+    // a bulk push counts depth of each element, as single pushes do
+    {
+        queue_t bulk;
+        EXPECT_EQ(bulk.push_bulk(std::vector<data_t>{1, 2, 3, 4}), 4);
+        EXPECT_DOUBLE_EQ(bulk.stats().average_depth, 2.5);
+    }
+}
+
+TEST(TEST_QUEUE, thread_pool_executor)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    using clock = steady_clock;
+    using data_t = std::uint64_t;
+    static constexpr data_t num_of_elements {200000};
+    constexpr std::size_t capacity {1 << 18};
+    using queue_t = Queue<data_t>;
+    using framework_t = producer_consumer::Framework<data_t, queue_t>;
+
+    {
+        std::atomic<std::size_t> done {0};
+        {
+            producer_consumer::ThreadPool pool {2};
+            for(std::size_t cntr {0}; cntr < 100; ++cntr)
+                pool.submit([&pool, &done]{ pool.submit([&done]{ ++done; }); });
+        }
+        EXPECT_EQ(done, 100);
+    }
+
+    // steps, that have nothing to do, back off instead of polling queue
+    {
+        std::atomic<std::size_t> polls {0};
+        std::atomic<bool> consumed {false};
+        const auto start {clock::now()};
+        auto produce = [start](queue_t& queue)
+        {
+            if(clock::now() - start < milliseconds(50))
+                return true;
+            EXPECT_TRUE(queue.push(1));
+            return false;
+        };
+        auto consume = [&polls, &consumed](queue_t& queue)
+        {
+            ++polls;
+            if(queue.try_pop())
+                consumed = true;
+            return !consumed;
+        };
+        framework_t framework {produce, 1, consume, 4, [](queue_t&){}, 16};
+        framework.run();
+        EXPECT_TRUE(consumed);
+        EXPECT_LT(polls, 2000);
+    }
+
+    // the same work is done by thread per producer and consumer, and by pool tasks
+    auto bench = [](std::size_t num_of_producers, std::size_t num_of_consumers, bool executor)
+    {
+        std::atomic<data_t> next {0};
+        std::atomic<data_t> consumed {0};
+        std::atomic<data_t> sum {0};
+        std::atomic<std::size_t> finished {0};
+
+        auto produce = [&next](queue_t& queue)
+        {
+            for(std::size_t cntr {0}; cntr < 64; ++cntr)
+            {
+                const auto n {next++};
+                if(n >= num_of_elements)
+                    return false;
+                EXPECT_TRUE(queue.push(n));
+            }
+            return true;
+        };
+        auto consume = [&consumed, &sum](queue_t& queue)
+        {
+            for(std::size_t cntr {0}; cntr < 64; ++cntr)
+            {
+                auto v {queue.try_pop()};
+                if(!v)
+                    break;
+                sum += *v;
+                ++consumed;
+            }
+            return consumed < num_of_elements;
+        };
+        auto main_cycle = [&consumed](queue_t&)
+        {
+            while(consumed < num_of_elements)
+                std::this_thread::sleep_for(milliseconds(1));
+        };
+
+        const auto start {clock::now()};
+        if(executor)
+        {
+            framework_t framework {produce, num_of_producers, consume, num_of_consumers, [](queue_t&){}, capacity};
+            EXPECT_TRUE(framework.executor_mode());
+            framework.run();
+            EXPECT_EQ(consumed, num_of_elements);
+        }
+        else
+        {
+            auto producer = [&produce, &finished](queue_t& queue)
+            {
+                while(produce(queue))
+                    ;
+                ++finished;
+            };
+            auto consumer = [&consume, &finished](queue_t& queue)
+            {
+                while(consume(queue))
+                    std::this_thread::yield();
+                ++finished;
+            };
+            framework_t framework {producer, num_of_producers, consumer, num_of_consumers, main_cycle, capacity};
+            EXPECT_FALSE(framework.executor_mode());
+            framework.run();
+            framework.join();
+            EXPECT_EQ(finished, num_of_producers + num_of_consumers);
+        }
+        EXPECT_EQ(sum, num_of_elements * (num_of_elements - 1) / 2);
+        return duration_cast<milliseconds>(clock::now() - start);
+    };
+
+    for(std::size_t num_of_producers:{4, 256})
+    {
+        std::cout << num_of_producers << " producers, 4 consumers:"
+                  << " thread per role " << bench(num_of_producers, 4, false).count() << " ms,"
+                  << " thread pool of " << producer_consumer::ThreadPool::default_num_of_threads()
+                  << " workers " << bench(num_of_producers, 4, true).count() << " ms" << std::endl;
+    }
+}
+
+/// \brief Framework stops consumers of \b Queue, that don't take a stop token, by closing it.
+template<typename Queue> void check_legacy_consumers()
+{
+    using data_t = typename Queue::value_type;
+    std::atomic<data_t> produced {0};
+    std::atomic<data_t> consumed {0};
+    auto producer = [&produced](std::stop_token stop_token, Queue& queue)
+    {
+        while(queue.wait_and_push(produced.load(), stop_token))
+            ++produced;
+    };
+    auto legacy_consumer = [&consumed](Queue& queue)
+    {
+        data_t el {0};
+        while(true)
+        {
+            queue.wait_and_pop(el);
+            ++consumed;
+        }
+    };
+    auto wait_for_work = [&consumed](Queue&)
+    {
+        while(consumed < 1000)
+            std::this_thread::yield();
+    };
+    {
+        producer_consumer::Framework<data_t, Queue> framework {producer, 2, legacy_consumer, 2, wait_for_work};
+        framework.run();
+    }
+    EXPECT_EQ(consumed, produced);
+
+    Queue queue;
+    queue.close();
+    EXPECT_TRUE(queue.closed());
+    data_t el {0};
+    EXPECT_THROW(queue.wait_and_pop(el), threadsafe_containers::QueueClosed);
+    EXPECT_FALSE(queue.wait_and_pop(el, std::stop_token{}));
+    queue.open();
+    EXPECT_FALSE(queue.closed());
+}
+
+TEST(TEST_QUEUE, framework_stop)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    using namespace producer_consumer;
+    using clock = steady_clock;
+    using data_t = std::uint64_t;
+    using queue_t = Queue<data_t>;
+
+    std::atomic<data_t> produced {0};
+    std::atomic<data_t> consumed {0};
+    std::atomic<int> running {0};
+    auto producer = [&produced, &running](std::stop_token stop_token, queue_t& queue)
+    {
+        ++running;
+        while(queue.wait_and_push(produced.load(), stop_token))
+            ++produced;
+        --running;
+    };
+    auto consumer = [&consumed, &running](std::stop_token stop_token, queue_t& queue)
+    {
+        ++running;
+        data_t el {0};
+        while(queue.wait_and_pop(el, stop_token))
+            ++consumed;
+        --running;
+    };
+    auto wait_for_work = [&consumed](queue_t&)
+    {
+        while(consumed < 1000)
+            std::this_thread::yield();
+    };
+
+    // drain: every produced element is consumed, threads of a previous run are not leaked
+    {
+        Framework<data_t> framework {producer, 2, consumer, 2, wait_for_work, 16};
+        EXPECT_FALSE(framework.spsc_mode());
+        for(std::size_t cntr {0}; cntr < 2; ++cntr)
+        {
+            consumed = 0;
+            produced = 0;
+            framework.run();
+            const auto start {clock::now()};
+            framework.stop(StopPolicy::drain);
+            std::cout << "drain stop took " << duration_cast<microseconds>(clock::now() - start).count() << " us" << std::endl;
+            EXPECT_EQ(running, 0);
+            EXPECT_EQ(consumed, produced);
+        }
+    }
+
+    // abandon: elements left in queue are dropped
+    {
+        auto stalled_consumer = [&running](std::stop_token stop_token, queue_t&)
+        {
+            ++running;
+            std::mutex mutex;
+            std::condition_variable_any cv;
+            std::unique_lock lk {mutex};
+            cv.wait(lk, stop_token, []{ return false; });
+            --running;
+        };
+        auto wait_for_full = [](queue_t& queue)
+        {
+            while(!queue.full())
+                std::this_thread::yield();
+        };
+        produced = 0;
+        Framework<data_t> framework {producer, 2, stalled_consumer, 1, wait_for_full, 16};
+        framework.run();
+        framework.stop(StopPolicy::abandon);
+        EXPECT_EQ(running, 0);
+        EXPECT_EQ(produced, 16);
+    }
+
+    // join wakes as soon as producers and consumers are done
+    {
+        auto once = [](queue_t& queue){ queue.wait_and_push(1); };
+        auto consume_once = [&consumed](queue_t& queue){ (void)queue.wait_and_pop(); ++consumed; };
+        consumed = 0;
+        Framework<data_t> framework {once, 3, consume_once, 3, [](queue_t&){}};
+        framework.run();
+        framework.join();
+        EXPECT_EQ(consumed, 3);
+    }
+
+    // consumers without a stop token are woken by closing queue once it's drained
+    {
+        auto legacy_consumer = [&consumed](queue_t& queue)
+        {
+            data_t el {0};
+            while(true)
+            {
+                queue.wait_and_pop(el);
+                ++consumed;
+            }
+        };
+        auto spsc_consumer = [&consumed](auto& queue)
+        {
+            data_t el {0};
+            while(true)
+            {
+                queue.wait_and_pop(el);
+                ++consumed;
+            }
+        };
+        auto spsc_producer = [&produced](std::stop_token stop_token, auto& queue)
+        {
+            while(queue.wait_and_push(produced.load(), stop_token))
+                ++produced;
+        };
+        auto spsc_wait_for_work = [&consumed](auto&)
+        {
+            while(consumed < 1000)
+                std::this_thread::yield();
+        };
+        for(std::size_t cntr {0}; cntr < 2; ++cntr)
+        {
+            consumed = 0;
+            produced = 0;
+            {
+                Framework<data_t> framework {producer, 2, legacy_consumer, 2, wait_for_work, 16};
+                framework.run();
+            }
+            EXPECT_EQ(running, 0);
+            EXPECT_EQ(consumed, produced);
+        }
+        consumed = 0;
+        produced = 0;
+        Framework<data_t> framework {spsc_producer, 1, spsc_consumer, 1, spsc_wait_for_work, 16};
+        EXPECT_TRUE(framework.spsc_mode());
+        framework.run();
+        framework.stop();
+        EXPECT_EQ(consumed, produced);
+        consumed = 0;
+        produced = 0;
+        framework.run();
+        framework.stop();
+        EXPECT_EQ(consumed, produced);
+
+        check_legacy_consumers<LockFreeQueue<data_t, 16>>();
+        check_legacy_consumers<ShardedQueue<data_t, 16>>();
+        check_legacy_consumers<PriorityQueue<data_t, 2, 16>>();
+        check_legacy_consumers<ClientAffinityQueue<data_t, 16>>();
+    }
+
+    // closed queue: blocking waits throw once queue is drained, others return
+    {
+        queue_t queue {2};
+        EXPECT_TRUE(queue.push(1));
+        queue.close();
+        EXPECT_TRUE(queue.closed());
+        data_t el {0};
+        queue.wait_and_pop(el);
+        EXPECT_EQ(el, 1);
+        EXPECT_THROW(queue.wait_and_pop(el), QueueClosed);
+        EXPECT_FALSE(queue.wait_and_pop(el, std::stop_token{}));
+        queue.wait_and_push(2);
+        queue.wait_and_push(3);
+        EXPECT_THROW(queue.wait_and_push(4), QueueClosed);
+        queue.open();
+        EXPECT_FALSE(queue.closed());
+        std::jthread closer {[&queue]{ std::this_thread::sleep_for(10ms); queue.close(); }};
+        EXPECT_THROW(queue.wait_until_full(), QueueClosed);
+    }
+
+    // executor mode: endless steps are stopped from main cycle
+    {
+        Framework<data_t>* framework_ptr {nullptr};
+        auto produce = [](queue_t& queue){ (void)queue.push(1); return true; };
+        auto consume = [&consumed](queue_t& queue){ if(queue.try_pop()) ++consumed; return true; };
+        auto main_cycle = [&framework_ptr, &wait_for_work](queue_t& queue)
+        {
+            wait_for_work(queue);
+            framework_ptr->stop();
+            EXPECT_TRUE(queue.empty());
+        };
+        consumed = 0;
+        Framework<data_t> framework {produce, 4, consume, 2, main_cycle};
+        framework_ptr = &framework;
+        EXPECT_TRUE(framework.executor_mode());
+        framework.run();
+    }
+}
+
+TEST(TEST_QUEUE, client_affinity_queue)
+{
+    using namespace threadsafe_containers;
+    using data_t = std::uint64_t;
+    // element is a query of client el / 1000
+    struct ClientOf
+    {
+        std::size_t operator()(data_t el) const noexcept
+        {
+            return el / 1000;
+        }
+    };
+    using queue_t = ClientAffinityQueue<data_t, 8, 2, ClientOf>;
+
+    // a client is served by one consumer, a consumer serves two clients at most
+    {
+        queue_t q {2};
+        EXPECT_TRUE(q.push(0));
+        EXPECT_TRUE(q.push(2001));
+        EXPECT_EQ(q.shard_of(0), 0);
+        EXPECT_EQ(q.shard_of(2), 0);
+        // shard 0 serves two clients already, client 4 is moved to shard 1
+        EXPECT_TRUE(q.push(4002));
+        EXPECT_EQ(q.shard_of(4), 1);
+        EXPECT_TRUE(q.push(1003));
+        EXPECT_EQ(q.num_of_clients(1), 2);
+        // both consumers saturated
+        EXPECT_FALSE(q.push(3004));
+        EXPECT_TRUE(q.push(5));
+        EXPECT_EQ(q.size(), 5);
+
+        std::vector<data_t> first;
+        std::jthread{[&q, &first]
+        {
+            while(auto el {q.try_pop()})
+                first.push_back(*el);
+        }}.join();
+        EXPECT_EQ(first, (std::vector<data_t>{0, 2001, 5}));
+        // client of the last popped element is released on the next pop
+        EXPECT_EQ(q.num_of_clients(0), 0);
+        EXPECT_TRUE(q.push(3004));
+        EXPECT_EQ(q.shard_of(3), 0);
+    }
+
+    // a thread alternating between queues keeps it's shard in each of them
+    {
+        queue_t first {2};
+        queue_t second {2};
+        for(auto* q:{&first, &second})
+        {
+            EXPECT_TRUE(q->push(0));
+            EXPECT_TRUE(q->push(2001));
+            EXPECT_TRUE(q->push(4002));
+            EXPECT_EQ(q->shard_of(4), 1);
+        }
+        std::vector<data_t> popped;
+        std::jthread{[&first, &second, &popped]
+        {
+            for(std::size_t cntr {0}; cntr < 2; ++cntr)
+            {
+                popped.push_back(*first.try_pop());
+                popped.push_back(*second.try_pop());
+            }
+        }}.join();
+        EXPECT_EQ(popped, (std::vector<data_t>{0, 0, 2001, 2001}));
+    }
+
+    // a waiting client of a full shard is moved with it's elements to a consumer with room
+    {
+        queue_t q {2};
+        for(data_t cntr {0}; cntr < 4; ++cntr)
+        {
+            EXPECT_TRUE(q.push(2000 + cntr));
+            EXPECT_TRUE(q.push(cntr));
+        }
+        // consumer of shard 0 handles an element of client 2
+        std::jthread{[&q]{ EXPECT_EQ(*q.pop(), 2000); }}.join();
+        EXPECT_TRUE(q.push(4));
+        // client 2 isn't moved while it's consumer handles it's element
+        EXPECT_FALSE(q.push(2004));
+        EXPECT_TRUE(q.push(5));
+        EXPECT_EQ(q.shard_of(0), 1);
+        EXPECT_EQ(q.shard_size(0), 3);
+        EXPECT_EQ(q.shard_size(1), 6);
+        EXPECT_EQ(q.num_of_clients(0), 1);
+        EXPECT_EQ(q.num_of_clients(1), 1);
+        EXPECT_TRUE(q.push(2004));
+        EXPECT_EQ(q.size(), 10);
+
+        std::vector<data_t> second;
+        std::jthread{[&q, &second]
+        {
+            while(auto el {q.try_pop()})
+                second.push_back(*el);
+        }}.join();
+        EXPECT_EQ(second, (std::vector<data_t>{0, 1, 2, 3, 4, 5}));
+        std::vector<data_t> first;
+        std::jthread{[&q, &first]
+        {
+            while(auto el {q.try_pop()})
+                first.push_back(*el);
+        }}.join();
+        EXPECT_EQ(first, (std::vector<data_t>{2001, 2002, 2003, 2004}));
+        EXPECT_TRUE(q.empty());
+    }
+
+    // per-client FIFO with multiple producers and consumers
+    {
+        constexpr std::size_t num_of_consumers {4};
+        constexpr std::size_t num_of_clients {16};
+        constexpr data_t per_client {500};
+        queue_t q {num_of_consumers};
+        // next element of a client, a client may move between consumers when it has no elements
+        std::array<std::atomic<data_t>, num_of_clients> next {};
+        std::atomic<data_t> consumed {0};
+        std::atomic_bool order_kept {true};
+        {
+            std::vector<std::jthread> consumers;
+            for(std::size_t cntr {0}; cntr < num_of_consumers; ++cntr)
+            {
+                consumers.emplace_back([&q, &next, &consumed, &order_kept](std::stop_token stop_token)
+                {
+                    data_t el {0};
+                    while(q.wait_and_pop(el, stop_token))
+                    {
+                        if(next[el / 1000]++ != el % 1000)
+                            order_kept = false;
+                        ++consumed;
+                    }
+                });
+            }
+            std::vector<std::jthread> producers;
+            for(std::size_t client {0}; client < num_of_clients; ++client)
+            {
+                producers.emplace_back([&q, client]
+                {
+                    for(data_t cntr {0}; cntr < per_client; ++cntr)
+                        q.wait_and_push(client * 1000 + cntr);
+                });
+            }
+            producers.clear();
+            while(consumed < num_of_clients * per_client)
+                std::this_thread::yield();
+        }
+        EXPECT_TRUE(order_kept);
+        EXPECT_TRUE(q.empty());
+    }
+
+    // archives of Queue and ClientAffinityQueue are interchangeable
+    {
+        Queue<data_t, 4> q;
+        EXPECT_TRUE(q.push(1));
+        EXPECT_TRUE(q.push(1003));
+        EXPECT_TRUE(q.push(6));
+        std::stringstream stream;
+        {
+            boost::archive::text_oarchive ar{stream};
+            ar << q;
+        }
+        queue_t cq {2};
+        {
+            boost::archive::text_iarchive ar{stream};
+            ar >> cq;
+        }
+        EXPECT_EQ(cq.size(), 3);
+        EXPECT_EQ(cq.shard_of(1), 1);
+        EXPECT_EQ(cq.shard_size(0), 2);
+    }
+
+    // framework creates a shard per consumer
+    {
+        std::atomic<data_t> consumed {0};
+        auto producer = [](queue_t& queue)
+        {
+            for(data_t cntr {0}; cntr < 100; ++cntr)
+                queue.wait_and_push(cntr % 10 * 1000 + cntr);
+        };
+        auto consumer = [&consumed](std::stop_token stop_token, queue_t& queue)
+        {
+            data_t el {0};
+            while(queue.wait_and_pop(el, stop_token))
+                ++consumed;
+        };
+        producer_consumer::Framework<data_t, queue_t> framework {producer, 2, consumer, 3, [](queue_t&){}};
+        framework.run();
+        framework.stop();
+        EXPECT_EQ(consumed, 200);
+    }
+}
+
+TEST(TEST_QUEUE, cpu_affinity)
+{
+#if !defined(__linux__)
+    GTEST_SKIP() << "CPU affinity and NUMA placement are supported on Linux only";
+#else
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    using data_t = std::uint64_t;
+    static constexpr data_t num_of_elements {200000};
+    using queue_t = Queue<data_t, 1024>;
+    using framework_t = producer_consumer::Framework<data_t, queue_t>;
+
+    const auto num_of_cpus {std::max(std::thread::hardware_concurrency(), 1u)};
+    auto socket_of = [](unsigned cpu)
+    {
+        std::ifstream file {"/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/physical_package_id"};
+        int socket {0};
+        file >> socket;
+        return socket;
+    };
+
+    // producer and consumer are pinned to a CPU each, queue is on the node of the consumer
+    auto bench = [](unsigned producer_cpu, unsigned consumer_cpu)
+    {
+        std::atomic<data_t> sum {0};
+        std::atomic<bool> pinned {true};
+        auto producer = [&pinned, producer_cpu](queue_t& queue)
+        {
+            pinned = pinned && sched_getcpu() == static_cast<int>(producer_cpu);
+            for(data_t cntr {0}; cntr < num_of_elements; ++cntr)
+                queue.wait_and_push(cntr);
+        };
+        auto consumer = [&sum, &pinned, consumer_cpu](queue_t& queue)
+        {
+            pinned = pinned && sched_getcpu() == static_cast<int>(consumer_cpu);
+            data_t local_sum {0};
+            for(data_t cntr {0}; cntr < num_of_elements; ++cntr)
+                local_sum += *queue.wait_and_pop();
+            sum = local_sum;
+        };
+
+        framework_t framework {producer, 1, consumer, 1, [](queue_t&){}};
+        framework.set_placement({{producer_cpu}, {consumer_cpu}, true, true});
+        const auto start {steady_clock::now()};
+        framework.run();
+        framework.join();
+        const auto time {duration_cast<milliseconds>(steady_clock::now() - start)};
+        EXPECT_TRUE(pinned);
+        EXPECT_EQ(sum, num_of_elements * (num_of_elements - 1) / 2);
+        return time;
+    };
+
+    const unsigned first {0};
+    std::optional<unsigned> same_socket;
+    std::optional<unsigned> other_socket;
+    for(unsigned cpu {1}; cpu < num_of_cpus; ++cpu)
+    {
+        auto& found {socket_of(cpu) == socket_of(first) ? same_socket : other_socket};
+        if(!found)
+            found = cpu;
+    }
+
+    std::cout << "same CPU " << bench(first, first).count() << " ms";
+    if(same_socket)
+        std::cout << ", same socket " << bench(first, *same_socket).count() << " ms";
+    if(other_socket)
+        std::cout << ", cross socket " << bench(first, *other_socket).count() << " ms";
+    else
+        std::cout << ", cross socket skipped: single socket";
+    std::cout << std::endl;
+
+    // only whole pages of a range are moved, so memory sharing a page with it stays in place
+    {
+        data_t local {0};
+        EXPECT_FALSE(bind_memory_to_node(&local, sizeof(local), current_numa_node()));
+        RingBuffer<data_t> small {8};
+        EXPECT_FALSE(small.bind_to_numa_node(current_numa_node()));
+        RingBuffer<data_t> large {page_size() / sizeof(data_t) + 1};
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(large.data()) % page_size(), 0);
+    }
+#endif
+}
+
+TEST(TEST_QUEUE, coroutine_consumers)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    using data_t = std::uint64_t;
+    static constexpr data_t num_of_elements {100000};
+    using queue_t = Queue<data_t, 64>;
+    using framework_t = producer_consumer::Framework<data_t, queue_t>;
+
+    {
+        // coroutine producers and consumers wait on a small queue, so both of them are suspended
+        queue_t queue;
+        std::atomic<data_t> sum {0};
+        std::atomic<std::size_t> done {0};
+        std::atomic<bool> threw {false};
+        constexpr std::size_t num_of_coroutines {8};
+        constexpr data_t per_coroutine {1000};
+        auto producer = [&queue, &done]() -> Task
+        {
+            for(data_t cntr {0}; cntr < per_coroutine; ++cntr)
+                co_await queue.async_push(cntr);
+            ++done;
+            done.notify_all();
+        };
+        auto consumer = [&queue, &sum, &done, &threw]() -> Task
+        {
+            try
+            {
+                static_cast<void>(co_await queue.async_pop(nullptr));
+            }
+            catch(const std::logic_error&)
+            {
+                threw = true;
+            }
+            for(data_t cntr {0}; cntr < per_coroutine; ++cntr)
+                sum += co_await queue.async_pop();
+            ++done;
+            done.notify_all();
+        };
+        {
+            producer_consumer::ThreadPool pool {2, 2 * num_of_coroutines};
+            for(std::size_t cntr {0}; cntr < num_of_coroutines; ++cntr)
+            {
+                consumer().start(pool);
+                producer().start(pool);
+            }
+            for(auto n {done.load()}; n < 2 * num_of_coroutines; n = done.load())
+                done.wait(n);
+        }
+        EXPECT_TRUE(threw);
+        EXPECT_TRUE(queue.empty());
+        EXPECT_EQ(sum, num_of_coroutines * per_coroutine * (per_coroutine - 1) / 2);
+    }
+
+    {
+        // stop wakes waiting coroutines, but elements left in queue are still dequeued
+        queue_t queue;
+        std::stop_source stop_source;
+        std::atomic<bool> finished {false};
+        data_t popped {0};
+        bool pushed {false};
+        auto consumer = [&]() -> Task
+        {
+            while(auto v {co_await queue.async_pop(stop_source.get_token())})
+                ++popped;
+            // there is space, so the push doesn't wait and isn't cancelled
+            pushed = co_await queue.async_push(3, stop_source.get_token());
+            finished = true;
+            finished.notify_all();
+        };
+        producer_consumer::ThreadPool pool {1};
+        EXPECT_TRUE(queue.push(1));
+        EXPECT_TRUE(queue.push(2));
+        consumer().start(pool);
+        std::this_thread::sleep_for(milliseconds(10));
+        EXPECT_FALSE(finished);
+        stop_source.request_stop();
+        finished.wait(false);
+        EXPECT_EQ(popped, 2);
+        EXPECT_TRUE(pushed);
+        EXPECT_EQ(*queue.try_pop(), 3);
+    }
+
+    {
+        // coroutines are scheduled after the queue lock is released, so a scheduler may use the queue,
+        // e.g. a thread pool that blocks on it's full queue while it's workers wait for this one
+        struct LockProbe: Scheduler
+        {
+            explicit LockProbe(queue_t& queue):
+                m_queue{queue}
+            {}
+
+            void schedule(std::coroutine_handle<> handle) override
+            {
+                // the probe is detached, so a locked queue fails the test instead of hanging it
+                auto probed {std::make_shared<std::atomic<bool>>(false)};
+                std::thread{[this, probed]{ static_cast<void>(m_queue.empty()); *probed = true; }}.detach();
+                const auto deadline {steady_clock::now() + seconds(1)};
+                while(!*probed && steady_clock::now() < deadline)
+                    std::this_thread::sleep_for(milliseconds(1));
+                m_unlocked = m_unlocked && *probed;
+                m_handles.push_back(handle);
+            }
+
+            queue_t& m_queue;
+            bool m_unlocked {true};
+            std::vector<std::coroutine_handle<>> m_handles;
+        };
+        queue_t queue;
+        LockProbe scheduler {queue};
+        data_t popped {0};
+        auto consumer = [&]() -> Task
+        {
+            popped = co_await queue.async_pop(&scheduler);
+        };
+        consumer().start(scheduler);
+        scheduler.m_handles.back().resume();
+        EXPECT_TRUE(queue.push(5));
+        ASSERT_EQ(scheduler.m_handles.size(), 2);
+        scheduler.m_handles.back().resume();
+        EXPECT_EQ(popped, 5);
+        EXPECT_TRUE(scheduler.m_unlocked);
+    }
+
+    {
+        // stop, that is requested after a coroutine is served but before it's scheduled, doesn't cancel it
+        struct StopOnSchedule: Scheduler
+        {
+            void schedule(std::coroutine_handle<> handle) override
+            {
+                m_handles.push_back(handle);
+                if(m_stop_source)
+                    m_stop_source->request_stop();
+            }
+
+            std::stop_source* m_stop_source {nullptr};
+            std::vector<std::coroutine_handle<>> m_handles;
+        };
+        queue_t queue;
+        StopOnSchedule scheduler;
+        std::array<std::stop_source, 2> stop_sources;
+        std::array<std::optional<data_t>, 2> popped;
+        auto consumer = [&](std::size_t n) -> Task
+        {
+            popped[n] = co_await queue.async_pop(stop_sources[n].get_token(), &scheduler);
+        };
+        consumer(0).start(scheduler);
+        consumer(1).start(scheduler);
+        for(auto handle:std::exchange(scheduler.m_handles, {}))
+            handle.resume();
+        scheduler.m_stop_source = &stop_sources[1];
+        static_cast<void>(queue.push_bulk(std::array<data_t, 2>{7, 8}));
+        ASSERT_EQ(scheduler.m_handles.size(), 2);
+        for(auto handle:scheduler.m_handles)
+            handle.resume();
+        EXPECT_EQ(popped[0], 7);
+        EXPECT_EQ(popped[1], 8);
+    }
+
+    // a consumer per client: thousands of consumers are suspended frames on a few threads
+    for(std::size_t num_of_consumers:{16, 4096})
+    {
+        std::atomic<data_t> consumed {0};
+        std::atomic<data_t> sum {0};
+        auto producer = [](std::stop_token stop_token, queue_t& queue)
+        {
+            for(data_t cntr {0}; cntr < num_of_elements / 2 && !stop_token.stop_requested(); ++cntr)
+                EXPECT_TRUE(queue.wait_and_push(cntr, stop_token));
+        };
+        auto consumer = [&consumed, &sum](std::stop_token stop_token, queue_t& queue) -> Task
+        {
+            while(auto v {co_await queue.async_pop(stop_token)})
+            {
+                sum += *v;
+                ++consumed;
+            }
+        };
+        auto main_cycle = [&consumed](queue_t&)
+        {
+            while(consumed < num_of_elements)
+                std::this_thread::sleep_for(milliseconds(1));
+        };
+
+        const auto start {steady_clock::now()};
+        framework_t framework {producer, 2, consumer, num_of_consumers, main_cycle};
+        EXPECT_TRUE(framework.coroutine_mode());
+        EXPECT_FALSE(framework.executor_mode());
+        framework.set_num_of_workers(2);
+        framework.run();
+        framework.stop();
+        EXPECT_EQ(consumed, num_of_elements);
+        EXPECT_EQ(sum, num_of_elements * (num_of_elements / 2 - 1) / 2);
+        std::cout << num_of_consumers << " coroutine consumers on 2 threads: "
+                  << duration_cast<milliseconds>(steady_clock::now() - start).count() << " ms" << std::endl;
+    }
+}
+
+TEST(TEST_QUEUE, autoscaling)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    using data_t = std::uint64_t;
+    static constexpr data_t num_of_elements {1000};
+    using queue_t = Queue<data_t, 2048, BlockingWait, RingBuffer, QueueStats>;
+    using framework_t = producer_consumer::Framework<data_t, queue_t>;
+
+    std::atomic<data_t> consumed {0};
+    std::atomic<std::size_t> running {0};
+    std::atomic<std::size_t> max_running {0};
+
+    // a burst, that backs queue up, then queue is idle
+    auto producer = [](std::stop_token stop_token, queue_t& queue)
+    {
+        for(data_t cntr {0}; cntr < num_of_elements; ++cntr)
+            EXPECT_TRUE(queue.wait_and_push(cntr, stop_token));
+    };
+    auto consumer = [&](std::stop_token stop_token, queue_t& queue)
+    {
+        const auto n {++running};
+        for(auto max {max_running.load()}; n > max && !max_running.compare_exchange_weak(max, n);)
+            ;
+        data_t v;
+        while(queue.wait_and_pop(v, stop_token))
+        {
+            std::this_thread::sleep_for(microseconds(200));
+            ++consumed;
+        }
+        --running;
+    };
+
+    framework_t framework {producer, 1, consumer, 1, [](queue_t&){}};
+    producer_consumer::Autoscaling autoscaling;
+    autoscaling.min_consumers = 1;
+    autoscaling.max_consumers = 4;
+    autoscaling.scale_up_depth = 100;
+    autoscaling.scale_up_latency = milliseconds(50);
+    autoscaling.scale_down_depth = 0;
+    autoscaling.sample_interval = milliseconds(2);
+    autoscaling.samples_to_scale = 2;
+    framework.set_autoscaling(autoscaling);
+    framework.run();
+
+    const auto deadline {steady_clock::now() + seconds(10)};
+    while(consumed < num_of_elements && steady_clock::now() < deadline)
+        std::this_thread::sleep_for(milliseconds(1));
+    EXPECT_EQ(consumed, num_of_elements);
+    while(framework.scaling_stats().num_of_consumers > 1 && steady_clock::now() < deadline)
+        std::this_thread::sleep_for(milliseconds(1));
+
+    const auto stats {framework.scaling_stats()};
+    EXPECT_EQ(stats.num_of_consumers, 1);
+    EXPECT_GE(stats.scale_ups, 1);
+    EXPECT_EQ(stats.scale_downs, stats.scale_ups);
+    EXPECT_EQ(stats.depth, 0);
+    EXPECT_EQ(stats.latency, nanoseconds{0});
+    EXPECT_LE(max_running, autoscaling.max_consumers);
+    EXPECT_GT(max_running, 1);
+    framework.stop();
+    EXPECT_EQ(running, 0);
+    std::cout << "scaled up " << stats.scale_ups << " times to " << max_running << " consumers" << std::endl;
+
+    // a stalled consumer makes latency unbounded, it doesn't scale up unless a latency threshold is set
+    std::atomic_bool stalled {true};
+    auto stalled_consumer = [&stalled](std::stop_token, queue_t& queue)
+    {
+        while(stalled)
+            std::this_thread::sleep_for(milliseconds(1));
+        queue.clear();
+    };
+    framework_t stalled_framework {producer, 1, stalled_consumer, 1, [](queue_t&){}};
+    autoscaling.scale_up_depth = 2 * num_of_elements;
+    autoscaling.scale_up_latency.reset();
+    stalled_framework.set_autoscaling(autoscaling);
+    stalled_framework.run();
+    std::this_thread::sleep_for(milliseconds(50));
+    EXPECT_GT(stalled_framework.scaling_stats().depth, 0);
+    EXPECT_EQ(stalled_framework.scaling_stats().scale_ups, 0);
+    stalled = false;
+    stalled_framework.stop();
+}
+
+TEST(TEST_QUEUE, pipeline)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    using producer_consumer::PipelineBuilder;
+    static constexpr std::uint64_t num_of_requests {20000};
+
+    auto parse = [](const std::string& request){ return std::stoull(request); };
+    auto plan = [](std::uint64_t query){ return query * 2; };
+    auto execute = [](std::uint64_t plan){ return static_cast<std::int64_t>(plan + 1); };
+
+    // parse -> plan -> execute -> respond, plan and execute are fused or queued
+    auto bench = [&](bool fused)
+    {
+        std::atomic<std::uint64_t> responses {0};
+        std::atomic<std::int64_t> sum {0};
+        auto respond = [&](std::int64_t result)
+        {
+            sum += result;
+            ++responses;
+        };
+
+        const auto start {steady_clock::now()};
+        std::vector<producer_consumer::StageStats> stats;
+        {
+            auto planned {PipelineBuilder<std::string>{}.stage("parse", parse, 2, 64)};
+            auto pipeline {fused ? std::move(planned).fuse("plan", plan).fuse("execute", execute)
+                                                     .stage("respond", respond, 1, 16).build()
+                                 : std::move(planned).stage("plan", plan, 1, 64)
+                                                     .template stage<LockFreeQueue<std::uint64_t, 64>>("execute", execute, 2)
+                                                     .stage("respond", respond, 1, 16).build()};
+            for(std::uint64_t cntr {0}; cntr < num_of_requests; ++cntr)
+                pipeline.push(std::to_string(cntr));
+            pipeline.stop();
+            stats = pipeline.stats();
+        }
+        const auto time {duration_cast<milliseconds>(steady_clock::now() - start)};
+
+        EXPECT_EQ(responses, num_of_requests);
+        EXPECT_EQ(sum, static_cast<std::int64_t>(num_of_requests * num_of_requests));
+        EXPECT_EQ(stats.size(), 4);
+        const std::vector<std::string> names {"parse", "plan", "execute", "respond"};
+        for(std::size_t cntr {0}; cntr < stats.size(); ++cntr)
+        {
+            EXPECT_EQ(stats[cntr].name, names[cntr]);
+            EXPECT_EQ(stats[cntr].processed, num_of_requests);
+            EXPECT_EQ(stats[cntr].depth, 0);
+            EXPECT_GT(stats[cntr].throughput, 0);
+            EXPECT_LE(stats[cntr].average_latency, stats[cntr].max_latency);
+        }
+        EXPECT_EQ(stats[0].num_of_threads, 2);
+        EXPECT_EQ(stats[1].num_of_threads, fused ? 0 : 1);
+        EXPECT_EQ(stats[2].num_of_threads, fused ? 0 : 2);
+        return time;
+    };
+
+    std::cout << "4 stages: queued " << bench(false).count() << " ms, plan and execute fused "
+              << bench(true).count() << " ms" << std::endl;
+
+    EXPECT_THROW(static_cast<void>(PipelineBuilder<int>{}.fuse("first", [](int v){ return v; })), std::logic_error);
+}
+
+TEST(TEST_QUEUE, inline_framework)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    using data_t = std::uint64_t;
+    static constexpr data_t num_of_elements {200000};
+    using queue_t = Queue<data_t, 1024>;
+
+    // the same tiny per item consumer run by std::function and by inlined callables
+    auto bench = [](auto make)
+    {
+        std::atomic<data_t> sum {0};
+        std::atomic<data_t> consumed {0};
+        auto producer = [](std::stop_token stop_token, queue_t& queue)
+        {
+            for(data_t cntr {0}; cntr < num_of_elements && !stop_token.stop_requested(); ++cntr)
+                static_cast<void>(queue.wait_and_push(cntr, stop_token));
+        };
+        auto consumer = [&sum, &consumed](std::stop_token stop_token, queue_t& queue)
+        {
+            data_t v;
+            while(queue.wait_and_pop(v, stop_token))
+            {
+                sum.fetch_add(v, std::memory_order_relaxed);
+                consumed.fetch_add(1, std::memory_order_relaxed);
+            }
+        };
+        auto main_cycle = [&consumed](queue_t&)
+        {
+            while(consumed < num_of_elements)
+                std::this_thread::sleep_for(microseconds(100));
+        };
+
+        const auto start {steady_clock::now()};
+        {
+            auto framework {make(producer, consumer, main_cycle)};
+            framework->run();
+            framework->stop();
+        }
+        const auto time {duration_cast<milliseconds>(steady_clock::now() - start)};
+        EXPECT_EQ(consumed, num_of_elements);
+        EXPECT_EQ(sum, num_of_elements * (num_of_elements - 1) / 2);
+        return time;
+    };
+
+    const auto erased {bench([](auto producer, auto consumer, auto main_cycle)
+    {
+        return std::make_unique<producer_consumer::Framework<data_t, queue_t>>(producer, 1, consumer, 1, main_cycle);
+    })};
+    const auto inlined {bench([](auto producer, auto consumer, auto main_cycle)
+    {
+        using framework_t = producer_consumer::InlineFramework<queue_t, decltype(producer), decltype(consumer), decltype(main_cycle)>;
+        return std::make_unique<framework_t>(producer, 1, consumer, 1, main_cycle);
+    })};
+    std::cout << "std::function " << erased.count() << " ms, inlined callables " << inlined.count() << " ms" << std::endl;
+
+    {
+        std::atomic<std::size_t> done {0};
+        auto framework {producer_consumer::make_framework<LockFreeQueue<data_t, 64>>(
+            [&done](LockFreeQueue<data_t, 64>&){ ++done; }, 2,
+            [&done](std::stop_token, LockFreeQueue<data_t, 64>&){ ++done; }, 3,
+            [](LockFreeQueue<data_t, 64>&){})};
+        framework.run();
+        framework.join();
+        EXPECT_EQ(done, 5);
+    }
+
+    // a consumer without a stop token doesn't block stop
+    {
+        std::atomic<std::size_t> popped {0};
+        auto framework {producer_consumer::make_framework<queue_t>(
+            [](queue_t& queue){ queue.wait_and_push(1); }, 2,
+            [&popped](queue_t& queue){ while(true) { (void)queue.wait_and_pop(); ++popped; } }, 2,
+            [&popped](queue_t&){ while(popped < 2) std::this_thread::yield(); })};
+        framework.run();
+        framework.stop();
+        EXPECT_EQ(popped, 2);
+    }
+}
+
+TEST(TEST_QUEUE, batch_consumer)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    using data_t = std::uint64_t;
+    static constexpr data_t burst {10000};
+    static constexpr data_t trickle {5};
+    static constexpr std::size_t max_batch_size {16};
+    using queue_t = Queue<data_t, 1024>;
+    using framework_t = producer_consumer::Framework<data_t, queue_t>;
+
+    std::atomic<data_t> consumed {0};
+    std::atomic<data_t> sum {0};
+    std::atomic<std::size_t> calls {0};
+    std::atomic<std::size_t> max_size {0};
+
+    // a burst is batched, a trickle is passed on after linger time
+    auto producer = [](std::stop_token stop_token, queue_t& queue)
+    {
+        for(data_t cntr {0}; cntr < burst; ++cntr)
+            EXPECT_TRUE(queue.wait_and_push(cntr, stop_token));
+        for(data_t cntr {burst}; cntr < burst + trickle; ++cntr)
+        {
+            std::this_thread::sleep_for(milliseconds(10));
+            EXPECT_TRUE(queue.wait_and_push(cntr, stop_token));
+        }
+    };
+    auto consumer = [&](std::span<data_t> batch)
+    {
+        EXPECT_FALSE(batch.empty());
+        EXPECT_LE(batch.size(), max_batch_size);
+        sum += std::accumulate(batch.begin(), batch.end(), data_t{0});
+        for(auto max {max_size.load()}; batch.size() > max && !max_size.compare_exchange_weak(max, batch.size());)
+            ;
+        ++calls;
+        consumed += batch.size();
+    };
+    auto main_cycle = [&consumed](queue_t&)
+    {
+        const auto deadline {steady_clock::now() + seconds(10)};
+        while(consumed < burst + trickle && steady_clock::now() < deadline)
+            std::this_thread::sleep_for(milliseconds(1));
+    };
+
+    framework_t framework {producer, 1, consumer, 2, main_cycle};
+    EXPECT_TRUE(framework.batch_mode());
+    EXPECT_FALSE(framework.spsc_mode());
+    framework.set_batching(max_batch_size, milliseconds(2));
+    framework.run();
+    framework.stop();
+
+    EXPECT_EQ(consumed, burst + trickle);
+    EXPECT_EQ(sum, (burst + trickle) * (burst + trickle - 1) / 2);
+    EXPECT_EQ(max_size, max_batch_size);
+
+    const auto stats {framework.batching_stats()};
+    EXPECT_EQ(std::accumulate(stats.batch_sizes.begin(), stats.batch_sizes.end(), std::uint64_t{0}), calls);
+    EXPECT_EQ(std::accumulate(stats.linger_times.begin(), stats.linger_times.end(), std::uint64_t{0}), calls);
+    EXPECT_EQ(stats.batch_sizes[0], 0);
+    EXPECT_GE(stats.batch_sizes[1], trickle);
+    EXPECT_GT(stats.batch_sizes[std::bit_width(max_batch_size)], 0);
+    std::cout << consumed << " elements in " << calls << " batches" << std::endl;
+}
+
+TEST(TEST_QUEUE, overflow_policies)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    using queue_t = Queue<int, 4>;
+
+    std::vector<std::pair<int, OverflowPolicy>> dropped;
+    auto on_drop = [&dropped](int&& v, OverflowPolicy policy){ dropped.emplace_back(v, policy); };
+    auto fill = [](queue_t& queue)
+    {
+        for(int cntr {0}; cntr < 4; ++cntr)
+            queue.wait_and_push(cntr);
+    };
+    auto contents = [](auto& queue)
+    {
+        std::vector<int> v;
+        static_cast<void>(queue.drain(std::back_inserter(v)));
+        return v;
+    };
+
+    {
+        queue_t queue;
+        queue.set_overflow({.policy = OverflowPolicy::reject_newest, .on_drop = on_drop});
+        fill(queue);
+        queue.wait_and_push(4);
+        EXPECT_FALSE(queue.wait_and_push(5, std::stop_token{}));
+        EXPECT_EQ(contents(queue), (std::vector<int>{0, 1, 2, 3}));
+        EXPECT_EQ(queue.overflow_stats().rejected, 2);
+        EXPECT_EQ(dropped, (std::vector<std::pair<int, OverflowPolicy>>{{4, OverflowPolicy::reject_newest}, {5, OverflowPolicy::reject_newest}}));
+        dropped.clear();
+    }
+    {
+        queue_t queue;
+        queue.set_overflow({.policy = OverflowPolicy::drop_oldest, .on_drop = on_drop});
+        fill(queue);
+        EXPECT_TRUE(queue.wait_and_push(4, std::stop_token{}));
+        queue.wait_and_push(5);
+        EXPECT_TRUE(queue.full());
+        EXPECT_EQ(contents(queue), (std::vector<int>{2, 3, 4, 5}));
+        EXPECT_EQ(queue.overflow_stats().evicted, 2);
+        EXPECT_EQ(dropped, (std::vector<std::pair<int, OverflowPolicy>>{{0, OverflowPolicy::drop_oldest}, {1, OverflowPolicy::drop_oldest}}));
+        dropped.clear();
+    }
+    {
+        queue_t queue;
+        queue.set_overflow({.policy = OverflowPolicy::block, .timeout = milliseconds(20), .on_drop = on_drop});
+        fill(queue);
+        const auto start {steady_clock::now()};
+        EXPECT_FALSE(queue.wait_and_push(4, std::stop_token{}));
+        EXPECT_GE(steady_clock::now() - start, milliseconds(20));
+        EXPECT_EQ(queue.overflow_stats().timed_out, 1);
+        EXPECT_EQ(dropped.size(), 1);
+
+        // space freed during the wait is taken
+        std::jthread consumer {[&queue]{ std::this_thread::sleep_for(milliseconds(5)); static_cast<void>(queue.try_pop()); }};
+        EXPECT_TRUE(queue.wait_and_push(5, std::stop_token{}));
+        EXPECT_EQ(queue.overflow_stats().dropped(), 1);
+        dropped.clear();
+    }
+    {
+        // odd elements have higher priority, so they are dropped less often
+        static constexpr int num_of_elements {1000};
+        Queue<int> queue(100);
+        EXPECT_THROW(queue.set_overflow({.policy = OverflowPolicy::sample_drop}), std::invalid_argument);
+        queue.set_overflow({.policy = OverflowPolicy::sample_drop, .sample_threshold = 50,
+                            .priority = [](const int& v){ return static_cast<std::size_t>(v % 2) * 3; }, .on_drop = on_drop});
+        for(int cntr {0}; cntr < num_of_elements; ++cntr)
+            queue.wait_and_push(cntr);
+        const auto stats {queue.overflow_stats()};
+        const auto kept {contents(queue)};
+        EXPECT_EQ(kept.size(), 100);
+        EXPECT_EQ(kept.size() + stats.dropped(), num_of_elements);
+        EXPECT_EQ(dropped.size(), stats.dropped());
+        EXPECT_GT(stats.sampled, 0);
+        EXPECT_GT(stats.rejected, 0);
+        const auto odd {std::ranges::count_if(kept, [](int v){ return v % 2; })};
+        EXPECT_GT(odd, static_cast<std::ptrdiff_t>(kept.size()) - odd);
+    }
+}
+
+TEST(TEST_QUEUE, journal)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    const auto dir {fs::temp_directory_path() / "test_queue_journal"};
+    fs::remove_all(dir);
+
+    auto contents = [](auto& queue)
+    {
+        std::vector<typename std::remove_reference_t<decltype(queue)>::value_type> v;
+        static_cast<void>(queue.drain(std::back_inserter(v)));
+        return v;
+    };
+
+    {
+        // small compaction size to take snapshots while elements are pushed and popped
+        Journal<int> journal {dir, milliseconds(1), 256};
+        Queue<int, 1024> queue;
+        EXPECT_EQ(journal.replay(queue), 0);
+        queue.set_journal(&journal);
+        for(int cntr {0}; cntr < 1000; ++cntr)
+        {
+            queue.wait_and_push(cntr);
+            if(cntr % 3 == 0)
+                static_cast<void>(queue.try_pop());
+        }
+        journal.flush();
+        const auto stats {journal.stats()};
+        EXPECT_EQ(stats.records, 1000 + 334);
+        EXPECT_GT(stats.compactions, 1);
+        EXPECT_LT(stats.commits, stats.records);
+    }
+    // one generation is left: a snapshot and the log after it
+    EXPECT_EQ(std::distance(fs::directory_iterator{dir}, fs::directory_iterator{}), 2);
+    {
+        Journal<int> journal {dir};
+        Queue<int, 1024> queue;
+        EXPECT_EQ(journal.replay(queue), 666);
+        const auto v {contents(queue)};
+        EXPECT_EQ(v.front(), 334);
+        EXPECT_EQ(v.back(), 999);
+        EXPECT_TRUE(std::ranges::is_sorted(v));
+
+        // a torn record at the end of log is ignored
+        queue.set_journal(&journal);
+        queue.wait_and_push(1);
+        queue.wait_and_push(2);
+        journal.flush();
+        for(const auto& entry:fs::directory_iterator{dir})
+        {
+            if(entry.path().filename().string().starts_with("wal."))
+                fs::resize_file(entry.path(), fs::file_size(entry.path()) - 1);
+        }
+        Queue<int, 1024> replayed;
+        EXPECT_EQ(journal.replay(replayed), 1);
+        queue.set_journal(nullptr);
+    }
+    fs::remove_all(dir);
+    {
+        // a snapshot, that can't be written, doesn't drop records it supersedes
+        Journal<int> journal {dir, hours(1)};
+        Queue<int, 16> queue;
+        queue.set_journal(&journal);
+        journal.flush();
+        queue.wait_and_push(1);
+        queue.wait_and_push(2);
+        fs::create_directory(dir / "snapshot.2.tmp");
+        queue.set_journal(&journal);
+        queue.wait_and_push(3);
+        EXPECT_THROW(journal.flush(), std::system_error);
+        Queue<int, 16> replayed;
+        EXPECT_EQ(journal.replay(replayed), 3);
+        EXPECT_EQ(contents(replayed), (std::vector<int>{1, 2, 3}));
+        queue.set_journal(nullptr);
+    }
+    fs::remove_all(dir);
+    {
+        Journal<std::string> journal {dir};
+        Queue<std::string, 16> queue;
+        queue.set_journal(&journal);
+        queue.wait_and_push("one");
+        queue.wait_and_push("two");
+        queue.wait_and_push("three");
+        static_cast<void>(queue.try_pop());
+        journal.flush();
+        Queue<std::string, 16> replayed;
+        EXPECT_EQ(journal.replay(replayed), 2);
+        EXPECT_EQ(contents(replayed), (std::vector<std::string>{"two", "three"}));
+    }
+    fs::remove_all(dir);
+
+    // the cost of a journaled push and pop doesn't depend on queue depth
+    for(std::size_t depth:{std::size_t{16}, std::size_t{16384}})
+    {
+        static constexpr int num_of_operations {100000};
+        Journal<int> journal {dir};
+        Queue<int> queue(depth + 1);
+        for(std::size_t cntr {0}; cntr < depth; ++cntr)
+            queue.wait_and_push(static_cast<int>(cntr));
+        queue.set_journal(&journal);
+        const auto start {steady_clock::now()};
+        for(int cntr {0}; cntr < num_of_operations; ++cntr)
+        {
+            queue.wait_and_push(cntr);
+            static_cast<void>(queue.try_pop());
+        }
+        journal.flush();
+        const auto elapsed {duration_cast<nanoseconds>(steady_clock::now() - start)};
+        queue.set_journal(nullptr);
+        std::cout << "journaled push and pop at depth " << depth << ": "
+                  << elapsed.count() / num_of_operations << " ns" << std::endl;
+        fs::remove_all(dir);
+    }
+}
+
+template<serialization::ArchiveType ArType, typename Queue> void check_snapshot(const std::filesystem::path& path)
+{
+    using namespace serialization;
+    Queue queue(1000);
+    for(int cntr {0}; cntr < 1000; ++cntr)
+        queue.wait_and_push(cntr);
+
+    std::filesystem::remove(path);
+    Serializer<Queue, ArType> serializer {path};
+    serializer << queue;
+    Queue loaded(1000);
+    serializer >> loaded;
+    EXPECT_TRUE(loaded == queue);
+
+    // the queue isn't locked while the snapshot is written
+    std::filesystem::remove(path);
+    auto saved {serializer.save_async(queue)};
+    std::vector<int> popped;
+    static_cast<void>(queue.drain(std::back_inserter(popped)));
+    EXPECT_EQ(popped.size(), 1000);
+    const auto hold_time {saved.get()};
+    EXPECT_GT(hold_time.count(), 0);
+    Queue restored(1000);
+    serializer >> restored;
+    EXPECT_TRUE(restored == loaded);
+    std::cout << "snapshot of 1000 elements held queue lock for " << hold_time.count() << " ns" << std::endl;
+    std::filesystem::remove(path);
+}
+
+TEST(TEST_QUEUE, snapshot)
+{
+    using namespace threadsafe_containers;
+    using serialization::ArchiveType;
+    const auto path {fs::temp_directory_path() / "test_queue_snapshot"};
+    check_snapshot<ArchiveType::BINARY, Queue<int>>(path);
+    check_snapshot<ArchiveType::TEXT, Queue<int>>(path);
+    check_snapshot<ArchiveType::XML, Queue<int>>(path);
+    check_snapshot<ArchiveType::TEXT, Queue<int, 2, BlockingWait, std::deque>>(path);
+
+    Queue<int, 8> queue;
+    for(int cntr {0}; cntr < 5; ++cntr)
+        queue.wait_and_push(cntr);
+    const auto snapshot {queue.snapshot()};
+    queue.clear();
+    EXPECT_EQ(snapshot.elements().size(), 5);
+    EXPECT_EQ(snapshot.elements()[4], 4);
+}
+
+TEST(TEST_QUEUE, kept_open_serializer)
+{
+    using namespace std::chrono;
+    using namespace serialization;
+    using queue_t = threadsafe_containers::Queue<int, 1000>;
+    static constexpr int num_of_checkpoints {2000};
+    const auto path {std::filesystem::temp_directory_path() / "test_queue_checkpoints"};
+
+    // frequent checkpoints of a short queue, where opening the file is a large part of a save
+    queue_t queue;
+    for(int cntr {0}; cntr < 16; ++cntr)
+        queue.wait_and_push(cntr);
+
+    auto checkpoints = [&](bool keep_open)
+    {
+        std::filesystem::remove(path);
+        Serializer<queue_t, ArchiveType::BINARY> serializer {path};
+        if(keep_open)
+            serializer.keep_open();
+        const auto start {steady_clock::now()};
+        for(int cntr {0}; cntr < num_of_checkpoints; ++cntr)
+            serializer << queue;
+        const auto elapsed {duration_cast<microseconds>(steady_clock::now() - start)};
+        serializer.sync();
+
+        queue_t loaded;
+        serializer >> loaded;
+        EXPECT_TRUE(loaded == queue);
+        return std::make_pair(elapsed, std::filesystem::file_size(path));
+    };
+    const auto [kept_open, kept_open_size] {checkpoints(true)};
+    const auto [reopened, reopened_size] {checkpoints(false)};
+    EXPECT_EQ(kept_open_size, reopened_size);
+    std::cout << num_of_checkpoints << " checkpoints, file reopened | kept open (us): "
+              << reopened.count() << " | " << kept_open.count() << std::endl;
+
+    // buffered data reaches the file on flush
+    std::filesystem::remove(path);
+    Serializer<queue_t, ArchiveType::TEXT> serializer {path};
+    serializer.keep_open(1 << 20);
+    serializer << queue;
+    EXPECT_EQ(std::filesystem::file_size(path), 0);
+    serializer.flush();
+    const auto size {std::filesystem::file_size(path)};
+    EXPECT_GT(size, 0);
+    EXPECT_GT(serializer.save_async(queue).get().count(), 0);
+    serializer.close();
+    EXPECT_EQ(std::filesystem::file_size(path), 2 * size);
+
+    // clear drops buffered data with the file, so it isn't written after
+    serializer.keep_open(1 << 20);
+    serializer << queue;
+    serializer.clear();
+    serializer.flush();
+    EXPECT_EQ(std::filesystem::file_size(path), 0);
+    serializer << queue;
+    serializer.close();
+    EXPECT_EQ(std::filesystem::file_size(path), size);
+
+    // overlapping saves to a file, that isn't kept open, append whole archives
+    static constexpr int num_of_saves {8};
+    std::filesystem::remove(path);
+    Serializer<queue_t, ArchiveType::BINARY> binary_serializer {path};
+    binary_serializer << queue;
+    const auto archive_size {std::filesystem::file_size(path)};
+    binary_serializer.clear();
+    std::vector<std::future<nanoseconds>> saves;
+    for(int cntr {0}; cntr < num_of_saves; ++cntr)
+        saves.push_back(binary_serializer.save_async(queue));
+    for(auto& saved:saves)
+        static_cast<void>(saved.get());
+    EXPECT_EQ(std::filesystem::file_size(path), num_of_saves * archive_size);
+    std::ifstream file {path, std::ifstream::in | std::ifstream::binary};
+    for(int cntr {0}; cntr < num_of_saves; ++cntr)
+    {
+        queue_t loaded;
+        boost::archive::binary_iarchive ar {file};
+        ar >> loaded;
+        EXPECT_TRUE(loaded == queue);
+    }
+    file.close();
+    std::filesystem::remove(path);
+}
+
+TEST(TEST_QUEUE, mapped_snapshot)
+{
+    using namespace std::chrono;
+    using namespace threadsafe_containers;
+    const auto path {std::filesystem::temp_directory_path() / "test_queue_mapped"};
+
+    {
+        Queue<std::string, 8> queue;
+        queue.wait_and_push("first");
+        queue.wait_and_push("");
+        queue.wait_and_push(std::string(1000, 'x'));
+        MappedSnapshot<std::string>::save(path, queue);
+        MappedSnapshot<std::string> snapshot {path};
+        EXPECT_EQ(snapshot.size(), 3);
+        EXPECT_EQ(snapshot[2], std::string(1000, 'x'));
+        EXPECT_EQ(snapshot.try_pop(), "first");
+        EXPECT_EQ(snapshot.try_pop(), "");
+        EXPECT_EQ(snapshot.remaining(), 1);
+        EXPECT_EQ(snapshot.try_pop()->size(), 1000);
+        EXPECT_FALSE(snapshot.try_pop());
+        EXPECT_THROW(MappedSnapshot<int>{path}, std::runtime_error);
+    }
+    {
+        std::filesystem::resize_file(path, 40);
+        EXPECT_THROW(MappedSnapshot<std::string>{path}, std::runtime_error);
+    }
+    {
+        // offset table is checked at map time: offsets after the header of 32 bytes
+        auto corrupt_offset = [&](std::size_t pos, std::uint64_t offset)
+        {
+            std::fstream file {path, std::ios::in | std::ios::out | std::ios::binary};
+            file.seekp(static_cast<std::streamoff>(32 + pos * sizeof(offset)));
+            file.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        };
+        Queue<std::string, 8> strings;
+        strings.wait_and_push("first");
+        strings.wait_and_push("second");
+        MappedSnapshot<std::string>::save(path, strings);
+        corrupt_offset(1, 1000);
+        EXPECT_THROW(MappedSnapshot<std::string>{path}, std::runtime_error);
+        MappedSnapshot<std::string>::save(path, strings);
+        corrupt_offset(1, 6);
+        corrupt_offset(2, 3);
+        EXPECT_THROW(MappedSnapshot<std::string>{path}, std::runtime_error);
+
+        Queue<std::uint64_t, 8> numbers;
+        numbers.wait_and_push(1);
+        numbers.wait_and_push(2);
+        MappedSnapshot<std::uint64_t>::save(path, numbers);
+        EXPECT_EQ(MappedSnapshot<std::uint64_t>{path}[1], 2);
+        corrupt_offset(1, 16);
+        EXPECT_THROW(MappedSnapshot<std::uint64_t>{path}, std::runtime_error);
+        EXPECT_FALSE(std::filesystem::exists(path.string() + ".tmp"));
+    }
+
+    // startup: a saved queue is mapped instead of loaded by Serializer
+    static constexpr int num_of_elements {200000};
+    using queue_t = Queue<std::uint64_t>;
+    queue_t queue(num_of_elements);
+    for(int cntr {0}; cntr < num_of_elements; ++cntr)
+        queue.wait_and_push(cntr);
+    MappedSnapshot<std::uint64_t>::save(path, queue);
+    const auto archive {std::filesystem::temp_directory_path() / "test_queue_mapped_archive"};
+    std::filesystem::remove(archive);
+    serialization::Serializer<queue_t, serialization::ArchiveType::BINARY> serializer {archive};
+    serializer << queue;
+
+    auto start {steady_clock::now()};
+    queue_t loaded(num_of_elements);
+    serializer >> loaded;
+    const auto parsed {duration_cast<microseconds>(steady_clock::now() - start)};
+
+    start = steady_clock::now();
+    MappedSnapshot<std::uint64_t> snapshot {path};
+    const auto mapped {duration_cast<microseconds>(steady_clock::now() - start)};
+    EXPECT_EQ(snapshot.size(), num_of_elements);
+
+    std::atomic<std::uint64_t> sum {0};
+    {
+        std::vector<std::jthread> consumers;
+        for(int cntr {0}; cntr < 4; ++cntr)
+            consumers.emplace_back([&]{
+                std::uint64_t local {0};
+                while(const auto v {snapshot.try_pop()})
+                    local += *v;
+                sum += local;
+            });
+    }
+    EXPECT_EQ(sum, std::uint64_t{num_of_elements} * (num_of_elements - 1) / 2);
+    std::cout << num_of_elements << " elements at startup, archive parsed | file mapped (us): "
+              << parsed.count() << " | " << mapped.count() << std::endl;
+    std::filesystem::remove(path);
+    std::filesystem::remove(archive);
+}
+
+template<serialization::ArchiveType ArType, typename Queue>
+std::pair<std::chrono::microseconds, std::chrono::microseconds> save_and_load(const Queue& queue, const std::filesystem::path& path)
+{
+    using namespace std::chrono;
+    std::filesystem::remove(path);
+    serialization::Serializer<Queue, ArType> serializer {path};
+    auto start {steady_clock::now()};
+    serializer << queue;
+    const auto saved {duration_cast<microseconds>(steady_clock::now() - start)};
+    Queue loaded(queue.max_size());
+    start = steady_clock::now();
+    serializer >> loaded;
+    const auto load_time {duration_cast<microseconds>(steady_clock::now() - start)};
+    EXPECT_TRUE(loaded == queue);
+    std::filesystem::remove(path);
+    return {saved, load_time};
+}
+
+TEST(TEST_QUEUE, raw_archive)
+{
+    using namespace threadsafe_containers;
+    using namespace serialization;
+    static_assert(fastest_archive_type<Queue<std::uint64_t>> == ArchiveType::RAW);
+    static_assert(fastest_archive_type<Queue<std::string>> == ArchiveType::BINARY);
+    static_assert(std::is_same_v<Serializer<Queue<std::uint64_t>>, Serializer<Queue<std::uint64_t>, ArchiveType::RAW>>);
+    const auto path {std::filesystem::temp_directory_path() / "test_queue_raw"};
+
+    // elements wrap around the end of ring buffer, so they are written in two parts
+    {
+        using queue_t = Queue<std::uint32_t, 8>;
+        queue_t queue;
+        for(std::uint32_t cntr {0}; cntr < 6; ++cntr)
+            queue.wait_and_push(cntr);
+        for(std::uint32_t cntr {0}; cntr < 4; ++cntr)
+            static_cast<void>(queue.try_pop());
+        for(std::uint32_t cntr {6}; cntr < 12; ++cntr)
+            queue.wait_and_push(cntr);
+        save_and_load<ArchiveType::RAW>(queue, path);
+
+        Serializer<queue_t, ArchiveType::RAW> serializer {path};
+        serializer.keep_open();
+        serializer << queue;
+        static_cast<void>(serializer.save_async(queue).get());
+        serializer.close();
+        EXPECT_EQ(std::filesystem::file_size(path), 2 * (sizeof(RawHeader) + 8 * sizeof(std::uint32_t)));
+        queue_t loaded;
+        serializer >> loaded;
+        EXPECT_TRUE(loaded == queue);
+
+        using other_t = Queue<std::uint64_t, 8>;
+        Serializer<other_t, ArchiveType::RAW> other {path};
+        other_t wrong;
+        EXPECT_THROW(other >> wrong, serialization::Exception);
+        // a queue, that can't keep the archive, keeps it's elements
+        using small_t = Queue<std::uint32_t, 4>;
+        Serializer<small_t, ArchiveType::RAW> small_serializer {path};
+        small_t small;
+        small.wait_and_push(42);
+        EXPECT_THROW(small_serializer >> small, serialization::Exception);
+        EXPECT_EQ(small.size(), 1);
+        // the same for a queue, that has space, but stops pushes at it's high watermark
+        Serializer<queue_t> watermarked_serializer {path};
+        queue_t watermarked(8, 4, 2);
+        watermarked.wait_and_push(42);
+        EXPECT_THROW(watermarked_serializer >> watermarked, serialization::Exception);
+        EXPECT_EQ(watermarked.size(), 1);
+        std::filesystem::resize_file(path, sizeof(RawHeader) + 1);
+        EXPECT_THROW(serializer >> loaded, serialization::Exception);
+        std::filesystem::remove(path);
+    }
+
+    static constexpr std::size_t num_of_elements {200000};
+    using queue_t = Queue<std::uint64_t>;
+    queue_t queue(num_of_elements);
+    for(std::size_t cntr {0}; cntr < num_of_elements; ++cntr)
+        queue.wait_and_push(cntr * 7919);
+    const auto raw {save_and_load<ArchiveType::RAW>(queue, path)};
+    const auto binary {save_and_load<ArchiveType::BINARY>(queue, path)};
+    const auto text {save_and_load<ArchiveType::TEXT>(queue, path)};
+    const auto xml {save_and_load<ArchiveType::XML>(queue, path)};
+    std::cout << num_of_elements << " elements save | load (us)" << std::endl
+              << "RAW:    " << raw.first.count() << " | " << raw.second.count() << std::endl
+              << "BINARY: " << binary.first.count() << " | " << binary.second.count() << std::endl
+              << "TEXT:   " << text.first.count() << " | " << text.second.count() << std::endl
+              << "XML:    " << xml.first.count() << " | " << xml.second.count() << std::endl;
+}
+
 /*
 TEST(TEST_QUEUE, producer_consumer_framework)
 {